@@ -0,0 +1,53 @@
+#ifndef __BENCH__H__
+#define __BENCH__H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * what the check and bench tools of the harness codecs share. Each tool
+ * counts its mismatches in errors and hands its checks and its benchmark
+ * to bench_main, which runs the benchmark only if the checks pass and
+ * --check was not given.
+ */
+static int errors;
+
+static inline uint32_t
+rnd32(void)
+{
+	return ((uint32_t)rand() << 16) ^ rand();
+}
+
+/* monotonic seconds */
+static inline double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* returns the exit code of the tool, 1 if any check failed */
+static inline int
+bench_main(int argc, char **argv, void (*checks)(void), void (*bench)(void),
+	const char *ok)
+{
+	checks();
+	if (errors) {
+		printf("%d errors\n", errors);
+		return 1;
+	}
+	printf("%s\n", ok);
+	if (argc > 1 && strcmp(argv[1], "--check") == 0)
+		return 0;
+	bench();
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <utility>
+#include "cmds.h"
+#include "bench.h"
+
+/*
+ * checks of the command encoders gencmds.pl generates: every command is
+ * framed with values of all lengths and decoded again with cmd_decode,
+ * commands with a string with the shortest and the longest one that
+ * fits. Frames are checked against the limits of framing.v, cmddefs
+ * against cmd_def. Exits 1 if anything differs
+ */
+#define ROUNDS		1000
+
+/* values of all VLQ lengths, negative ones included */
+static uint32_t
+rnd_val(void)
+{
+	return rnd32() >> rand() % 32 ^ -(uint32_t)(rand() & 1);
+}
+
+template <int CMD, size_t N, size_t... I>
+static int
+frame_of(uint8_t (&buf)[N], int seq, const uint32_t *v,
+	std::index_sequence<I...>)
+{
+	return cmd_frame<CMD>(buf, seq, v[I]...);
+}
+
+/* a round trip of CMD with nstr bytes of string */
+template <int CMD, int NSTR>
+static void
+roundtrip(void)
+{
+	typedef cmd_def<CMD> def;
+	const int nv = def::nvals + NSTR;
+	uint8_t frame[def::frame_max];
+	uint32_t in[nv + 1];
+	uint32_t out[def::nargs + CMD_MAXSTRING];
+	uint16_t crc;
+	int len;
+	int ret;
+	int i;
+
+	for (i = 0; i < def::nvals; ++i)
+		in[i] = rnd_val();
+	for (; i < nv; ++i)
+		in[i] = rand() & 0xff;
+	len = frame_of<CMD>(frame, rand() & 0xf, in,
+		std::make_index_sequence<nv>());
+
+	crc = crc16_ccitt(frame, len - 3);
+	if (len > CMD_FRAME_MAX || len > def::frame_max || frame[0] != len ||
+	    frame[len - 3] != crc >> 8 || frame[len - 2] != (crc & 0xff) ||
+	    frame[len - 1] != 0x7e) {
+		printf("%s: bad frame of %d bytes\n", cmddefs[CMD].name, len);
+		++errors;
+		return;
+	}
+
+	ret = cmd_decode<CMD>(frame + 2, len - 5, out);
+	if (ret != def::nargs + NSTR) {
+		printf("%s: decoded %d values, want %d\n", cmddefs[CMD].name,
+			ret, def::nargs + NSTR);
+		++errors;
+		return;
+	}
+	/* the length of the string is the value in front of it */
+	for (i = 0; i < ret; ++i) {
+		uint32_t want = !def::string_arg || i < def::nvals ? in[i] :
+			i == def::nvals ? NSTR : in[i - 1];
+
+		if (out[i] != want) {
+			printf("%s: value %d is %x, want %x\n",
+				cmddefs[CMD].name, i, out[i], want);
+			++errors;
+			return;
+		}
+	}
+
+	/* a payload cut short or of another command is no CMD */
+	if (len > 5 && cmd_decode<CMD>(frame + 2, len - 6, out) != -1) {
+		printf("%s: short payload decoded\n", cmddefs[CMD].name);
+		++errors;
+	}
+	frame[2] ^= 0x20;
+	if (cmd_decode<CMD>(frame + 2, len - 5, out) != -1) {
+		printf("%s: other command decoded\n", cmddefs[CMD].name);
+		++errors;
+	}
+}
+
+template <int CMD>
+struct check {
+	static void
+	run(void)
+	{
+		typedef cmd_def<CMD> def;
+		const cmddef_t *cd = &cmddefs[CMD];
+		int i;
+
+		if (cd->name == NULL || cd->unit != def::unit ||
+		    cd->nargs != def::nargs ||
+		    cd->string_arg != def::string_arg ||
+		    cd->has_response != def::has_response) {
+			printf("command %d: cmddefs differs from cmd_def\n",
+				CMD);
+			++errors;
+		}
+		/* the same three times for commands without a string */
+		for (i = 0; i < ROUNDS; ++i) {
+			roundtrip<CMD, 0>();
+			roundtrip<CMD, def::string_arg ? 1 : 0>();
+			roundtrip<CMD, def::maxstring>();
+		}
+		check<CMD + 1>::run();
+	}
+};
+
+template <>
+struct check<NCMDS> {
+	static void
+	run(void)
+	{
+	}
+};
+
+int
+main(void)
+{
+	check<0>::run();
+	if (errors) {
+		printf("%d errors\n", errors);
+		return 1;
+	}
+	printf("%d commands survive a round trip, frames up to %d bytes\n",
+		NCMDS, CMD_FRAME_MAX);
+
+	return 0;
+}
@@ -192,6 +192,14 @@ module conan #(
 	output wire wdi,
 	output wire wden,
 
+`ifdef VERILATOR
+	/* transaction level host link, see framing */
+	input wire tlm_en,
+	input wire [7:0] tlm_rx_data,
+	input wire tlm_rx_valid,
+	output wire [7:0] tlm_tx_data,
+	output wire tlm_tx_valid,
+`endif
 	input wire fpga1,
 	output wire fpga2,
 	output wire fpga3,
@@ -392,6 +400,13 @@ framing #(
 
 	/* reset */
 	.error(frame_error),
+`ifdef VERILATOR
+	.tlm_en(tlm_en),
+	.tlm_rx_data(tlm_rx_data),
+	.tlm_rx_valid(tlm_rx_valid),
+	.tlm_tx_data(tlm_tx_data),
+	.tlm_tx_valid(tlm_tx_valid),
+`endif
 	.clr(frame_reset)
 /* verilator lint_on PINCONNECTEMPTY */
 );
@@ -0,0 +1,279 @@
+#include <stdint.h>
+#include <stddef.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "crc.h"
+
+/* tk[k][i]: crc of byte i followed by k zero bytes */
+static uint16_t t16[8][256];	/* crc16_ccitt, reflected */
+static uint16_t tx16[8][256];	/* crc16_xmodem */
+static uint32_t t32[8][256];
+static uint8_t t8[256];		/* crc8_tmc, for the bit reversed byte */
+static uint8_t rev8[256];
+static uint8_t t7[256];		/* crc7_sd, shifted left by one */
+static int have_pclmul;
+
+static void __attribute__((constructor))
+crc_init(void)
+{
+	int i;
+	int j;
+	int k;
+
+	for (i = 0; i < 256; ++i) {
+		uint16_t c16 = i;
+		uint16_t x16 = i << 8;
+		uint32_t c32 = i;
+		uint8_t c8 = i;
+		uint8_t c7 = i;
+		uint8_t r = 0;
+
+		for (j = 0; j < 8; ++j) {
+			c16 = (c16 & 1) ? (c16 >> 1) ^ 0x8408 : c16 >> 1;
+			x16 = (x16 & 0x8000) ? (x16 << 1) ^ 0x1021 : x16 << 1;
+			c32 = (c32 & 1) ? (c32 >> 1) ^ 0xedb88320 : c32 >> 1;
+			c8 = (c8 & 0x80) ? (c8 << 1) ^ 0x07 : c8 << 1;
+			c7 = (c7 & 0x80) ? (c7 << 1) ^ (0x09 << 1) : c7 << 1;
+			r |= ((i >> j) & 1) << (7 - j);
+		}
+		t16[0][i] = c16;
+		tx16[0][i] = x16;
+		t32[0][i] = c32;
+		t8[i] = c8;
+		t7[i] = c7;
+		rev8[i] = r;
+	}
+	for (k = 1; k < 8; ++k) {
+		for (i = 0; i < 256; ++i) {
+			uint16_t c16 = t16[k - 1][i];
+			uint16_t x16 = tx16[k - 1][i];
+			uint32_t c32 = t32[k - 1][i];
+
+			t16[k][i] = (c16 >> 8) ^ t16[0][c16 & 0xff];
+			tx16[k][i] = (x16 << 8) ^ tx16[0][x16 >> 8];
+			t32[k][i] = (c32 >> 8) ^ t32[0][c32 & 0xff];
+		}
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	have_pclmul = __builtin_cpu_supports("pclmul") &&
+		__builtin_cpu_supports("sse4.1");
+#endif
+}
+
+uint16_t
+crc16_ccitt_update(uint16_t crc, const uint8_t *p, size_t len)
+{
+	while (len >= 8) {
+		uint16_t lo = crc ^ (p[0] | (p[1] << 8));
+
+		crc = t16[7][lo & 0xff] ^ t16[6][lo >> 8] ^
+			t16[5][p[2]] ^ t16[4][p[3]] ^ t16[3][p[4]] ^
+			t16[2][p[5]] ^ t16[1][p[6]] ^ t16[0][p[7]];
+		p += 8;
+		len -= 8;
+	}
+	while (len--)
+		crc = (crc >> 8) ^ t16[0][(crc ^ *p++) & 0xff];
+
+	return crc;
+}
+
+uint16_t
+crc16_ccitt(const uint8_t *buf, size_t len)
+{
+	return crc16_ccitt_update(0xffff, buf, len);
+}
+
+uint16_t
+crc16_xmodem_update(uint16_t crc, const uint8_t *p, size_t len)
+{
+	while (len >= 8) {
+		uint16_t hi = crc ^ ((p[0] << 8) | p[1]);
+
+		crc = tx16[7][hi >> 8] ^ tx16[6][hi & 0xff] ^
+			tx16[5][p[2]] ^ tx16[4][p[3]] ^ tx16[3][p[4]] ^
+			tx16[2][p[5]] ^ tx16[1][p[6]] ^ tx16[0][p[7]];
+		p += 8;
+		len -= 8;
+	}
+	while (len--)
+		crc = (crc << 8) ^ tx16[0][(crc >> 8) ^ *p++];
+
+	return crc;
+}
+
+uint32_t
+crc32_update_bytewise(uint32_t crc, const uint8_t *p, size_t len)
+{
+	while (len--)
+		crc = (crc >> 8) ^ t32[0][(crc ^ *p++) & 0xff];
+
+	return crc;
+}
+
+uint32_t
+crc32_update_slice8(uint32_t crc, const uint8_t *p, size_t len)
+{
+	while (len >= 8) {
+		uint32_t lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) |
+			((uint32_t)p[3] << 24));
+
+		crc = t32[7][lo & 0xff] ^ t32[6][(lo >> 8) & 0xff] ^
+			t32[5][(lo >> 16) & 0xff] ^ t32[4][lo >> 24] ^
+			t32[3][p[4]] ^ t32[2][p[5]] ^ t32[1][p[6]] ^
+			t32[0][p[7]];
+		p += 8;
+		len -= 8;
+	}
+
+	return crc32_update_bytewise(crc, p, len);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * folding with carry-less multiplies, after "Fast CRC Computation for
+ * Generic Polynomials Using PCLMULQDQ Instruction" (Intel), constants
+ * for the bit reflected domain. len is a multiple of 16, at least 64
+ */
+__attribute__((target("sse4.1,pclmul")))
+static uint32_t
+crc32_fold(uint32_t crc, const uint8_t *p, size_t len)
+{
+	static const uint64_t __attribute__((aligned(16))) k1k2[] = {
+		0x0154442bd4, 0x01c6e41596
+	};
+	static const uint64_t __attribute__((aligned(16))) k3k4[] = {
+		0x01751997d0, 0x00ccaa009e
+	};
+	static const uint64_t __attribute__((aligned(16))) k5k0[] = {
+		0x0163cd6124, 0x0000000000
+	};
+	static const uint64_t __attribute__((aligned(16))) poly[] = {
+		0x01db710641, 0x01f7011641
+	};
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+	p += 64;
+	len -= 64;
+
+	/* four blocks of 16 in parallel */
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+			_mm_loadu_si128((const __m128i *)(p + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+			_mm_loadu_si128((const __m128i *)(p + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+			_mm_loadu_si128((const __m128i *)(p + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+			_mm_loadu_si128((const __m128i *)(p + 0x30)));
+		p += 64;
+		len -= 64;
+	}
+
+	/* fold the four into one */
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* remaining blocks of 16 */
+	while (len >= 16) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+			_mm_loadu_si128((const __m128i *)p));
+		p += 16;
+		len -= 16;
+	}
+
+	/* 128 to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i *)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_extract_epi32(x1, 1);
+}
+#endif
+
+int
+crc32_have_pclmul(void)
+{
+	return have_pclmul;
+}
+
+uint32_t
+crc32_update(uint32_t crc, const uint8_t *p, size_t len)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	if (have_pclmul && len >= 64) {
+		size_t n = len & ~(size_t)15;
+
+		crc = crc32_fold(crc, p, n);
+		p += n;
+		len -= n;
+	}
+#endif
+	return crc32_update_slice8(crc, p, len);
+}
+
+uint32_t
+crc32(const uint8_t *buf, size_t len)
+{
+	return ~crc32_update(0xffffffff, buf, len);
+}
+
+uint8_t
+crc8_tmc(const uint8_t *p, size_t len)
+{
+	uint8_t crc = 0;
+
+	while (len--)
+		crc = t8[crc ^ rev8[*p++]];
+
+	return crc;
+}
+
+uint8_t
+crc7_sd(const uint8_t *p, size_t len)
+{
+	uint8_t crc = 0;
+
+	while (len--)
+		crc = t7[crc ^ *p++];
+
+	return crc >> 1;
+}
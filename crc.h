@@ -0,0 +1,38 @@
+#ifndef __CRC__H__
+#define __CRC__H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * table driven crcs of the harness, for the host link framing, tmcuart
+ * datagrams, ethernet and sd. The 16 and 32 bit ones that see longer
+ * buffers use slice-by-8 tables, crc32 folds with PCLMUL from 64 bytes
+ * on if the cpu has it. Tables are built at startup.
+ * All functions take the crc state of a previous call where that makes
+ * sense, so a buffer can be checked in pieces.
+ *
+ *	crc16_ccitt	framing.v: poly 0x1021 reflected, init 0xffff
+ *	crc16_xmodem	sd data lines: poly 0x1021, init 0
+ *	crc32		ethernet fcs: poly 0x04c11db7 reflected, init and
+ *			final xor 0xffffffff
+ *	crc8_tmc	tmcuart: poly 0x07, bits lsb first, init 0
+ *	crc7_sd		sd commands: poly 0x09, init 0, returns the 7 bits
+ *			without the end bit
+ */
+uint16_t crc16_ccitt(const uint8_t *buf, size_t len);
+uint16_t crc16_ccitt_update(uint16_t crc, const uint8_t *buf, size_t len);
+uint16_t crc16_xmodem_update(uint16_t crc, const uint8_t *buf, size_t len);
+uint32_t crc32(const uint8_t *buf, size_t len);
+/* the raw register, without the final xor */
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, size_t len);
+uint8_t crc8_tmc(const uint8_t *buf, size_t len);
+uint8_t crc7_sd(const uint8_t *buf, size_t len);
+
+/* implementations, for crcbench */
+uint32_t crc32_update_bytewise(uint32_t crc, const uint8_t *buf, size_t len);
+uint32_t crc32_update_slice8(uint32_t crc, const uint8_t *buf, size_t len);
+/* 0 if the cpu can't, the plain table is used then */
+int crc32_have_pclmul(void);
+
+#endif
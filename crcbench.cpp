@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "crc.h"
+#include "bench.h"
+
+/*
+ * known answer tests and throughput of the crc module. The tables are
+ * also checked against the bit serial versions they replaced, over random
+ * buffers of all lengths up to 2k and all alignments.
+ * Exits 1 if anything differs
+ */
+static const uint8_t check[] = "123456789";
+
+/* the bit serial versions, as used by the harness before */
+static uint16_t
+ref_crc16_ccitt(const uint8_t *buf, size_t len)
+{
+	uint16_t crc = 0xffff;
+
+	while (len--) {
+		uint8_t data = *buf++;
+		data ^= crc & 0xff;
+		data ^= data << 4;
+		crc = ((((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4)
+		       ^ ((uint16_t)data << 3));
+	}
+	return crc;
+}
+
+static uint16_t
+ref_crc16_xmodem(const uint8_t *buf, size_t len)
+{
+	uint16_t crc = 0;
+	int j;
+
+	while (len--) {
+		crc ^= *buf++ << 8;
+		for (j = 0; j < 8; ++j)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+static uint32_t
+ref_crc32(const uint8_t *p, size_t len)
+{
+	uint32_t crc = 0xffffffff;
+	size_t i;
+	int j;
+
+	for (i = 0; i < len; ++i) {
+		unsigned int mask;
+
+		crc = crc ^ p[i];
+		for (j = 7; j >= 0; j--) {
+			mask = -(crc & 1);
+			crc = (crc >> 1) ^ (0xEDB88320 & mask);
+		}
+	}
+	return ~crc;
+}
+
+static uint8_t
+ref_crc8_tmc(const uint8_t *b, size_t l)
+{
+	uint8_t crc = 0;
+	uint8_t currentByte;
+	size_t i;
+	int j;
+
+	for (i = 0; i < l; i++) {
+		currentByte = b[i];
+		for (j = 0; j < 8; j++) {
+			if ((crc >> 7) ^ (currentByte & 0x01))
+				crc = (crc << 1) ^ 0x07;
+			else
+				crc = (crc << 1);
+			currentByte = currentByte >> 1;
+		}
+	}
+	return crc;
+}
+
+static uint8_t
+ref_crc7_sd(const uint8_t *b, size_t l)
+{
+	uint8_t crc = 0;
+	size_t i;
+	int j;
+
+	for (i = 0; i < l; i++) {
+		for (j = 7; j >= 0; j--) {
+			int bit = ((b[i] >> j) & 1) ^ ((crc >> 6) & 1);
+
+			crc = (crc << 1) & 0x7f;
+			if (bit)
+				crc ^= 0x09;
+		}
+	}
+	return crc;
+}
+
+static void
+expect(const char *what, uint32_t got, uint32_t want)
+{
+	if (got == want)
+		return;
+	printf("%s: got %08x, expected %08x\n", what, got, want);
+	++errors;
+}
+
+static void
+kat(void)
+{
+	/* sd CMD0, the end bit makes it the well known 0x95 */
+	static const uint8_t cmd0[] = { 0x40, 0, 0, 0, 0 };
+	/* tmcuart read request of register 0x06 of slave 0 */
+	static const uint8_t tmc_read[] = { 0x05, 0x00, 0x06 };
+
+	expect("crc16_ccitt", crc16_ccitt(check, 9), 0x6f91);
+	expect("crc16_xmodem", crc16_xmodem_update(0, check, 9), 0x31c3);
+	expect("crc32", crc32(check, 9), 0xcbf43926);
+	expect("crc7_sd", crc7_sd(check, 9), 0x75);
+	expect("crc7_sd cmd0", (crc7_sd(cmd0, 5) << 1) | 1, 0x95);
+	expect("crc8_tmc", crc8_tmc(tmc_read, 3), 0x6f);
+}
+
+static void
+compare(void)
+{
+	static uint8_t buf[2048 + 16];
+	size_t len;
+	int off;
+	int i;
+
+	for (i = 0; i < (int)sizeof(buf); ++i)
+		buf[i] = rand();
+	for (off = 0; off < 16; ++off) {
+		for (len = 0; len <= 2048; ++len) {
+			const uint8_t *p = buf + off;
+			char what[64];
+
+			snprintf(what, sizeof(what), "len %zu off %d", len, off);
+			if (crc16_ccitt(p, len) != ref_crc16_ccitt(p, len) ||
+			    crc16_xmodem_update(0, p, len) !=
+			    ref_crc16_xmodem(p, len) ||
+			    crc32(p, len) != ref_crc32(p, len) ||
+			    crc8_tmc(p, len) != ref_crc8_tmc(p, len) ||
+			    crc7_sd(p, len) != ref_crc7_sd(p, len)) {
+				printf("mismatch against bit serial at %s\n",
+					what);
+				++errors;
+				return;
+			}
+			/* in two pieces */
+			if (len > 0 && (~crc32_update(crc32_update(0xffffffff,
+			    p, len / 3), p + len / 3, len - len / 3)) !=
+			    ref_crc32(p, len)) {
+				printf("crc32 in pieces differs at %s\n", what);
+				++errors;
+				return;
+			}
+		}
+	}
+}
+
+#define BENCH_BYTES	(256 << 20)
+
+/* MB/s over BENCH_BYTES in buffers of len */
+#define BENCH(name, len, expr) do {					\
+	size_t _n = BENCH_BYTES / (len);				\
+	volatile uint32_t _sink = 0;					\
+	double _t = now();						\
+	size_t _i;							\
+									\
+	for (_i = 0; _i < _n; ++_i)					\
+		_sink += (expr);					\
+	_t = now() - _t;						\
+	printf("%-22s %5d bytes %9.1f MB/s\n", name, (int)(len),	\
+		_n * (double)(len) / _t / 1e6);				\
+} while (0)
+
+static void
+bench(void)
+{
+	static uint8_t buf[1514];
+	static const int lens[] = { 8, 64, 1514 };
+	int i;
+
+	for (i = 0; i < (int)sizeof(buf); ++i)
+		buf[i] = rand();
+	printf("pclmul %s\n", crc32_have_pclmul() ? "available" : "not available");
+	for (i = 0; i < 3; ++i) {
+		size_t len = lens[i];
+
+		BENCH("crc16_ccitt bitserial", len, ref_crc16_ccitt(buf, len));
+		BENCH("crc16_ccitt", len, crc16_ccitt(buf, len));
+		BENCH("crc16_xmodem", len, crc16_xmodem_update(0, buf, len));
+		BENCH("crc32 bitserial", len, ref_crc32(buf, len));
+		BENCH("crc32 bytewise", len,
+			crc32_update_bytewise(0xffffffff, buf, len));
+		BENCH("crc32 slice8", len,
+			crc32_update_slice8(0xffffffff, buf, len));
+		BENCH("crc32", len, crc32(buf, len));
+		BENCH("crc8_tmc", len, crc8_tmc(buf, len));
+		BENCH("crc7_sd", len, crc7_sd(buf, len));
+	}
+}
+
+static void
+checks(void)
+{
+	kat();
+	compare();
+}
+
+int
+main(int argc, char **argv)
+{
+	return bench_main(argc, argv, checks, bench,
+		"known answers and bit serial comparison ok");
+}
@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "daqdemux.h"
+#include "bench.h"
+
+/*
+ * checks and throughput of the daq demultiplexer on synthetic frames, as
+ * mac.v would send them: whole daq packets of the units, up to MAX_PACKET
+ * words, short frames stuffed. Every record is checked against what was
+ * put in. Throughput is given in payload bytes, a saturated 100 Mbit
+ * RMII link is 12.5 MB/s.
+ * Exits 1 if anything differs
+ */
+#define MAX_PACKET	375	/* mac.v */
+#define MIN_PAYLOAD	12	/* 46 bytes, rounded up to words */
+#define SIGNAL_PACKET	100	/* DAQ_PACKET_SIZE of signal.v */
+
+/* record mixes: the logic analyzer, and the small records of the sensors */
+enum { MIX_LA, MIX_SENSOR, NMIX };
+static const char *mix_names[NMIX] = { "logic analyzer", "sensors" };
+
+typedef struct _gen {
+	uint64_t	systime;
+	uint32_t	mcu_high;
+	daq_rec_t	*want;		/* records in the order generated */
+	uint8_t		*src;		/* and their sources */
+	int		nwant;
+	int		maxwant;
+} gen_t;
+
+static void
+gen_want(gen_t *g, int src, const daq_rec_t *r)
+{
+	if (g->want == NULL)
+		return;
+	if (g->nwant == g->maxwant) {
+		printf("too many records generated\n");
+		exit(1);
+	}
+	g->want[g->nwant] = *r;
+	g->src[g->nwant] = src;
+	++g->nwant;
+}
+
+/* one daq packet at w, returns its length, 0 if it does not fit */
+static int
+gen_packet(gen_t *g, int mix, uint32_t *w, int room)
+{
+	daq_rec_t r;
+	int type;
+	int i;
+
+	memset(&r, 0, sizeof(r));
+	g->systime += rand() % 1000;
+	if (mix == MIX_LA)
+		type = rand() % 20 == 0 ? DAQT_SYSTIME_ROLLOVER :
+			rand() % 2 ? DAQT_SIGNAL_DATA : DAQT_ABZ_DATA;
+	else {
+		static const int types[] = {
+			DAQT_MCU_RX, DAQT_MCU_TX, DAQT_MCU_RX_LONG,
+			DAQT_AS5311_DAT, DAQT_AS5311_MAG, DAQT_DRO_DATA,
+			DAQT_DISCARD, DAQT_SYSTIME_SET
+		};
+		type = types[rand() % 8];
+	}
+	r.type = type;
+	r.time = g->systime;
+
+	switch (type) {
+	case DAQT_MCU_RX:
+	case DAQT_MCU_TX:
+	case DAQT_MCU_RX_LONG:
+		if (room < 2)
+			return 0;
+		r.val = rand() & 0xff;
+		r.chan = type == DAQT_MCU_TX;
+		if (type == DAQT_MCU_RX_LONG)
+			g->mcu_high = g->systime >> 16;
+		r.time = (uint64_t)g->mcu_high << 16 | (g->systime & 0xffff);
+		w[0] = type << 24 | r.val << 16 | (g->systime & 0xffff);
+		w[1] = g->mcu_high;
+		gen_want(g, DAQS_MCU, &r);
+		return type == DAQT_MCU_RX_LONG ? 2 : 1;
+	case DAQT_AS5311_DAT:
+	case DAQT_AS5311_MAG:
+		if (room < 2)
+			return 0;
+		r.val = rnd32() & 0x3ffff;
+		r.chan = rand() & 0x3f;
+		w[0] = type << 24 | r.chan << 18 | r.val;
+		w[1] = g->systime;
+		gen_want(g, DAQS_AS5311, &r);
+		return 2;
+	case DAQT_SYSTIME_SET:
+	case DAQT_SYSTIME_ROLLOVER:
+		if (room < 2)
+			return 0;
+		g->systime += rnd32() % 100000;
+		r.time = g->systime;
+		w[0] = type << 24 | (g->systime >> 32);
+		w[1] = g->systime;
+		gen_want(g, DAQS_SYSTIME, &r);
+		return 2;
+	case DAQT_DRO_DATA:
+		if (room < 3)
+			return 0;
+		r.val = rnd32();
+		r.chan = rand() & 0xff;
+		r.bits = 24;
+		w[0] = type << 24 | r.chan << 16 | r.bits << 8;
+		w[1] = r.val;
+		w[2] = g->systime;
+		gen_want(g, DAQS_DRO, &r);
+		return 3;
+	case DAQT_DISCARD:
+		r.val = rnd32() & 0xffffff;
+		r.time = 0;	/* not checked */
+		w[0] = type << 24 | r.val;
+		gen_want(g, DAQS_DISCARD, &r);
+		return 1;
+	default:
+		if (room < 3)
+			return 0;
+		r.len = 1 + rand() % SIGNAL_PACKET;
+		if (room < 2 + r.len)
+			r.len = room - 2;
+		r.offset = rand() % 32;
+		r.rle_len = 12;
+		r.bits = type == DAQT_ABZ_DATA ? 3 : 4;
+		w[0] = type << 24 | r.offset << 18 | r.rle_len << 13 |
+			r.bits << 8 | r.len;
+		w[1] = g->systime;
+		for (i = 0; i < r.len; ++i)
+			w[2 + i] = rnd32();
+		r.data = w + 2;
+		gen_want(g, type == DAQT_ABZ_DATA ? DAQS_ABZ : DAQS_SIGNAL, &r);
+		return 2 + r.len;
+	}
+}
+
+/* a frame of whole packets, returns its length in words */
+static int
+gen_frame(gen_t *g, int mix, uint32_t *w)
+{
+	int len = 0;
+	int ret;
+
+	while ((ret = gen_packet(g, mix, w + len, MAX_PACKET - len)) != 0)
+		len += ret;
+	while (len < MIN_PAYLOAD)
+		w[len++] = 0xffffffff;
+
+	return len;
+}
+
+static int
+same(const daq_rec_t *a, const daq_rec_t *b)
+{
+	if (a->type != b->type || a->val != b->val || a->len != b->len ||
+	    a->chan != b->chan || a->bits != b->bits)
+		return 0;
+	if (a->type != DAQT_DISCARD && a->time != b->time)
+		return 0;
+	if (a->len && (a->data != b->data || a->offset != b->offset ||
+	    a->rle_len != b->rle_len))
+		return 0;
+
+	return 1;
+}
+
+#define CHECK_FRAMES	2000
+
+static void
+compare(int mix)
+{
+	static uint32_t frames[CHECK_FRAMES][MAX_PACKET];
+	static daq_rec_t want[CHECK_FRAMES * MAX_PACKET];
+	static uint8_t src[CHECK_FRAMES * MAX_PACKET];
+	daq_demux_t *dm = daq_demux_new(CHECK_FRAMES * MAX_PACKET);
+	gen_t g;
+	int got[DAQS_N] = { 0 };
+	int total = 0;
+	int i;
+
+	memset(&g, 0, sizeof(g));
+	g.systime = 12345;
+	g.want = want;
+	g.src = src;
+	g.maxwant = CHECK_FRAMES * MAX_PACKET;
+	/* the demux takes times before the first systime record as is */
+	frames[0][0] = DAQT_SYSTIME_SET << 24;
+	frames[0][1] = g.systime;
+	if (daq_demux_frame(dm, frames[0], 2) != 1)
+		++errors;
+	daq_next(dm, DAQS_SYSTIME);
+	for (i = 0; i < CHECK_FRAMES; ++i) {
+		int len = gen_frame(&g, mix, frames[i]);
+		int n = daq_demux_frame(dm, frames[i], len);
+
+		if (n < 0) {
+			printf("%s: frame %d: %s\n", mix_names[mix], i,
+				daq_demux_error(dm));
+			++errors;
+			return;
+		}
+		total += n;
+	}
+	if (total != g.nwant) {
+		printf("%s: %d records, generated %d\n", mix_names[mix], total,
+			g.nwant);
+		++errors;
+	}
+	for (i = 0; i < g.nwant; ++i) {
+		const daq_rec_t *r = daq_next(dm, src[i]);
+
+		if (r == NULL || !same(r, &want[i])) {
+			printf("%s: record %d (%s, %d of its source) differs\n",
+				mix_names[mix], i, daq_type_name(want[i].type),
+				got[src[i]]);
+			++errors;
+			break;
+		}
+		++got[src[i]];
+	}
+	daq_demux_free(dm);
+}
+
+/* broken frames are reported, the records in front of the break kept */
+static void
+broken(void)
+{
+	daq_demux_t *dm = daq_demux_new(16);
+	uint32_t w[8];
+
+	w[0] = DAQT_MCU_RX << 24;
+	w[1] = DAQT_DRO_DATA << 24;
+	w[2] = 0;
+	if (daq_demux_frame(dm, w, 3) != -1 || daq_pending(dm, DAQS_MCU) != 1 ||
+	    daq_pending(dm, DAQS_DRO) != 0) {
+		printf("cut off dro record not detected\n");
+		++errors;
+	}
+	w[1] = DAQT_SIGNAL_DATA << 24 | 6;
+	if (daq_demux_frame(dm, w, 8) != -1) {
+		printf("cut off signal record not detected\n");
+		++errors;
+	}
+	w[1] = 0x42 << 24;
+	if (daq_demux_frame(dm, w, 2) != -1) {
+		printf("unknown type not detected\n");
+		++errors;
+	}
+	/* full rings drop the newest records and count them */
+	daq_demux_flush(dm);
+	for (int i = 0; i < 20; ++i)
+		daq_demux_frame(dm, w, 1);
+	if (daq_pending(dm, DAQS_MCU) != 16 || dm->ring[DAQS_MCU].lost != 4) {
+		printf("full ring not handled\n");
+		++errors;
+	}
+	daq_demux_free(dm);
+}
+
+#define BENCH_FRAMES	256
+#define BENCH_ROUNDS	2000
+
+static void
+bench(void)
+{
+	static uint32_t frames[BENCH_FRAMES][MAX_PACKET];
+	static int lens[BENCH_FRAMES];
+	daq_demux_t *dm = daq_demux_new(1024);
+	volatile uint64_t sink = 0;
+	int mix;
+
+	for (mix = 0; mix < NMIX; ++mix) {
+		gen_t g;
+		uint64_t words = 0;
+		uint64_t recs = 0;
+		double t;
+		int i;
+		int j;
+
+		memset(&g, 0, sizeof(g));
+		for (i = 0; i < BENCH_FRAMES; ++i) {
+			lens[i] = gen_frame(&g, mix, frames[i]);
+			words += lens[i];
+		}
+		t = now();
+		for (j = 0; j < BENCH_ROUNDS; ++j) {
+			for (i = 0; i < BENCH_FRAMES; ++i) {
+				const daq_rec_t *r;
+				int src;
+
+				recs += daq_demux_frame(dm, frames[i], lens[i]);
+				/* consume, as a reader of each source would */
+				for (src = 0; src < DAQS_N; ++src)
+					while ((r = daq_next(dm, src)) != NULL)
+						sink += r->time + r->len;
+			}
+		}
+		t = now() - t;
+		words *= BENCH_ROUNDS;
+		printf("%-15s %6.1f words/frame %8.1f Mrecords/s %8.1f MB/s, "
+			"%.0fx 100 Mbit\n", mix_names[mix],
+			(double)words / BENCH_FRAMES / BENCH_ROUNDS, recs / t / 1e6,
+			words * 4 / t / 1e6, words * 4 / t / 12.5e6);
+	}
+	daq_demux_free(dm);
+}
+
+static void
+checks(void)
+{
+	int mix;
+
+	broken();
+	for (mix = 0; mix < NMIX; ++mix)
+		compare(mix);
+}
+
+int
+main(int argc, char **argv)
+{
+	return bench_main(argc, argv, checks, bench,
+		"demultiplexed records match the generated ones");
+}
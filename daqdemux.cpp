@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "daqdemux.h"
+
+/*
+ * times before the first systime record stay as they are: 32 bit times
+ * are taken as the nearest value to the time base, this one maps them
+ * onto themselves
+ */
+#define DAQ_TIME_INIT	(1ull << 31)
+
+daq_demux_t *
+daq_demux_new(int depth)
+{
+	daq_demux_t *dm = (daq_demux_t *)calloc(1, sizeof(*dm));
+	uint32_t n = 1;
+	int i;
+
+	while (n < (uint32_t)depth)
+		n <<= 1;
+	dm->mask = n - 1;
+	for (i = 0; i < DAQS_N; ++i) {
+		dm->ring[i].rec = (daq_rec_t *)calloc(n, sizeof(daq_rec_t));
+		if (dm->ring[i].rec == NULL) {
+			printf("daqdemux: failed to allocate %d records\n", n);
+			exit(1);
+		}
+	}
+	dm->systime = DAQ_TIME_INIT;
+
+	return dm;
+}
+
+void
+daq_demux_free(daq_demux_t *dm)
+{
+	int i;
+
+	for (i = 0; i < DAQS_N; ++i)
+		free(dm->ring[i].rec);
+	free(dm);
+}
+
+void
+daq_demux_flush(daq_demux_t *dm)
+{
+	int i;
+
+	for (i = 0; i < DAQS_N; ++i)
+		dm->ring[i].tail = dm->ring[i].head;
+}
+
+const char *
+daq_demux_error(const daq_demux_t *dm)
+{
+	return dm->err;
+}
+
+const char *
+daq_type_name(int type)
+{
+	switch (type) {
+	case DAQT_MCU_RX:		return "mcu_rx";
+	case DAQT_MCU_RX_LONG:		return "mcu_rx_long";
+	case DAQT_MCU_TX:		return "mcu_tx";
+	case DAQT_MCU_TX_LONG:		return "mcu_tx_long";
+	case DAQT_AS5311_DAT:		return "as5311_dat";
+	case DAQT_AS5311_MAG:		return "as5311_mag";
+	case DAQT_SYSTIME_SET:		return "systime_set";
+	case DAQT_SYSTIME_ROLLOVER:	return "systime_rollover";
+	case DAQT_DRO_DATA:		return "dro";
+	case DAQT_SIGNAL_DATA:		return "signal";
+	case DAQT_ABZ_DATA:		return "abz";
+	case DAQT_DISCARD:		return "discard";
+	case DAQT_STUFF:		return "stuff";
+	}
+
+	return NULL;
+}
+
+/* the slot for the next record of src */
+static inline daq_rec_t *
+daq_push(daq_demux_t *dm, int src)
+{
+	daq_ring_t *r = &dm->ring[src];
+
+	if (r->head - r->tail > dm->mask) {
+		++r->lost;
+		return &dm->drop;
+	}
+	return &r->rec[r->head++ & dm->mask];
+}
+
+static inline uint64_t
+daq_time(const daq_demux_t *dm, uint32_t t)
+{
+	return dm->systime + (int32_t)(t - (uint32_t)dm->systime);
+}
+
+int
+daq_demux_frame(daq_demux_t *dm, const uint32_t *w, int len)
+{
+	const uint32_t *end = w + len;
+	const uint32_t *p = w;
+	daq_rec_t *r;
+	uint32_t d;
+	int type;
+	int n = 0;
+
+	while (p < end) {
+		d = *p;
+		type = d >> 24;
+		switch (type) {
+		case DAQT_STUFF:
+			++p;
+			continue;
+		case DAQT_MCU_RX_LONG:
+		case DAQT_MCU_TX_LONG:
+			if (end - p < 2)
+				goto cut;
+			dm->mcu_high = p[1];
+			/* fall through */
+		case DAQT_MCU_RX:
+		case DAQT_MCU_TX:
+			r = daq_push(dm, DAQS_MCU);
+			r->time = (uint64_t)dm->mcu_high << 16 | (d & 0xffff);
+			r->val = (d >> 16) & 0xff;
+			r->chan = (type & ~1) == DAQT_MCU_TX;
+			p += type & 1 ? 2 : 1;
+			break;
+		case DAQT_AS5311_DAT:
+		case DAQT_AS5311_MAG:
+			if (end - p < 2)
+				goto cut;
+			r = daq_push(dm, DAQS_AS5311);
+			r->time = daq_time(dm, p[1]);
+			r->val = d & 0x3ffff;
+			r->chan = (d >> 18) & 0x3f;
+			p += 2;
+			break;
+		case DAQT_SYSTIME_SET:
+		case DAQT_SYSTIME_ROLLOVER:
+			if (end - p < 2)
+				goto cut;
+			dm->systime = (uint64_t)(d & 0xffffff) << 32 | p[1];
+			r = daq_push(dm, DAQS_SYSTIME);
+			r->time = dm->systime;
+			p += 2;
+			break;
+		case DAQT_DRO_DATA:
+			if (end - p < 3)
+				goto cut;
+			r = daq_push(dm, DAQS_DRO);
+			r->time = daq_time(dm, p[2]);
+			r->val = p[1];
+			r->chan = (d >> 16) & 0xff;
+			r->bits = (d >> 8) & 0xff;
+			p += 3;
+			break;
+		case DAQT_SIGNAL_DATA:
+		case DAQT_ABZ_DATA:
+			if (end - p < 2 + (d & 0xff))
+				goto cut;
+			r = daq_push(dm, type == DAQT_ABZ_DATA ? DAQS_ABZ :
+				DAQS_SIGNAL);
+			r->time = daq_time(dm, p[1]);
+			r->data = p + 2;
+			r->len = d & 0xff;
+			r->offset = (d >> 18) & 0x3f;
+			r->rle_len = (d >> 13) & 0x1f;
+			r->bits = (d >> 8) & 0x1f;
+			p += 2 + r->len;
+			break;
+		case DAQT_DISCARD:
+			r = daq_push(dm, DAQS_DISCARD);
+			r->time = dm->systime;
+			r->val = d & 0xffffff;
+			++p;
+			break;
+		default:
+			snprintf(dm->err, sizeof(dm->err),
+				"unknown daq record type %d at word %d", type,
+				(int)(p - w));
+			return -1;
+		}
+		r->type = type;
+		++n;
+	}
+
+	return n;
+
+cut:
+	snprintf(dm->err, sizeof(dm->err), "%s record cut off at word %d",
+		daq_type_name(type), (int)(p - w));
+	return -1;
+}
@@ -0,0 +1,128 @@
+#ifndef __DAQDEMUX__H__
+#define __DAQDEMUX__H__
+
+#include <stdint.h>
+
+/*
+ * splits the payload of the ethernet frames of daq.v into its records
+ * and queues them per source. A frame holds whole daq packets, each
+ * starting with a word with the record type in the top byte:
+ *
+ *	DAQT_MCU_RX/TX		uartlog.v: byte in 23:16, time 15:0. The
+ *				_LONG ones are followed by time 47:16
+ *	DAQT_AS5311_DAT/MAG	channel 23:18, data 17:0, then the time
+ *	DAQT_SYSTIME_*		systime 55:32 in 23:0, then 31:0
+ *	DAQT_DRO_DATA		channel 23:16, bits 15:8, then data, time
+ *	DAQT_SIGNAL/ABZ_DATA	signal.v: offset 23:18, rle_len 17:13,
+ *				sig_width 12:8, len 7:0, then the time and
+ *				len words of rle data
+ *	DAQT_DISCARD		daq.v: packets discarded since the last one
+ *	DAQT_STUFF		mac.v fills short frames with these
+ *
+ * Words are in host order, as get_packet returns them. Times are 32 bit
+ * in most records and extended to 64 bit with the last systime record.
+ * Each source has a ring of records allocated upfront. The rle data of
+ * signal records is not copied, data points into the frame, which has
+ * to stay around until the record is consumed.
+ */
+enum {
+	DAQT_MCU_RX		= 8,
+	DAQT_MCU_RX_LONG	= 9,
+	DAQT_MCU_TX		= 10,
+	DAQT_MCU_TX_LONG	= 11,
+	DAQT_AS5311_DAT		= 16,
+	DAQT_AS5311_MAG		= 17,
+	DAQT_SYSTIME_SET	= 32,
+	DAQT_SYSTIME_ROLLOVER	= 33,
+	DAQT_DRO_DATA		= 48,
+	DAQT_SIGNAL_DATA	= 64,
+	DAQT_ABZ_DATA		= 72,
+	DAQT_DISCARD		= 0xfe,
+	DAQT_STUFF		= 0xff,
+};
+
+/* the sources, one ring each */
+enum {
+	DAQS_MCU,
+	DAQS_AS5311,
+	DAQS_SYSTIME,
+	DAQS_DRO,
+	DAQS_SIGNAL,
+	DAQS_ABZ,
+	DAQS_DISCARD,
+	DAQS_N
+};
+
+typedef struct _daq_rec {
+	uint64_t	time;
+	const uint32_t	*data;		/* rle words of signal records */
+	uint32_t	val;		/* mcu byte, sensor data, discard count */
+	uint16_t	len;		/* words at data */
+	uint8_t		type;		/* DAQT_xxx */
+	uint8_t		chan;		/* mcu: 0 rx, 1 tx */
+	uint8_t		bits;		/* dro bits, sig_width */
+	uint8_t		rle_len;
+	uint8_t		offset;		/* bit of the first code in data[0] */
+} daq_rec_t;
+
+typedef struct _daq_ring {
+	daq_rec_t	*rec;
+	uint32_t	head;
+	uint32_t	tail;
+	uint64_t	lost;		/* records dropped on a full ring */
+} daq_ring_t;
+
+typedef struct _daq_demux {
+	daq_ring_t	ring[DAQS_N];
+	uint32_t	mask;		/* records per ring - 1 */
+	uint64_t	systime;	/* of the last systime record */
+	uint32_t	mcu_high;	/* time 47:16 of the last long mcu record */
+	daq_rec_t	drop;		/* written instead on a full ring */
+	char		err[80];
+} daq_demux_t;
+
+/* depth records per source, rounded up to a power of 2 */
+daq_demux_t *daq_demux_new(int depth);
+void daq_demux_free(daq_demux_t *dm);
+/* drops everything queued, keeps the time base */
+void daq_demux_flush(daq_demux_t *dm);
+
+/*
+ * queues the records of the len words at w. Returns their number, -1 on
+ * an unknown type or a record cut off by the end of the frame, with
+ * daq_demux_error telling which. The records up to there are queued
+ */
+int daq_demux_frame(daq_demux_t *dm, const uint32_t *w, int len);
+const char *daq_demux_error(const daq_demux_t *dm);
+/* "signal" for DAQT_SIGNAL_DATA etc., NULL for an unknown type */
+const char *daq_type_name(int type);
+
+static inline int
+daq_pending(const daq_demux_t *dm, int src)
+{
+	return dm->ring[src].head - dm->ring[src].tail;
+}
+
+/* the oldest record of src, NULL if there is none */
+static inline const daq_rec_t *
+daq_peek(const daq_demux_t *dm, int src)
+{
+	const daq_ring_t *r = &dm->ring[src];
+
+	if (r->head == r->tail)
+		return NULL;
+	return &r->rec[r->tail & dm->mask];
+}
+
+/* the same, consumed. It stays valid until the next daq_demux_frame */
+static inline const daq_rec_t *
+daq_next(daq_demux_t *dm, int src)
+{
+	daq_ring_t *r = &dm->ring[src];
+
+	if (r->head == r->tail)
+		return NULL;
+	return &r->rec[r->tail++ & dm->mask];
+}
+
+#endif
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "fiber.h"
+
+static void
+fiber_run(fiber_t *f)
+{
+	f->fn(f->arg);
+	f->done = 1;
+	fiber_yield(f);
+
+	/* never resumed again, fiber_resume refuses finished fibers */
+	abort();
+}
+
+#if defined(__x86_64__)
+/*
+ * fiber_switch(void **save_sp, void *new_sp)
+ * save the callee-saved registers on the current stack, store the stack
+ * pointer to *save_sp and continue on new_sp
+ */
+extern "C" void fiber_switch(void **save_sp, void *new_sp);
+extern "C" void fiber_trampoline(void);
+asm(
+	".text\n"
+	".globl fiber_switch\n"
+	".type fiber_switch, @function\n"
+	"fiber_switch:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	".size fiber_switch, .-fiber_switch\n"
+	/* first switch into a fiber lands here, fiber pointer in r12 */
+	".globl fiber_trampoline\n"
+	".type fiber_trampoline, @function\n"
+	"fiber_trampoline:\n"
+	"	movq %r12, %rdi\n"
+	"	call fiber_entry\n"
+	"	ud2\n"
+	".size fiber_trampoline, .-fiber_trampoline\n"
+);
+
+extern "C" void
+fiber_entry(fiber_t *f)
+{
+	fiber_run(f);
+}
+
+static void
+fiber_init_ctx(fiber_t *f, uint8_t *stack_base)
+{
+	uint64_t *sp = (uint64_t *)(stack_base + f->stack_size);
+
+	/*
+	 * initial frame as fiber_switch expects it: 6 saved registers and
+	 * the return address. The stack is 16 byte aligned after the ret
+	 */
+	*--sp = (uint64_t)fiber_trampoline;
+	*--sp = 0;			/* rbp */
+	*--sp = 0;			/* rbx */
+	*--sp = (uint64_t)f;		/* r12 */
+	*--sp = 0;			/* r13 */
+	*--sp = 0;			/* r14 */
+	*--sp = 0;			/* r15 */
+	f->sp = sp;
+}
+#else
+/*
+ * makecontext only passes int arguments, so hand the fiber over in two
+ * halves
+ */
+static void
+fiber_entry(unsigned int lo, unsigned int hi)
+{
+	fiber_run((fiber_t *)(((uintptr_t)hi << 32) | lo));
+}
+
+static void
+fiber_init_ctx(fiber_t *f, uint8_t *stack_base)
+{
+	uintptr_t p = (uintptr_t)f;
+
+	if (getcontext(&f->ctx) != 0) {
+		printf("fiber: getcontext failed\n");
+		exit(1);
+	}
+	f->ctx.uc_stack.ss_sp = stack_base;
+	f->ctx.uc_stack.ss_size = f->stack_size;
+	f->ctx.uc_link = NULL;
+	makecontext(&f->ctx, (void (*)())fiber_entry, 2,
+		(unsigned int)(p & 0xffffffff), (unsigned int)(p >> 32));
+}
+#endif
+
+fiber_t *
+fiber_create(void (*fn)(void *arg), void *arg, size_t stack_size,
+	const char *name)
+{
+	fiber_t *f = (fiber_t *)calloc(1, sizeof(*f));
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+
+	if (f == NULL) {
+		printf("fiber: out of memory\n");
+		exit(1);
+	}
+	if (stack_size == 0)
+		stack_size = FIBER_STACK_SIZE;
+	stack_size = (stack_size + pagesz - 1) & ~(pagesz - 1);
+
+	/* one extra page below the stack as guard against overflows */
+	f->stack = mmap(NULL, stack_size + pagesz, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (f->stack == MAP_FAILED) {
+		printf("fiber: failed to allocate stack for %s\n", name);
+		exit(1);
+	}
+	if (mprotect(f->stack, pagesz, PROT_NONE) != 0) {
+		printf("fiber: failed to set up guard page for %s\n", name);
+		exit(1);
+	}
+	f->stack_size = stack_size;
+	f->fn = fn;
+	f->arg = arg;
+	f->name = name;
+
+	fiber_init_ctx(f, (uint8_t *)f->stack + pagesz);
+
+	return f;
+}
+
+void
+fiber_free(fiber_t *f)
+{
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+
+	munmap(f->stack, f->stack_size + pagesz);
+	free(f);
+}
+
+/*
+ * switch to the fiber, returns when it yields or finishes
+ */
+void
+fiber_resume(fiber_t *f)
+{
+	if (f->done) {
+		printf("fiber: resuming finished fiber %s\n", f->name);
+		exit(1);
+	}
+#if defined(__x86_64__)
+	fiber_switch(&f->caller_sp, f->sp);
+#else
+	if (swapcontext(&f->caller, &f->ctx) != 0) {
+		printf("fiber: swapcontext to %s failed\n", f->name);
+		exit(1);
+	}
+#endif
+}
+
+/*
+ * called from inside the fiber, return to whoever resumed us
+ */
+void
+fiber_yield(fiber_t *f)
+{
+#if defined(__x86_64__)
+	fiber_switch(&f->sp, f->caller_sp);
+#else
+	if (swapcontext(&f->ctx, &f->caller) != 0) {
+		printf("fiber: swapcontext from %s failed\n", f->name);
+		exit(1);
+	}
+#endif
+}
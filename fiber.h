@@ -0,0 +1,48 @@
+#ifndef __FIBER__H__
+#define __FIBER__H__
+
+#include <stddef.h>
+#if !defined(__x86_64__)
+#include <ucontext.h>
+#endif
+
+/*
+ * minimal cooperative fibers. Each fiber runs on its own separately
+ * allocated stack, so any number of test procedures can be suspended at
+ * the same time. A fiber is resumed from the main loop and runs until it
+ * yields back or its function returns.
+ * On x86_64 the switch is a handful of instructions, as the testbench
+ * switches at least once per simulated cycle. Everything else falls back
+ * to ucontext, which costs a syscall per switch for the signal mask.
+ */
+#define FIBER_STACK_SIZE	(1024 * 1024)
+
+typedef struct _fiber {
+#if defined(__x86_64__)
+	void		*sp;		/* saved stack pointer of the fiber */
+	void		*caller_sp;	/* saved stack pointer of the resumer */
+#else
+	ucontext_t	ctx;
+	ucontext_t	caller;
+#endif
+	void		*stack;
+	size_t		stack_size;	/* usable size, excl. guard page */
+	void		(*fn)(void *arg);
+	void		*arg;
+	const char	*name;
+	int		done;
+} fiber_t;
+
+fiber_t *fiber_create(void (*fn)(void *arg), void *arg, size_t stack_size,
+	const char *name);
+void fiber_free(fiber_t *f);
+void fiber_resume(fiber_t *f);
+void fiber_yield(fiber_t *f);
+
+static inline int
+fiber_done(fiber_t *f)
+{
+	return f->done;
+}
+
+#endif
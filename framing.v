@@ -42,6 +42,18 @@ module framing #(
 
 	/* error, reset */
 	output reg error = 0,
+`ifdef VERILATOR
+	/*
+	 * transaction level backdoor for the testbench. With tlm_en, bytes
+	 * come from tlm_rx_* instead of the uart and sent bytes are only
+	 * presented on tlm_tx_*, the uart stays idle
+	 */
+	input wire tlm_en,
+	input wire [7:0] tlm_rx_data,
+	input wire tlm_rx_valid,
+	output wire [7:0] tlm_tx_data,
+	output wire tlm_tx_valid,
+`endif
 	input wire clr
 );
 
@@ -63,8 +75,11 @@ end
  */
 wire [7:0] rx_data;
 wire rx_ready;
+wire [7:0] uart_rx_data;
+wire uart_rx_ready;
 reg [7:0] tx_data = 0;
 reg tx_en = 0;
+wire uart_tx_en;
 wire tx_transmitting;
 
 localparam CLOCK_DIVIDE = HZ / BAUD / 4; /* 4 phases per bit */
@@ -75,15 +90,27 @@ uart #(
 	.rst(1'b0),
 	.rx(rx_sync),
 	.tx(tx),
-	.transmit(tx_en),
+	.transmit(uart_tx_en),
 	.tx_byte(tx_data),
-	.received(rx_ready),
-	.rx_byte(rx_data),
+	.received(uart_rx_ready),
+	.rx_byte(uart_rx_data),
 	.is_receiving(),
 	.is_transmitting(tx_transmitting),
 	.recv_error()
 );
 
+`ifdef VERILATOR
+assign rx_data = tlm_en ? tlm_rx_data : uart_rx_data;
+assign rx_ready = tlm_en ? tlm_rx_valid : uart_rx_ready;
+assign uart_tx_en = tx_en & !tlm_en;
+assign tlm_tx_data = tx_data;
+assign tlm_tx_valid = tx_en & tlm_en;
+`else
+assign rx_data = uart_rx_data;
+assign rx_ready = uart_rx_ready;
+assign uart_tx_en = tx_en;
+`endif
+
 uartlog #(
 	.HZ(HZ)
 ) mculog_u (
@@ -288,13 +315,22 @@ localparam SST_CRC2 = 3'd5;	/* read crc2 */
 localparam SST_EOF = 3'd6;	/* read sync byte (end of frame) */
 reg [2:0] send_state = SST_IDLE;
 
+/*
+ * without the uart pacing the bytes, wait for the crc of the last one
+ */
+`ifdef VERILATOR
+wire send_crc16_wait = tlm_en && send_crc16_cnt != 0;
+`else
+wire send_crc16_wait = 1'b0;
+`endif
+
 /*
  * send state machine
  */
 always @(posedge clk) begin
 	if (!send_ptr_init) begin
 		send_rptr <= 0;
-	end else if (!tx_transmitting && !tx_en) begin
+	end else if (!tx_transmitting && !tx_en && !send_crc16_wait) begin
 		if (send_state == SST_IDLE && !send_fifo_empty) begin
 			send_state <= SST_SOF;
 			send_len <= send_fifo_rd_data + 8'd5;
@@ -0,0 +1,284 @@
+#!/usr/bin/perl -w
+
+use strict;
+
+if (@ARGV != 3) {
+	die "usage: gencmds.pl <command-v> <framing-v> <dst-h>\n";
+}
+my ($srcname, $framingname, $dstname) = @ARGV;
+
+open (my $src, '<', $srcname)
+	or die "failed to open $srcname";
+
+# localparam UNIT_STEPPER		= 4'd2;
+# localparam CMD_QUEUE_STEP		= 6;
+# localparam RSP_GET_TIME		= 1;
+# localparam STRLEN = 6;	/* in bits, longest string is 64 bytes */
+# 	cmdtab[CMD_SD_QUEUE] = { UNIT_SD, ARGS_2, 1'b1, 1'b0 };
+#
+# cmdtab entries are { unit, nargs, string_arg, cmd_has_response }, nargs
+# without the command byte
+my (@units, @cmds, @rsps, %cmdtab);
+my ($ncmds, $strlen);
+while (<$src>) {
+	if (/^localparam UNIT_(\w+)\s*=\s*(?:\d+'d)?(\d+);/) {
+		push @units, [ $1, $2 ];
+	} elsif (/^localparam CMD_(\w+)\s*=\s*(\d+);/) {
+		push @cmds, [ $1, $2 ];
+	} elsif (/^localparam RSP_(\w+)\s*=\s*(\d+);/) {
+		push @rsps, [ $1, $2 ];
+	} elsif (/^localparam NCMDS\s*=\s*(\d+);/) {
+		$ncmds = $1;
+	} elsif (/^localparam STRLEN\s*=\s*(\d+);/) {
+		$strlen = $1;
+	} elsif (/^\s*cmdtab\[CMD_(\w+)\]\s*=\s*\{\s*UNIT_(\w+),\s*ARGS_(\d+),\s*1'b([01]),\s*1'b([01])\s*\};/) {
+		die "CMD_$1 twice in cmdtab" if (exists $cmdtab{$1});
+		$cmdtab{$1} = {
+			unit => $2,
+			nargs => $3,
+			string_arg => $4,
+			has_response => $5,
+		};
+	} elsif (/cmdtab\[CMD_/) {
+		die "failed to parse $_";
+	}
+}
+close($src);
+
+# 		end else if (rx_data < 5 || rx_data >= 64) begin
+#
+# the length byte framing.v accepts, anything else wedges its receiver
+my $frame_max;
+open (my $framing, '<', $framingname)
+	or die "failed to open $framingname";
+while (<$framing>) {
+	if (/rx_data\s*<\s*\d+\s*\|\|\s*rx_data\s*>=\s*(\d+)/) {
+		$frame_max = $1 - 1;
+	}
+}
+close($framing);
+
+die "no frame length check in $framingname" if (!defined $frame_max);
+die "no NCMDS in $srcname" if (!defined $ncmds);
+die "no STRLEN in $srcname" if (!defined $strlen);
+die "found " . @cmds . " commands, NCMDS is $ncmds" if (@cmds != $ncmds);
+my %units = map { $_->[0] => 1 } @units;
+for (@cmds) {
+	my $c = $cmdtab{$_->[0]};
+	die "CMD_$_->[0] has no cmdtab entry" if (!defined $c);
+	die "CMD_$_->[0]: unknown UNIT_$c->{unit}" if (!exists $units{$c->{unit}});
+	die "CMD_$_->[0]: string without length" if ($c->{string_arg} && $c->{nargs} == 0);
+}
+
+open (my $dst, '>', $dstname)
+	or die "failed to open $dstname";
+
+sub print_enum {
+	my ($prefix, $list, $last) = @_;
+
+	print $dst "enum {\n";
+	for (@$list) {
+		print $dst "\t$prefix$_->[0] = $_->[1],\n";
+	}
+	print $dst "\t$last\n" if (defined $last);
+	print $dst "};\n\n";
+}
+
+print $dst <<"HERE";
+/* generated by gencmds.pl from $srcname, do not edit */
+#ifndef __CMDS__H__
+#define __CMDS__H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "crc.h"
+#include "vlq.h"
+
+HERE
+print_enum("UNIT_", \@units);
+print_enum("CMD_", \@cmds, "NCMDS = $ncmds");
+print_enum("RSP_", \@rsps);
+
+my $maxstring = (1 << $strlen) - 1;
+print $dst <<"HERE";
+#define CMD_MAXSTRING	$maxstring	/* what the STRLEN bits of str_len hold */
+#define CMD_FRAME_MAX	$frame_max	/* longest frame framing.v takes */
+
+/* cmdtab of command.v, for lookups at runtime */
+typedef struct _cmddef {
+	const char	*name;
+	int		unit;
+	int		nargs;		/* without the command byte */
+	int		string_arg;	/* last arg is the length of a string */
+	int		has_response;
+} cmddef_t;
+
+static const cmddef_t cmddefs[NCMDS] = {
+HERE
+for (@cmds) {
+	my $c = $cmdtab{$_->[0]};
+	print $dst "\t{ \"\L$_->[0]\E\", UNIT_$c->{unit}, $c->{nargs}, ";
+	print $dst "$c->{string_arg}, $c->{has_response} },\n";
+}
+print $dst <<"HERE";
+};
+
+/*
+ * the same at compile time, as cmd_def<CMD_xxx>. maxstring is the longest
+ * string that fits a frame with all values at their longest, maxlen the
+ * longest payload, frame_max the longest frame of the command
+ */
+template <int UNIT, int NARGS, int STRING_ARG, int HAS_RESPONSE>
+struct cmd_desc {
+	static constexpr int	unit = UNIT;
+	static constexpr int	nargs = NARGS;
+	static constexpr bool	string_arg = STRING_ARG;
+	static constexpr bool	has_response = HAS_RESPONSE;
+	/* values in front of the string, the length is the last arg */
+	static constexpr int	nvals = STRING_ARG ? NARGS - 1 : NARGS;
+	static constexpr int	maxstring = !STRING_ARG ? 0 :
+		CMD_FRAME_MAX - 6 - NARGS * VLQ_MAX < CMD_MAXSTRING ?
+		CMD_FRAME_MAX - 6 - NARGS * VLQ_MAX : CMD_MAXSTRING;
+	static constexpr int	maxlen = 1 + NARGS * VLQ_MAX + maxstring;
+	static constexpr int	frame_max = maxlen + 5;
+};
+
+template <int CMD> struct cmd_def;
+HERE
+for (@cmds) {
+	my $c = $cmdtab{$_->[0]};
+	print $dst "template <> struct cmd_def<CMD_$_->[0]> : cmd_desc<";
+	print $dst "UNIT_$c->{unit}, $c->{nargs}, $c->{string_arg}, ";
+	print $dst "$c->{has_response}> {};\n";
+}
+print $dst "\n";
+for (@cmds) {
+	print $dst "static_assert(cmd_def<CMD_$_->[0]>::frame_max <= ";
+	print $dst "CMD_FRAME_MAX,\n\t\"CMD_$_->[0] does not fit a frame\");\n";
+}
+
+print $dst <<'HERE';
+
+/*
+ * payload of command CMD into buf, returns its length. The args are the
+ * values of the command. For a command with a string, the values in front
+ * of it are followed by the bytes of the string, its length is counted.
+ * A wrong number of args or a string longer than maxstring does not
+ * compile
+ */
+template <int CMD, typename... A>
+static inline int
+cmd_encode(uint8_t *buf, A... args)
+{
+	typedef cmd_def<CMD> def;
+	const uint32_t v[] = { 0, (uint32_t)args... };
+	const int nstr = (int)sizeof...(A) - def::nvals;
+	uint8_t *p = buf;
+	int i;
+
+	static_assert(def::string_arg || sizeof...(A) == def::nargs,
+		"wrong number of arguments for the command");
+	static_assert(!def::string_arg || sizeof...(A) >= def::nvals,
+		"too few arguments in front of the string");
+	static_assert(!def::string_arg ||
+		sizeof...(A) - def::nvals <= def::maxstring,
+		"string too long for a frame");
+
+	*p++ = CMD;
+	for (i = 0; i < def::nvals; ++i)
+		p = vlq_encode(p, v[i + 1]);
+	if (def::string_arg) {
+		p = vlq_encode(p, nstr);
+		for (i = 0; i < nstr; ++i)
+			*p++ = v[def::nvals + i + 1];
+	}
+
+	return p - buf;
+}
+
+/*
+ * complete frame for framing.v around the len bytes of payload at
+ * buf + 2. Returns the length of the frame
+ */
+static inline int
+cmd_frame_seal(uint8_t *buf, int seq, int len)
+{
+	uint16_t crc;
+
+	buf[0] = len + 5;
+	buf[1] = 0x10 | seq;
+	crc = crc16_ccitt(buf, len + 2);
+	buf[len + 2] = crc >> 8;
+	buf[len + 3] = crc & 0xff;
+	buf[len + 4] = 0x7e;
+
+	return len + 5;
+}
+
+/* command CMD as frame with sequence number seq, see cmd_encode */
+template <int CMD, size_t N, typename... A>
+static inline int
+cmd_frame(uint8_t (&buf)[N], int seq, A... args)
+{
+	static_assert(N >= cmd_def<CMD>::frame_max, "buffer too short");
+
+	return cmd_frame_seal(buf, seq, cmd_encode<CMD>(buf + 2, args...));
+}
+
+/*
+ * values of a command payload into v, the reverse of cmd_encode. Bytes of
+ * a string follow the values, one per entry. Returns the number of
+ * entries, -1 if the payload is not a well formed CMD
+ */
+template <int CMD, size_t N>
+static inline int
+cmd_decode(const uint8_t *p, int len, uint32_t (&v)[N])
+{
+	typedef cmd_def<CMD> def;
+	int ret;
+	int i;
+
+	static_assert(N >= def::nargs + (def::string_arg ? CMD_MAXSTRING : 0),
+		"value buffer too short");
+
+	if (len < 1 || p[0] != CMD)
+		return -1;
+	++p;
+	--len;
+	for (i = 0; i < def::nargs; ++i) {
+		ret = vlq_decode(p, len, v + i);
+		if (ret == 0)
+			return -1;
+		p += ret;
+		len -= ret;
+	}
+	if (def::string_arg) {
+		int nstr = v[def::nargs - 1];
+
+		if (nstr > len || nstr > CMD_MAXSTRING)
+			return -1;
+		for (i = 0; i < nstr; ++i)
+			v[def::nargs + i] = p[i];
+		len -= nstr;
+		i = def::nargs + nstr;
+	}
+
+	return len == 0 ? i : -1;
+}
+
+/*
+ * values of a response payload into v, the response type first. The
+ * number of values of a response is not in cmdtab, the caller knows it.
+ * Returns the number of values, -1 if the payload does not end after a
+ * value or has more than N
+ */
+template <size_t N>
+static inline int
+rsp_decode(const uint8_t *p, int len, uint32_t (&v)[N])
+{
+	return vlq_decode_all(p, len, v, N);
+}
+
+#endif
+HERE
+close($dst);
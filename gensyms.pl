@@ -15,6 +15,10 @@ open (my $dst, '>', $dstname)
 # QData/*34:0*/ conan__DOT__u_command__DOT__rcv_param;
 # QData/*63:0*/ conan__DOT__u_led7219__DOT__dout;
 # CData/*7:0*/ conan__DOT__u_framing__DOT__recv_ring[256];
+# WData/*65:0*/ conan__DOT__u_foo__DOT__wide[3];
+#
+# WData signals carry the number of 32 bit words as last dimension, newer
+# verilator versions declare them as VlWide<3>/*65:0*/ instead
 
 while (<$src>) {
 	last if (/^\s+\/\/ LOCAL SIGNALS$/);
@@ -26,10 +30,10 @@ while (<$src>) {
 	next if (/^\s*\/\//);
 	next if (/^\s*};/);
 	next if (/^\s*struct \{/);
-	if (!/^\s+([CIQSW])Data\/\*(\d+):(\d+)\*\/ (\w+)(\[\d+\])?(\[\d+\])?;$/) {
+	if (!/^\s+(?:([CIQSW])Data|VlWide<\d+>)\/\*(\d+):(\d+)\*\/ (\w+)(\[\d+\])?(\[\d+\])?;$/) {
 		die "failed to parse $_";
 	}
-	my $type = $1;
+	my $type = $1 // 'W';
 	my $range_start = $2;
 	my $range_end = $3;
 	my $name_raw = $4;
@@ -38,6 +42,20 @@ while (<$src>) {
 	$num1 =~ s/[\[\]]//g;
 	$num2 =~ s/[\[\]]//g;
 	my $num = $num1 * $num2;
+	my $width = $range_start - $range_end + 1;
+	my %elem_len = (C => 1, S => 2, I => 4, Q => 8);
+	my $elem_len;
+	if ($type eq 'W') {
+		my $words = int(($width + 31) / 32);
+		# the word dimension is not an array dimension
+		$num /= $words if (/^\s+WData/);
+		if ($num != int($num)) {
+			die "word count does not match width in $_";
+		}
+		$elem_len = $words * 4;
+	} else {
+		$elem_len = $elem_len{$type};
+	}
 	my $name_cooked = $name_raw;
 	$name_cooked =~ s/__DOT__/./g;
 	$name_cooked =~ s/__BRA__(\d+)__KET__/[$1]/g;
@@ -52,6 +70,8 @@ while (<$src>) {
 		name_raw => $name_raw,
 		name_cooked => $name_cooked,
 		num => $num,
+		elem_len => $elem_len,
+		len => $elem_len * $num,
 	};
 }
 print $dst <<"HERE";
@@ -74,6 +94,8 @@ typedef struct _signal {
 	int		range_start;	/* bitfield range */
 	int		range_end;
 	int		num;		/* number of entries in array */
+	int		len;		/* bytes in total */
+	int		elem_len;	/* bytes per entry */
 	int		offset;		/* offset of signal in structure */
 } signal_t;
 
@@ -82,12 +104,142 @@ HERE
 
 for (@signals) {
 	print $dst "\t{ \"$_->{name_cooked}\", $_->{type}, $_->{range_start}, ";
-	print $dst "$_->{range_end}, $_->{num}, offsetof(V$model, $_->{name_raw}) },\n";
+	print $dst "$_->{range_end}, $_->{num}, $_->{len}, $_->{elem_len}, ";
+	print $dst "offsetof(V$model, $_->{name_raw}) },\n";
 }
 
 print $dst <<"HERE";
 };
 #define NSIGS (sizeof(vsigs) / sizeof(signal_t))
 
+/* catches any disagreement with the sizes verilator uses */
+HERE
+for (@signals) {
+	print $dst "static_assert(sizeof(V${model}::$_->{name_raw}) == ";
+	print $dst "$_->{len}, \"$_->{name_cooked}\");\n";
+}
+
+# compile-time descriptors, named like the cooked names with dots and
+# brackets replaced
+print $dst <<"HERE";
+
+/*
+ * compile-time descriptor of each signal, as vsd::<name> with dots and
+ * brackets replaced by underscores. For wide signals elem_t is one word
+ */
+template <typename T, int ID, size_t OFFSET, int ELEM_LEN, int NUM, int MSB,
+	int LSB>
+struct vsig_desc {
+	typedef T		elem_t;
+	static constexpr int	id = ID;	/* in vsigs[] */
+	static constexpr size_t	offset = OFFSET;
+	static constexpr int	elem_len = ELEM_LEN;
+	static constexpr int	num = NUM;
+	static constexpr int	len = ELEM_LEN * NUM;
+	static constexpr int	words = (ELEM_LEN + 3) / 4;
+	static constexpr int	msb = MSB;
+	static constexpr int	lsb = LSB;
+	static constexpr int	width = MSB - LSB + 1;
+	static constexpr bool	wide = ELEM_LEN > 8;
+};
+
+namespace vsd {
+HERE
+my %idents;
+for (my $i = 0; $i < @signals; ++$i) {
+	my $s = $signals[$i];
+	my $ident = $s->{name_cooked};
+	$ident =~ s/[^A-Za-z0-9_]/_/g;
+	if (exists $idents{$ident}) {
+		die "$s->{name_cooked} and $idents{$ident} map to the same name";
+	}
+	$idents{$ident} = $s->{name_cooked};
+	my $ctype = substr($s->{type}, 3) . "Data";
+	print $dst "typedef vsig_desc<$ctype, $i, offsetof(V$model, ";
+	print $dst "$s->{name_raw}), $s->{elem_len}, $s->{num}, ";
+	print $dst "$s->{range_start}, $s->{range_end}> $ident;\n";
+}
+print $dst <<"HERE";
+}
+
+/* typed access to entry i of a signal, no lookup and no size switch */
+template <typename D>
+static inline typename D::elem_t *
+vsig_ptr(V$model *tb, int i = 0)
+{
+	return (typename D::elem_t *)((uint8_t *)tb + D::offset +
+		i * D::elem_len);
+}
+
+template <typename D>
+static inline uint64_t
+vsig_get(const V$model *tb, int i = 0)
+{
+	static_assert(!D::wide, "wide signal, use vsig_ptr");
+	return *(const typename D::elem_t *)((const uint8_t *)tb + D::offset +
+		i * D::elem_len);
+}
+
+template <typename D>
+static inline void
+vsig_set(V$model *tb, uint64_t val, int i = 0)
+{
+	static_assert(!D::wide, "wide signal, use vsig_ptr");
+	*vsig_ptr<D>(tb, i) = (typename D::elem_t)val;
+}
+
+HERE
+
+# name index: signal numbers sorted by name, for binary search
+my @sorted = sort { $signals[$a]->{name_cooked} cmp $signals[$b]->{name_cooked} }
+	0 .. $#signals;
+print $dst "int vsig_sorted[] = {\n";
+for (my $i = 0; $i < @sorted; $i += 16) {
+	my $end = $i + 15 < $#sorted ? $i + 15 : $#sorted;
+	print $dst "\t", join(", ", @sorted[$i .. $end]), ",\n";
+}
+print $dst "};\n\n";
+
+# suffix index: signal numbers sorted by the reversed name, so all names
+# ending in the same text are contiguous
+my @rsorted = sort { reverse($signals[$a]->{name_cooked}) cmp
+	reverse($signals[$b]->{name_cooked}) } 0 .. $#signals;
+print $dst "int vsig_rsorted[] = {\n";
+for (my $i = 0; $i < @rsorted; $i += 16) {
+	my $end = $i + 15 < $#rsorted ? $i + 15 : $#rsorted;
+	print $dst "\t", join(", ", @rsorted[$i .. $end]), ",\n";
+}
+print $dst "};\n\n";
+
+# hierarchy scopes, each with its range in vsig_sorted. As the index is
+# sorted, all signals below a scope are contiguous
+my %scopes;
+for (my $i = 0; $i < @sorted; ++$i) {
+	my $name = $signals[$sorted[$i]]->{name_cooked};
+	while ($name =~ /\./g) {
+		my $scope = substr($name, 0, pos($name));
+		if (!exists $scopes{$scope}) {
+			$scopes{$scope} = [ $i, 0 ];
+		}
+		++$scopes{$scope}->[1];
+	}
+}
+print $dst <<"HERE";
+typedef struct _sigscope {
+	const char	*name;		/* including the trailing dot */
+	int		first;		/* first entry in vsig_sorted */
+	int		num;		/* signals below this scope */
+} sigscope_t;
+
+sigscope_t vscopes[] = {
+HERE
+for (sort keys %scopes) {
+	print $dst "\t{ \"$_\", $scopes{$_}->[0], $scopes{$_}->[1] },\n";
+}
+print $dst <<"HERE";
+	{ NULL, 0, 0 }	/* keeps the array non-empty */
+};
+#define NSCOPES (sizeof(vscopes) / sizeof(sigscope_t) - 1)
+
 #endif
 HERE
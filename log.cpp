@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "log.h"
+
+#define LOG_RING	(1 << 22)	/* bytes, power of 2 */
+
+int log_levels[LOG_MAXCAT];
+
+static struct {
+	char		*buf;
+	uint64_t	head;		/* only written by the producer */
+	uint64_t	tail;		/* only written by the writer thread */
+	int		stop;
+	int		running;
+	int		fd;		/* the original stdout */
+	pthread_t	thread;
+} ring;
+
+static void __attribute__((constructor))
+log_init_levels(void)
+{
+	int i;
+
+	for (i = 0; i < LOG_MAXCAT; ++i)
+		log_levels[i] = LOG_INFO;
+}
+
+static void
+log_write_all(const char *p, size_t len)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(ring.fd, p, len);
+		if (ret <= 0)
+			return;	/* nowhere to report it */
+		p += ret;
+		len -= ret;
+	}
+}
+
+static void *
+log_writer(void *arg __attribute__((unused)))
+{
+	struct timespec ts = { 0, 1000000 };
+
+	for (;;) {
+		/* stop first: everything before it is in head already */
+		int stop = __atomic_load_n(&ring.stop, __ATOMIC_ACQUIRE);
+		uint64_t head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+		uint64_t tail = ring.tail;
+		uint64_t off;
+		uint64_t n;
+
+		if (head == tail) {
+			if (stop)
+				break;
+			nanosleep(&ts, NULL);
+			continue;
+		}
+		/* everything up to the end of the buffer in one go */
+		off = tail & (LOG_RING - 1);
+		n = head - tail;
+		if (n > LOG_RING - off)
+			n = LOG_RING - off;
+		log_write_all(ring.buf + off, n);
+		__atomic_store_n(&ring.tail, tail + n, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+static ssize_t
+log_cookie_write(void *cookie __attribute__((unused)), const char *data, size_t len)
+{
+	size_t done = 0;
+
+	if (!ring.running) {
+		log_write_all(data, len);
+		return len;
+	}
+	while (done < len) {
+		uint64_t head = ring.head;
+		uint64_t tail = __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE);
+		uint64_t space = LOG_RING - (head - tail);
+		uint64_t off = head & (LOG_RING - 1);
+		uint64_t n = len - done;
+		uint64_t first;
+
+		if (space == 0) {
+			/* writer is behind, only happens with huge output */
+			struct timespec ts = { 0, 100000 };
+
+			nanosleep(&ts, NULL);
+			continue;
+		}
+		if (n > space)
+			n = space;
+		first = n < LOG_RING - off ? n : LOG_RING - off;
+		memcpy(ring.buf + off, data + done, first);
+		memcpy(ring.buf, data + done + first, n - first);
+		__atomic_store_n(&ring.head, head + n, __ATOMIC_RELEASE);
+		done += n;
+	}
+
+	return len;
+}
+
+void
+log_config(const char *spec, const char **names, int ncat)
+{
+	static const char *levels[] = { "err", "info", "debug" };
+	const char *p = spec;
+
+	while (*p) {
+		const char *eq = strchr(p, '=');
+		const char *end = strchr(p, ',');
+		int level = -1;
+		int len;
+		int i;
+
+		if (end == NULL)
+			end = p + strlen(p);
+		if (eq == NULL || eq > end) {
+			printf("log: expected category=level in %s\n", spec);
+			exit(1);
+		}
+		for (i = 0; i < 3; ++i)
+			if ((int)strlen(levels[i]) == end - eq - 1 &&
+			    strncmp(eq + 1, levels[i], end - eq - 1) == 0)
+				level = i;
+		if (level < 0) {
+			printf("log: unknown level in %s\n", spec);
+			exit(1);
+		}
+		len = eq - p;
+		if (len == 3 && strncmp(p, "all", 3) == 0) {
+			for (i = 0; i < LOG_MAXCAT; ++i)
+				log_levels[i] = level;
+		} else {
+			for (i = 0; i < ncat; ++i)
+				if ((int)strlen(names[i]) == len &&
+				    strncmp(p, names[i], len) == 0)
+					break;
+			if (i == ncat) {
+				printf("log: unknown category in %s\n", spec);
+				exit(1);
+			}
+			log_levels[i] = level;
+		}
+		p = *end ? end + 1 : end;
+	}
+}
+
+void
+log_start(void)
+{
+	cookie_io_functions_t io = { NULL, log_cookie_write, NULL, NULL };
+	static int registered;
+	FILE *fp;
+
+	if (ring.running)
+		return;
+	fflush(stdout);
+	if (ring.buf == NULL)
+		ring.buf = (char *)malloc(LOG_RING);
+	fp = fopencookie(NULL, "w", io);
+	if (ring.buf == NULL || fp == NULL) {
+		printf("log: failed to set up the output ring\n");
+		exit(1);
+	}
+	/* lines go to the ring right away, that is only a copy */
+	setvbuf(fp, NULL, _IOLBF, 4096);
+	ring.fd = fileno(stdout);
+	ring.head = ring.tail = 0;
+	ring.stop = 0;
+	stdout = fp;
+	ring.running = 1;
+	if (pthread_create(&ring.thread, NULL, log_writer, NULL) != 0) {
+		ring.running = 0;
+		printf("log: failed to start the writer thread\n");
+		exit(1);
+	}
+	if (!registered)
+		atexit(log_stop);
+	registered = 1;
+}
+
+/*
+ * write out everything still in the ring and continue synchronously,
+ * for failures and exit
+ */
+void
+log_stop(void)
+{
+	if (!ring.running)
+		return;
+	fflush(stdout);
+	__atomic_store_n(&ring.stop, 1, __ATOMIC_RELEASE);
+	pthread_join(ring.thread, NULL);
+	ring.running = 0;
+}
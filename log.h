@@ -0,0 +1,34 @@
+#ifndef __LOG__H__
+#define __LOG__H__
+
+#include <stdio.h>
+
+/*
+ * harness output. After log_start, stdout is a line buffered stream that
+ * only copies into a lock-free single producer ring, a writer thread
+ * empties the ring into the original stdout in batches. The simulation
+ * thread does not do any syscalls for its output anymore, and the order
+ * of everything printed stays as is.
+ * LOG() additionally filters by category and level. Categories are
+ * numbers chosen by the testbench, the names given to log_config map
+ * them for the command line. All categories start at LOG_INFO.
+ */
+#define LOG_ERR		0
+#define LOG_INFO	1
+#define LOG_DEBUG	2
+
+#define LOG_MAXCAT	32
+
+extern int log_levels[LOG_MAXCAT];
+
+#define LOG(cat, level, ...) do {				\
+	if ((level) <= log_levels[cat])				\
+		printf(__VA_ARGS__);				\
+} while (0)
+
+/* "cat=level,cat=level", with "all" for all categories */
+void log_config(const char *spec, const char **names, int ncat);
+void log_start(void);
+void log_stop(void);
+
+#endif
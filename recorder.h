@@ -0,0 +1,241 @@
+#ifndef __RECORDER__H__
+#define __RECORDER__H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "trace.h"
+
+/*
+ * flight recorder: keeps the last cycles of a fixed set of signals in a
+ * ring of binary records, one per cycle. Recording is a copy of each
+ * signal, nothing is formatted until the ring gets dumped, as a text
+ * table and as an FST trace.
+ * Include after watch.h, the signals are selected by pattern from
+ * vsigs[] like watched signals.
+ */
+#define REC_MAXSIGS	256
+
+typedef struct _recorder {
+	const uint8_t	*tb;		/* model, base of vsigs[].offset */
+	int		sig[REC_MAXSIGS];
+	int		off[REC_MAXSIGS];	/* in the record */
+	int		nsigs;
+	int		rec_len;	/* cycle plus all signals */
+	int		depth;		/* records in the ring */
+	uint8_t		*ring;
+	uint64_t	head;		/* records written so far */
+} recorder_t;
+
+static recorder_t *
+recorder_init(const void *tb, int depth)
+{
+	recorder_t *rp = (recorder_t *)calloc(1, sizeof(*rp));
+
+	rp->tb = (const uint8_t *)tb;
+	rp->depth = depth;
+	rp->rec_len = sizeof(uint64_t);
+
+	return rp;
+}
+
+/*
+ * add all signals matching the pattern. Only possible before the first
+ * record is taken, the layout of the records is fixed from then on
+ */
+static int
+recorder_add(recorder_t *rp, const char *pattern)
+{
+	int _r = 0;
+	int sig;
+	int n = 0;
+
+	if (rp->ring != NULL) {
+		printf("recorder: cannot add %s while recording\n", pattern);
+		exit(1);
+	}
+	while ((sig = find_signal(pattern, &_r)) >= 0) {
+		if (rp->nsigs == REC_MAXSIGS) {
+			printf("recorder: too many signals\n");
+			exit(1);
+		}
+		rp->sig[rp->nsigs] = sig;
+		rp->off[rp->nsigs] = rp->rec_len;
+		rp->rec_len += sig_to_len(sig);
+		++rp->nsigs;
+		++n;
+	}
+
+	return n;
+}
+
+static void
+recorder_start(recorder_t *rp)
+{
+	/* keep the cycle of each record aligned */
+	rp->rec_len = (rp->rec_len + 7) & ~7;
+	rp->ring = (uint8_t *)calloc(rp->depth, rp->rec_len);
+	if (rp->ring == NULL) {
+		printf("recorder: failed to allocate %d records\n", rp->depth);
+		exit(1);
+	}
+	rp->head = 0;
+}
+
+static inline void
+recorder_sample(recorder_t *rp, uint64_t cycle)
+{
+	uint8_t *rec = rp->ring + (rp->head % rp->depth) * rp->rec_len;
+	int i;
+
+	*(uint64_t *)rec = cycle;
+	for (i = 0; i < rp->nsigs; ++i)
+		memcpy(rec + rp->off[i], rp->tb + vsigs[rp->sig[i]].offset,
+			sig_to_len(rp->sig[i]));
+	++rp->head;
+}
+
+/* i-th oldest record still in the ring */
+static uint8_t *
+recorder_rec(recorder_t *rp, uint64_t i)
+{
+	uint64_t first = rp->head > (uint64_t)rp->depth ?
+		rp->head - rp->depth : 0;
+
+	return rp->ring + ((first + i) % rp->depth) * rp->rec_len;
+}
+
+static uint64_t
+recorder_count(recorder_t *rp)
+{
+	return rp->head < (uint64_t)rp->depth ? rp->head : rp->depth;
+}
+
+static void
+recorder_print_sig(FILE *fp, recorder_t *rp, int i, const uint8_t *rec)
+{
+	int sig = rp->sig[i];
+	int elen = sig_elem_len(sig);
+	int j;
+
+	fprintf(fp, " ");
+	for (j = 0; j < vsigs[sig].num; ++j) {
+		const uint8_t *p = rec + rp->off[i] + j * elen;
+		uint64_t val = 0;
+		int k;
+
+		if (j)
+			fprintf(fp, "/");
+		if (elen > 8) {
+			/* wide, most significant word first */
+			fprintf(fp, "%x", ((const uint32_t *)p)[elen / 4 - 1]);
+			for (k = elen / 4 - 2; k >= 0; --k)
+				fprintf(fp, "_%08x", ((const uint32_t *)p)[k]);
+			continue;
+		}
+		memcpy(&val, p, elen);
+		fprintf(fp, "%lx", val);
+	}
+}
+
+/*
+ * text table of all records in the ring, one row per cycle in which any
+ * of the signals changed
+ */
+static void
+recorder_dump_text(recorder_t *rp, const char *path)
+{
+	uint64_t n = recorder_count(rp);
+	const uint8_t *prev = NULL;
+	FILE *fp;
+	uint64_t r;
+	int i;
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		printf("recorder: failed to open %s\n", path);
+		return;
+	}
+	fprintf(fp, "%10s", "cycle");
+	for (i = 0; i < rp->nsigs; ++i)
+		fprintf(fp, " %s", vsigs[rp->sig[i]].name);
+	fprintf(fp, "\n");
+	for (r = 0; r < n; ++r) {
+		const uint8_t *rec = recorder_rec(rp, r);
+
+		if (prev != NULL && memcmp(prev + sizeof(uint64_t),
+		    rec + sizeof(uint64_t), rp->rec_len - sizeof(uint64_t)) == 0)
+			continue;
+		fprintf(fp, "%10lu", *(const uint64_t *)rec);
+		for (i = 0; i < rp->nsigs; ++i)
+			recorder_print_sig(fp, rp, i, rec);
+		fprintf(fp, "\n");
+		prev = rec;
+	}
+	fclose(fp);
+}
+
+/*
+ * replay the ring into an FST trace. The trace samples from a scratch
+ * record that gets filled from the ring cycle by cycle
+ */
+static void
+recorder_dump_fst(recorder_t *rp, const char *path, const char *top,
+	uint64_t period_ps)
+{
+	uint64_t n = recorder_count(rp);
+	uint8_t *scratch = (uint8_t *)malloc(rp->rec_len);
+	trace_t *tp;
+	uint64_t r;
+	int i;
+
+	memcpy(scratch, recorder_rec(rp, 0), rp->rec_len);
+	tp = trace_open(path, top, period_ps);
+	for (i = 0; i < rp->nsigs; ++i) {
+		int sig = rp->sig[i];
+		signal_t *s = vsigs + sig;
+		int width = s->range_start - s->range_end + 1;
+		int elen = sig_elem_len(sig);
+		char name[strlen(s->name) + 16];
+		int j;
+
+		/* same layout as watch_trace_sig */
+		if (s->num == 1) {
+			trace_var(tp, s->name, width, scratch + rp->off[i],
+				sig_to_len(sig));
+			continue;
+		}
+		for (j = 0; j < s->num; ++j) {
+			snprintf(name, sizeof(name), "%s[%d]", s->name, j);
+			trace_var(tp, name, width,
+				scratch + rp->off[i] + j * elen, elen);
+		}
+	}
+	for (r = 0; r < n; ++r) {
+		memcpy(scratch, recorder_rec(rp, r), rp->rec_len);
+		trace_sample(tp, *(uint64_t *)scratch);
+	}
+	trace_close(tp);
+	free(scratch);
+}
+
+static void
+recorder_dump(recorder_t *rp, const char *prefix, const char *top,
+	uint64_t period_ps)
+{
+	char path[1024];
+
+	if (rp == NULL || rp->ring == NULL || rp->head == 0)
+		return;
+
+	snprintf(path, sizeof(path), "%s.txt", prefix);
+	recorder_dump_text(rp, path);
+	snprintf(path, sizeof(path), "%s.fst", prefix);
+	recorder_dump_fst(rp, path, top, period_ps);
+	printf("recorder: last %lu cycles written to %s.txt and %s.fst\n",
+		recorder_count(rp), prefix, prefix);
+	fflush(stdout);
+}
+
+#endif
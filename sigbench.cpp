@@ -0,0 +1,508 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "sigdec.h"
+#include "daqdemux.h"
+#include "bench.h"
+
+/*
+ * checks and throughput of the signal.v decoder. Sample streams are
+ * encoded with a model of signal.v, cut into records of DAQ_PACKET_SIZE
+ * words and decoded again, all at once, in small pieces and starting in
+ * the middle of the stream. The bit at a time parser tb_daq used before
+ * is the baseline.
+ * Exits 1 if anything differs
+ */
+#define DAQ_PACKET_SIZE	100	/* signal.v */
+#define RLE_LEN		12	/* RLE_BITS of the testbenches */
+#define NSLOTS		7
+#define FLUSH		10000	/* samples between flushes of the slots */
+
+/*
+ * streams: the stimulus of tb_daq, abz encoder counts of a motor moving
+ * at varying speed, and mostly idle inputs
+ */
+enum { ST_TB_DAQ, ST_ABZ, ST_IDLE, NSTREAMS };
+static const char *stream_names[NSTREAMS] = { "tb_daq", "abz", "idle" };
+static const int stream_width[NSTREAMS] = { 16, 3, 18 };
+
+static void
+stimulus(int st, uint32_t *s, int n)
+{
+	uint32_t priv[NSLOTS] = { 0x1234, 0x4321, 0x1111, 0x9a9a, 0x5b5b,
+		0xbcde, 0x0000 };
+	static const uint32_t gray[4] = { 0, 1, 3, 2 };
+	uint32_t prev = 0;
+	int pos = 0;
+	int i = 0;
+
+	while (i < n) {
+		int which = rand() % 100;
+		int run = 1;
+		uint32_t v = prev;
+
+		switch (st) {
+		case ST_TB_DAQ:
+			if (which < 80) {
+				v = prev;
+			} else if (which < 90) {
+				v = priv[rand() % NSLOTS];
+			} else if (which < 95) {
+				v = rand() & 0xffff;
+			} else if (which < 98) {
+				v = rand() & 0xffff;
+				run = rand() % 256;
+			} else {
+				v = rand() & 0xffff;
+				run = rand() % 2000;
+			}
+			if (which > 96)
+				priv[rand() % NSLOTS] = rand() & 0xffff;
+			break;
+		case ST_ABZ:
+			/* a and b in quadrature, z once per 1000 counts */
+			pos += which < 90 ? 1 : -1;
+			v = gray[pos & 3] | (pos % 1000 == 0) << 2;
+			run = 1 + rand() % 20;
+			break;
+		default:
+			if (which >= 50)
+				v = rand() & 0x3ffff;
+			run = 1 + rand() % 100000;
+			break;
+		}
+		for (; run > 0 && i < n; --run)
+			s[i++] = v;
+		prev = v;
+	}
+}
+
+/*
+ * the encoder of signal.v: each code is pushed msb first into a stream
+ * of words, each word remembers where the first code starting in it
+ * does and the time of that code, for the record headers. Like the
+ * FLUSH_FREQ timer of signal.v, the slots are forgotten every FLUSH
+ * samples
+ */
+typedef struct _enc {
+	uint32_t	*w;
+	uint8_t		*mark;
+	uint32_t	*mtime;
+	int		nw;
+	uint64_t	acc;
+	int		nacc;
+	uint32_t	mru[NSLOTS];
+	int		nvalid;
+	uint32_t	time;
+	uint32_t	done_time;	/* end of the last code in full words */
+	int		width;
+} enc_t;
+
+static void
+enc_put(enc_t *e, uint32_t bits, int len, uint32_t cnt)
+{
+	int start = e->nacc;
+
+	if (e->mark[e->nw] == 0xff) {
+		e->mark[e->nw] = start;
+		e->mtime[e->nw] = e->time;
+	}
+	e->acc = (e->acc << len) | bits;
+	e->nacc += len;
+	e->time += cnt;
+	if (e->nacc >= 32) {
+		e->nacc -= 32;
+		e->w[e->nw++] = e->acc >> e->nacc;
+		e->done_time = e->nacc == 0 ? e->time : e->time - cnt;
+	}
+}
+
+static void
+enc_count(enc_t *e, int slot, uint32_t cnt)
+{
+	if (cnt < 16)
+		enc_put(e, slot << 5 | cnt, 8, cnt);
+	else if (cnt < 256)
+		enc_put(e, slot << 10 | 2 << 8 | cnt, 13, cnt);
+	else
+		enc_put(e, slot << (3 + RLE_LEN) | 6 << RLE_LEN | cnt,
+			6 + RLE_LEN, cnt);
+}
+
+static void
+enc_use(enc_t *e, int k, uint32_t v)
+{
+	int i;
+
+	if (k >= e->nvalid && e->nvalid < NSLOTS)
+		++e->nvalid;
+	if (k == NSLOTS)
+		k = NSLOTS - 1;
+	for (i = k; i > 0; --i)
+		e->mru[i] = e->mru[i - 1];
+	e->mru[0] = v;
+}
+
+/* a run of run samples v */
+static void
+enc_run(enc_t *e, uint32_t v, uint32_t run)
+{
+	const uint32_t max = (1 << RLE_LEN) - 1;
+	int k;
+
+	for (k = 0; k < e->nvalid; ++k)
+		if (e->mru[k] == v)
+			break;
+	if (k == e->nvalid) {
+		enc_put(e, v, 3 + e->width, 1);
+		enc_use(e, NSLOTS, v);
+		--run;
+		k = 0;
+	}
+	while (run) {
+		uint32_t c = run < max ? run : max;
+
+		enc_count(e, k + 1, c);
+		enc_use(e, k, v);
+		run -= c;
+		k = 0;
+	}
+}
+
+/*
+ * the records of the n samples at s into out, returns their length in
+ * words. *ndone is the number of samples in complete words
+ */
+static int
+encode(const uint32_t *s, int n, int width, uint32_t time0, uint32_t *out,
+	int *ndone)
+{
+	enc_t e;
+	int len = 0;
+	int i;
+	int j;
+
+	memset(&e, 0, sizeof(e));
+	e.w = (uint32_t *)malloc(sizeof(uint32_t) * (n + 2));
+	e.mark = (uint8_t *)malloc(n + 2);
+	e.mtime = (uint32_t *)malloc(sizeof(uint32_t) * (n + 2));
+	memset(e.mark, 0xff, n + 2);
+	e.width = width;
+	e.time = time0;
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && s[j] == s[i] && j % FLUSH != 0; ++j)
+			;
+		if (i % FLUSH == 0)
+			e.nvalid = 0;
+		enc_run(&e, s[i], j - i);
+	}
+	for (i = 0; i < e.nw; i += DAQ_PACKET_SIZE) {
+		int nw = e.nw - i < DAQ_PACKET_SIZE ? e.nw - i :
+			DAQ_PACKET_SIZE;
+
+		if (e.mark[i] >= 32) {
+			printf("no code starts in word %d\n", i);
+			exit(1);
+		}
+		out[len++] = DAQT_SIGNAL_DATA << 24 | e.mark[i] << 18 |
+			RLE_LEN << 13 | width << 8 | nw;
+		out[len++] = e.mtime[i];
+		memcpy(out + len, e.w + i, nw * sizeof(uint32_t));
+		len += nw;
+	}
+	*ndone = e.done_time - time0;
+	free(e.w);
+	free(e.mark);
+	free(e.mtime);
+
+	return len;
+}
+
+/* the parser of tb_daq before, a bit at a time, without its output */
+typedef struct _ref {
+	const uint32_t	*buf;
+	int		len;
+	int		ptr;
+	int		ix;
+	int		p_end;
+	int		in_packet;
+	int		sig_width;
+	int		rle_len;
+} ref_t;
+
+static int
+ref_get_bits(ref_t *p, int num, uint32_t *res)
+{
+	uint32_t r = 0;
+	int i;
+
+	for (i = 0; i < num; ++i) {
+		if (!p->in_packet) {
+			if (p->ptr + 2 > p->len)
+				return -1;
+			p->sig_width = (p->buf[p->ptr] >> 8) & 0x1f;
+			p->rle_len = (p->buf[p->ptr] >> 13) & 0x1f;
+			p->p_end = p->ptr + 2 + (p->buf[p->ptr] & 0xff);
+			p->ptr += 2;
+			p->in_packet = 1;
+		}
+		r = (r << 1) | ((p->buf[p->ptr] >> (31 - p->ix)) & 1);
+		if (++p->ix == 32) {
+			p->ix = 0;
+			if (++p->ptr == p->p_end)
+				p->in_packet = 0;
+		}
+	}
+	*res = r;
+
+	return 0;
+}
+
+static int
+ref_decode(const uint32_t *buf, int len, uint32_t *out, int outmax)
+{
+	ref_t p;
+	uint32_t pipeline[NSLOTS] = { 0 };
+	uint32_t slot;
+	uint32_t sample;
+	uint32_t scnt;
+	uint32_t b;
+	int outlen = 0;
+	uint32_t i;
+
+	memset(&p, 0, sizeof(p));
+	p.buf = buf;
+	p.len = len;
+	while (outlen < outmax) {
+		if (ref_get_bits(&p, 3, &slot) < 0)
+			break;
+		if (slot == 0) {
+			if (ref_get_bits(&p, p.sig_width, &sample) < 0)
+				break;
+			memmove(pipeline + 1, pipeline, sizeof(*pipeline) *
+				(NSLOTS - 1));
+			pipeline[0] = sample;
+			out[outlen++] = sample;
+			continue;
+		}
+		if (ref_get_bits(&p, 1, &b) < 0)
+			break;
+		if (b == 0) {
+			if (ref_get_bits(&p, 4, &scnt) < 0)
+				break;
+		} else {
+			if (ref_get_bits(&p, 1, &b) < 0)
+				break;
+			if (b == 0) {
+				if (ref_get_bits(&p, 8, &scnt) < 0)
+					break;
+			} else {
+				if (ref_get_bits(&p, 1, &b) < 0 || b == 1 ||
+				    ref_get_bits(&p, p.rle_len, &scnt) < 0)
+					break;
+			}
+		}
+		sample = pipeline[slot - 1];
+		memmove(pipeline + 1, pipeline, sizeof(*pipeline) * (slot - 1));
+		pipeline[0] = sample;
+		for (i = 0; i < scnt && outlen < outmax; ++i)
+			out[outlen++] = sample;
+	}
+
+	return outlen;
+}
+
+/*
+ * all records at buf through sd, fetching at most chunk samples at a
+ * time. Returns the number of samples, -1 on an error
+ */
+static int
+decode(sigdec_t *sd, const uint32_t *buf, int len, uint32_t *out, int outmax,
+	int chunk)
+{
+	int outlen = 0;
+	int pos = 0;
+	int ret;
+
+	while (pos < len) {
+		ret = sigdec_record(sd, buf + pos, len - pos);
+		if (ret < 0)
+			return -1;
+		pos += ret;
+		do {
+			int max = outmax - outlen < chunk ? outmax - outlen :
+				chunk;
+
+			ret = sigdec_samples(sd, out + outlen, max);
+			if (ret < 0)
+				return -1;
+			outlen += ret;
+		} while (ret > 0);
+	}
+
+	return outlen;
+}
+
+#define CHECK_SAMPLES	200000
+
+static void
+compare(int st)
+{
+	static uint32_t s[CHECK_SAMPLES];
+	static uint32_t rec[CHECK_SAMPLES * 2];
+	static uint32_t out[CHECK_SAMPLES];
+	static const int chunks[] = { 1, 3, 64, CHECK_SAMPLES };
+	const char *name = stream_names[st];
+	sigdec_t sd;
+	int ndone;
+	int len;
+	int n;
+	int i;
+	int j;
+
+	stimulus(st, s, CHECK_SAMPLES);
+	len = encode(s, CHECK_SAMPLES, stream_width[st], 1000, rec, &ndone);
+
+	n = ref_decode(rec, len, out, CHECK_SAMPLES);
+	if (n != ndone || memcmp(out, s, n * sizeof(*s)) != 0) {
+		printf("%s: the model and the old parser disagree\n", name);
+		++errors;
+		return;
+	}
+	for (i = 0; i < 4; ++i) {
+		sigdec_init(&sd);
+		n = decode(&sd, rec, len, out, CHECK_SAMPLES, chunks[i]);
+		if (n < 0) {
+			printf("%s: chunk %d: %s\n", name, chunks[i],
+				sigdec_error(&sd));
+			++errors;
+			return;
+		}
+		if (n != ndone || memcmp(out, s, n * sizeof(*s)) != 0 ||
+		    sd.systime != 1000 + (uint32_t)ndone) {
+			printf("%s: chunk %d: %d samples, %d expected, or they "
+				"differ\n", name, chunks[i], n, ndone);
+			++errors;
+			return;
+		}
+	}
+
+	/*
+	 * starting at a later record: the samples from its time on, right
+	 * from the next flush on
+	 */
+	for (i = 0, j = 0; i < 5 && j < len; ++i)
+		j += 2 + (rec[j] & 0xff);
+	if (j < len) {
+		int t = rec[j + 1] - 1000;
+		int f = (t + FLUSH - 1) / FLUSH * FLUSH;
+
+		sigdec_init(&sd);
+		n = decode(&sd, rec + j, len - j, out, CHECK_SAMPLES, 100);
+		if (n != ndone - t || memcmp(out + f - t, s + f,
+		    (ndone - f) * sizeof(*s)) != 0) {
+			printf("%s: starting at word %d differs\n", name, j);
+			++errors;
+		}
+	}
+
+	/* a record that does not continue the one before */
+	sigdec_init(&sd);
+	rec[j + 1] += 1;
+	if (j < len && decode(&sd, rec, len, out, CHECK_SAMPLES, 100) != -1) {
+		printf("%s: wrong time in a record not detected\n", name);
+		++errors;
+	}
+	rec[j + 1] -= 1;
+
+	/*
+	 * invalid codes from the start of each record on, some of them
+	 * finish a code of the record before
+	 */
+	for (j = 0; j < len; j += 2 + (rec[j] & 0xff)) {
+		uint32_t w = rec[j + 2];
+
+		sigdec_init(&sd);
+		rec[j + 2] = 0xffffffff;
+		if (decode(&sd, rec, len, out, CHECK_SAMPLES, 100) != -1) {
+			printf("%s: invalid code at word %d not detected\n",
+				name, j + 2);
+			++errors;
+		}
+		rec[j + 2] = w;
+	}
+
+	/* a record of some other unit */
+	sigdec_init(&sd);
+	rec[0] = (rec[0] & 0xffffff) | DAQT_DRO_DATA << 24;
+	if (decode(&sd, rec, len, out, CHECK_SAMPLES, 100) != -1) {
+		printf("%s: record of another type not detected\n", name);
+		++errors;
+	}
+	rec[0] = (rec[0] & 0xffffff) | DAQT_SIGNAL_DATA << 24;
+}
+
+#define BENCH_SAMPLES	(4 << 20)
+#define BENCH_ROUNDS	8
+
+static void
+bench(void)
+{
+	uint32_t *s = (uint32_t *)malloc(sizeof(*s) * BENCH_SAMPLES);
+	uint32_t *rec = (uint32_t *)malloc(sizeof(*rec) * BENCH_SAMPLES * 2);
+	uint32_t *out = (uint32_t *)malloc(sizeof(*out) * BENCH_SAMPLES);
+	volatile uint32_t sink = 0;
+	int st;
+
+	for (st = 0; st < NSTREAMS; ++st) {
+		sigdec_t sd;
+		double t;
+		int ndone;
+		int len;
+		int n = 0;
+		int i;
+
+		stimulus(st, s, BENCH_SAMPLES);
+		len = encode(s, BENCH_SAMPLES, stream_width[st], 0, rec, &ndone);
+		printf("%s: %.2f bits per sample\n", stream_names[st],
+			32.0 * len / ndone);
+
+		t = now();
+		n = ref_decode(rec, len, out, BENCH_SAMPLES);
+		sink += out[n - 1];
+		t = now() - t;
+		printf("  %-10s %9.1f Msamples/s %8.1f MB/s\n", "bitwise",
+			n / t / 1e6, len * 4 / t / 1e6);
+
+		t = now();
+		for (i = 0; i < BENCH_ROUNDS; ++i) {
+			sigdec_init(&sd);
+			n = decode(&sd, rec, len, out, BENCH_SAMPLES, 4096);
+			sink += out[n - 1];
+		}
+		t = now() - t;
+		printf("  %-10s %9.1f Msamples/s %8.1f MB/s\n", "sigdec",
+			(double)n * BENCH_ROUNDS / t / 1e6,
+			(double)len * 4 * BENCH_ROUNDS / t / 1e6);
+	}
+	free(s);
+	free(rec);
+	free(out);
+}
+
+static void
+checks(void)
+{
+	int st;
+
+	for (st = 0; st < NSTREAMS; ++st)
+		compare(st);
+}
+
+int
+main(int argc, char **argv)
+{
+	return bench_main(argc, argv, checks, bench,
+		"decoded streams match the stimulus and the old parser");
+}
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "sigdec.h"
+#include "daqdemux.h"
+
+/* codes have to fit the 32 bits a refill guarantees */
+#define SIGDEC_MAX_WIDTH	29
+#define SIGDEC_MAX_RLE		26
+/* runs up to this long are stored without a loop over their length */
+#define SIGDEC_SHORT		16
+
+void
+sigdec_init(sigdec_t *sd)
+{
+	memset(sd, 0, sizeof(*sd));
+}
+
+const char *
+sigdec_error(const sigdec_t *sd)
+{
+	return sd->err;
+}
+
+static void
+sigdec_table(sigdec_t *sd)
+{
+	int i;
+
+	for (i = 0; i < 1 << SIGDEC_PREFIX; ++i) {
+		sigdec_code_t *c = &sd->tab[i];
+		int slot = i >> 3;
+
+		c->slot = slot;
+		if (slot == 0) {
+			c->hdr = 3;
+			c->vbits = sd->sig_width;
+		} else if ((i & 4) == 0) {
+			c->hdr = 4;
+			c->vbits = 4;
+		} else if ((i & 2) == 0) {
+			c->hdr = 5;
+			c->vbits = 8;
+		} else if ((i & 1) == 0) {
+			c->hdr = 6;
+			c->vbits = sd->rle_len;
+		} else {
+			c->hdr = 0;
+			c->vbits = 0;
+		}
+		c->len = c->hdr + c->vbits;
+	}
+}
+
+static inline void
+sigdec_refill(sigdec_t *sd)
+{
+	if (sd->nbits <= 32 && sd->p < sd->end) {
+		sd->bb |= (uint64_t)*sd->p++ << (32 - sd->nbits);
+		sd->nbits += 32;
+	}
+}
+
+/* the samples the code at the top of bb stands for */
+static inline uint32_t
+sigdec_count(const sigdec_t *sd, const sigdec_code_t *c)
+{
+	if (c->slot == 0)
+		return 1;
+	if (c->vbits == 0)
+		return 0;	/* the invalid prefix */
+	return (sd->bb << c->hdr) >> (64 - c->vbits);
+}
+
+int
+sigdec_record(sigdec_t *sd, const uint32_t *w, int len)
+{
+	uint32_t h;
+	int offset;
+	int rle_len;
+	int sig_width;
+	int n;
+	int left;
+
+	if (len < 2 || len < 2 + (int)(w[0] & 0xff)) {
+		snprintf(sd->err, sizeof(sd->err), "record cut off");
+		return -1;
+	}
+	h = w[0];
+	if (h >> 24 != DAQT_SIGNAL_DATA && h >> 24 != DAQT_ABZ_DATA) {
+		snprintf(sd->err, sizeof(sd->err), "not a signal record: %08x",
+			h);
+		return -1;
+	}
+	n = h & 0xff;
+	offset = (h >> 18) & 0x3f;
+	rle_len = (h >> 13) & 0x1f;
+	sig_width = (h >> 8) & 0x1f;
+	if (n == 0 || offset >= 32) {
+		snprintf(sd->err, sizeof(sd->err), "bad record header %08x", h);
+		return -1;
+	}
+	if (sd->p != sd->end || sd->run_left || (sd->nbits &&
+	    sd->tab[sd->bb >> (64 - SIGDEC_PREFIX)].len <= sd->nbits)) {
+		snprintf(sd->err, sizeof(sd->err),
+			"samples of the record before not fetched");
+		return -1;
+	}
+
+	if (!sd->synced) {
+		if (sig_width < 1 || sig_width > SIGDEC_MAX_WIDTH ||
+		    rle_len < 8 || rle_len > SIGDEC_MAX_RLE) {
+			snprintf(sd->err, sizeof(sd->err),
+				"unsupported sig_width %d rle_len %d",
+				sig_width, rle_len);
+			return -1;
+		}
+		sd->sig_width = sig_width;
+		sd->rle_len = rle_len;
+		sigdec_table(sd);
+		/* the rest of a code from before the capture */
+		sd->bb = (uint64_t)w[2] << (32 + offset);
+		sd->nbits = 32 - offset;
+		sd->p = w + 3;
+		sd->end = w + 2 + n;
+		sd->systime = w[1];
+		sd->synced = 1;
+		++sd->records;
+		return 2 + n;
+	}
+
+	if (sig_width != sd->sig_width || rle_len != sd->rle_len) {
+		snprintf(sd->err, sizeof(sd->err),
+			"sig_width/rle_len changed to %d/%d", sig_width,
+			rle_len);
+		return -1;
+	}
+	/*
+	 * the bits left belong to a code finished by the first word, the
+	 * first code of the record starts after it
+	 */
+	left = sd->nbits;
+	sd->p = w + 2;
+	sd->end = w + 2 + n;
+	sigdec_refill(sd);
+	if (left) {
+		const sigdec_code_t *c = &sd->tab[sd->bb >> (64 - SIGDEC_PREFIX)];
+
+		if (c->len == 0) {
+			snprintf(sd->err, sizeof(sd->err), "invalid code in "
+				"front of the record at time %u", w[1]);
+			return -1;
+		}
+		if (c->len != left + offset || sd->systime +
+		    sigdec_count(sd, c) != w[1]) {
+			snprintf(sd->err, sizeof(sd->err), "record at bit %d "
+				"time %u, expected bit %d time %u", offset,
+				w[1], c->len - left,
+				sd->systime + sigdec_count(sd, c));
+			return -1;
+		}
+	} else if (offset != 0 || sd->systime != w[1]) {
+		snprintf(sd->err, sizeof(sd->err), "record at bit %d time %u, "
+			"expected bit 0 time %u", offset, w[1], sd->systime);
+		return -1;
+	}
+	++sd->records;
+
+	return 2 + n;
+}
+
+int
+sigdec_samples(sigdec_t *sd, uint32_t *out, int max)
+{
+	const uint32_t *p = sd->p;
+	const uint32_t *end = sd->end;
+	uint32_t mru[SIGDEC_NSLOTS];
+	uint32_t systime = sd->systime;
+	uint64_t bb = sd->bb;
+	int nbits = sd->nbits;
+	int n = 0;
+	int i;
+
+	if (sd->run_left) {
+		n = sd->run_left < (uint32_t)max ? sd->run_left : max;
+		for (i = 0; i < n; ++i)
+			out[i] = sd->run;
+		sd->run_left -= n;
+	}
+
+	/* locals only, out could alias anything of type uint32_t in sd */
+	memcpy(mru, sd->mru, sizeof(mru));
+	while (n < max) {
+		const sigdec_code_t *c;
+		uint32_t sample;
+		uint32_t cnt;
+		uint32_t v;
+		int k;
+
+		if (nbits <= 32 && p < end) {
+			bb |= (uint64_t)*p++ << (32 - nbits);
+			nbits += 32;
+		}
+		c = &sd->tab[bb >> (64 - SIGDEC_PREFIX)];
+		if (c->len > nbits)
+			break;		/* continues in the next record */
+		if (c->vbits == 0) {
+			snprintf(sd->err, sizeof(sd->err),
+				"bad count prefix at time %u", systime);
+			return -1;
+		}
+		v = (bb << c->hdr) >> (64 - c->vbits);
+		bb <<= c->len;
+		nbits -= c->len;
+
+		/*
+		 * a new sample pushes the whole list down, a known one only
+		 * the part in front of it
+		 */
+		k = c->slot ? c->slot - 1 : SIGDEC_NSLOTS - 1;
+		sample = c->slot ? mru[k] : v;
+		cnt = c->slot ? v : 1;
+		for (i = SIGDEC_NSLOTS - 1; i > 0; --i)
+			mru[i] = i <= k ? mru[i - 1] : mru[i];
+		mru[0] = sample;
+		systime += cnt;
+
+		if (cnt <= SIGDEC_SHORT && max - n >= SIGDEC_SHORT) {
+			/* a fixed length store, the rest is written over */
+			for (i = 0; i < SIGDEC_SHORT; ++i)
+				out[n + i] = sample;
+			n += cnt;
+			continue;
+		}
+		if (cnt > (uint32_t)(max - n)) {
+			sd->run = sample;
+			sd->run_left = cnt - (max - n);
+			cnt = max - n;
+		}
+		for (i = 0; i < (int)cnt; ++i)
+			out[n + i] = sample;
+		n += cnt;
+	}
+	memcpy(sd->mru, mru, sizeof(mru));
+	sd->p = p;
+	sd->bb = bb;
+	sd->nbits = nbits;
+	sd->systime = systime;
+	sd->samples += n;
+
+	return n;
+}
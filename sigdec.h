@@ -0,0 +1,74 @@
+#ifndef __SIGDEC__H__
+#define __SIGDEC__H__
+
+#include <stdint.h>
+
+/*
+ * decoder for the sample stream of signal.v, as sent in its daq records:
+ * a header word (type 0x40 or 0x48, offset 23:18, rle_len 17:13,
+ * sig_width 12:8, len 7:0), the systime of the first code starting in
+ * the record and len words of codes. Codes are packed msb first and run
+ * on from one record into the next. Each starts with a 3 bit slot:
+ *
+ *	0	sig_width bits of a new sample
+ *	1..7	the sample in that slot of the most recently used list,
+ *		followed by its count: 0 and 4 bits, 10 and 8 bits or 110
+ *		and rle_len bits
+ *
+ * A sample used moves to the front of the list, a new one pushes the
+ * last one out. offset is the bit in the first word the first code of the
+ * record starts at, the rest of the word finishes the code of the record
+ * before. The decoder checks this and the time of each record against
+ * its own. The first record it sees sets them, so it can start anywhere
+ * in a stream. Samples from slots filled before that are wrong until
+ * signal.v flushes its slots, FLUSH_FREQ times a second.
+ * Codes are taken from a 64 bit buffer, refilled a word at a time, with
+ * a table over the slot and count prefix giving a code's layout.
+ */
+#define SIGDEC_NSLOTS	7
+#define SIGDEC_PREFIX	6	/* bits of slot and count prefix */
+
+typedef struct _sigdec_code {
+	uint8_t		len;		/* of the whole code, 0 for a bad one */
+	uint8_t		hdr;		/* bits in front of the value */
+	uint8_t		vbits;		/* sample or count */
+	uint8_t		slot;
+} sigdec_code_t;
+
+typedef struct _sigdec {
+	uint64_t	bb;		/* bit buffer, next bit at the top */
+	int		nbits;		/* bits in bb */
+	const uint32_t	*p;		/* words of the record not in bb yet */
+	const uint32_t	*end;
+	uint32_t	mru[SIGDEC_NSLOTS];
+	uint32_t	systime;	/* of the next code */
+	uint32_t	run;		/* sample of a run cut off by out */
+	uint32_t	run_left;
+	int		sig_width;
+	int		rle_len;
+	int		synced;		/* seen a record */
+	uint64_t	samples;	/* statistics */
+	uint64_t	records;
+	sigdec_code_t	tab[1 << SIGDEC_PREFIX];
+	char		err[80];
+} sigdec_t;
+
+void sigdec_init(sigdec_t *sd);
+
+/*
+ * the record of len words at w, header first. The samples of the record
+ * before must have been fetched. Returns the length of the record, -1
+ * if it is no signal or abz record or does not fit the stream, see
+ * sigdec_error
+ */
+int sigdec_record(sigdec_t *sd, const uint32_t *w, int len);
+
+/*
+ * up to max samples of the current record into out. Returns their
+ * number, 0 when the record is used up, -1 on a bad code
+ */
+int sigdec_samples(sigdec_t *sd, uint32_t *out, int max);
+
+const char *sigdec_error(const sigdec_t *sd);
+
+#endif
@@ -1,93 +1,57 @@
 #include <stdlib.h>
 #include <stddef.h>
-#include <setjmp.h>
 #include <stdarg.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/select.h>
 #include <arpa/inet.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 #include <pcre.h>
 #include "Vconan.h"
 #include "verilated.h"
 #include "vsyms.h"
-
-static int color_disabled = 0;
-
-#define CMD_GET_VERSION		0
-#define CMD_SYNC_TIME		1
-#define CMD_GET_TIME		2
-#define CMD_CONFIG_PWM		3
-#define CMD_SCHEDULE_PWM	4
-#define CMD_CONFIG_STEPPER	5
-#define CMD_QUEUE_STEP		6
-#define CMD_SET_NEXT_STEP_DIR	7
-#define CMD_RESET_STEP_CLOCK	8
-#define CMD_STEPPER_GET_POS	9
-#define CMD_ENDSTOP_SET_STEPPER	10
-#define CMD_ENDSTOP_QUERY	11
-#define CMD_ENDSTOP_HOME	12
-#define CMD_TMCUART_WRITE	13
-#define CMD_TMCUART_READ	14
-#define CMD_SET_DIGITAL_OUT	15
-#define CMD_CONFIG_DIGITAL_OUT	16
-#define CMD_SCHEDULE_DIGITAL_OUT 17
-#define CMD_UPDATE_DIGITAL_OUT	18
-#define CMD_SHUTDOWN		19
-#define CMD_STEPPER_GET_NEXT	20
-#define CMD_CONFIG_DRO		21
-#define CMD_CONFIG_AS5311	22
-#define CMD_SD_QUEUE		23
-#define CMD_CONFIG_ETHER	24
-#define CMD_ETHER_MD_READ	25
-#define CMD_ETHER_MD_WRITE	26
-#define CMD_ETHER_SET_STATE	27
-#define CMD_CONFIG_SIGNAL	28
-#define CMD_CONFIG_BISS		29
-#define CMD_BISS_FRAME		30
-#define CMD_CONFIG_ABZ		31
-
-#define RSP_GET_VERSION		0
-#define RSP_GET_TIME		1
-#define RSP_STEPPER_GET_POS	2
-#define RSP_ENDSTOP_STATE	3
-#define RSP_TMCUART_READ	4
-#define RSP_SHUTDOWN		5
-#define RSP_STEPPER_GET_NEXT	6
-#define RSP_DRO_DATA		7
-#define RSP_AS5311_DATA		8
-#define RSP_SD_CMDQ		9
-#define RSP_SD_DATQ		10
-#define RSP_ETHER_MD_READ	11
-#define RSP_BISS_FRAME		12
+#include "watch.h"
+#include "recorder.h"
+#include "fiber.h"
+#include "log.h"
+#include "txlog.h"
+#include "crc.h"
+#include "cmds.h"
+#include "daqdemux.h"
 
 #define HZ 48000000
+/* host link, has to match the BAUD parameter of the model */
+#ifndef BAUD
+#define BAUD 250000
+#endif
 #define NUART 6
 
-#define WF_WATCH	1
-#define WF_PRINT	2
-#define WF_ALL		(WF_WATCH | WF_PRINT)
-
-#define FORM_BIN	1
-#define FORM_HEX	2
-#define FORM_DEC	3
-
-#define COLOR_NONE	1
-#define COLOR_CHANGED	2
-#define COLOR_ALWAYS	3
+/*
+ * BFM scheduler entry. A BFM is called when one of the signals it is
+ * sensitive to changed since its last call, or when its wake-up cycle is
+ * reached. The tick returns the next wake-up cycle, SCHED_NEVER to only
+ * react to signal changes
+ */
+#define SCHED_NEVER	(~0ull)
+#define SCHED_MAXSENSE	4
 
-typedef struct _watch_entry {
-	int		sig;	/* signal number */
-	char		*nick;
-	int		flags;
-	void		*val;
-	uint64_t	*mask;
-	int		format;
-	int		cmp;
-} watch_entry_t;
-
-typedef struct _watch {
-	watch_entry_t	*we;
-	int		n;
-	Vconan		*tb;
-	uint64_t	last_cycle;
-} watch_t;
+struct _sim;
+typedef struct _sched {
+	const char	*name;
+	uint64_t	(*tick)(struct _sim *sp, void *arg);
+	void		*arg;
+	int		prof;		/* profiler component */
+	uint64_t	wake;
+	int		nsense;
+	vluint8_t	*sense[SCHED_MAXSENSE];
+	vluint8_t	last[SCHED_MAXSENSE];	/* values at the last call */
+	struct _sched	*next;
+} sched_t;
 
 #define MAXPACKET	128
 
@@ -101,6 +65,10 @@ typedef struct {
 	int		len;		/* buffer len */
 	int		seq;		/* next seq to send */
 	const char	*name;
+	sched_t		*se;		/* if scheduled on its own */
+	uint64_t	next;		/* tlm: first cycle for the next byte */
+	vluint8_t	*cts;		/* if set, bytes wait while it is low */
+	uint64_t	cts_stalls;	/* cycles a byte waited for cts */
 	uint8_t		buf[MAXPACKET];
 } uart_send_t;
 
@@ -114,10 +82,37 @@ typedef struct {
 	int		pos;		/* pos in buffer */
 	const char	*name;
 	uint8_t		buf[MAXPACKET];
-	/* packet level */
-	int		expected_seq;
 } uart_recv_t;
 
+/*
+ * frames from the fpga. The host link receiver only delivers bytes, the
+ * splitter collects them in a ring, cuts them into frames and queues
+ * them until a test takes them, so any number of frames may arrive
+ * unasked, e.g. back to back involuntary responses. Bad frames are
+ * counted and dropped, the splitter then syncs on the next 0x7e trailer.
+ * Errors only fail the test once a frame is taken
+ */
+#define RXRING	256	/* bytes, power of 2, > MAXPACKET */
+
+typedef struct _rx_frame {
+	struct _rx_frame *next;
+	uint64_t	cycle;		/* when it was complete */
+	int		len;
+	uint8_t		buf[MAXPACKET];
+} rx_frame_t;
+
+typedef struct {
+	uint8_t		ring[RXRING];
+	unsigned int	head;		/* next to write */
+	unsigned int	tail;		/* first not yet split */
+	int		sync;		/* dropping up to the next trailer */
+	int		expected_seq;
+	int		errors;
+	rx_frame_t	*first;		/* queue of complete frames */
+	rx_frame_t	**last;
+	int		nframes;
+} frame_rx_t;
+
 typedef struct {
 	uart_send_t *usp;
 	uart_recv_t *urp;
@@ -133,6 +128,9 @@ typedef struct {
 	vluint8_t *line_in;
 	vluint8_t *line_out;
 
+	sched_t *se;
+	int chan;	/* slot, for the transaction log */
+
 	uint32_t regs[128];
 } tmcuart_t;
 #define TU_READ		1
@@ -160,6 +158,7 @@ typedef struct {
 	vluint8_t	*cs;
 	vluint8_t	*clk;
 	vluint8_t	*dout;
+	sched_t		*se;
 } as5311_t;
 
 #define SDC_IDLE	0
@@ -187,6 +186,7 @@ typedef struct {
 	int		cmd_rcv_ready;
 	int		sndbits;
 	uint8_t		sndbuf[17];
+	sched_t		*se;
 } sd_t;
 
 typedef struct {
@@ -209,393 +209,175 @@ typedef struct {
 	int		phy;
 	int		reg;
 	uint16_t	data;
+	sched_t		*se;
 } ether_t;
 
-typedef struct {
+#define DAQ_DEPTH	512	/* records per source, more than a frame holds */
+
+/*
+ * test procedures run as tasks, each on its own fiber. All unfinished
+ * tasks are resumed once per cycle from step(), so several tests can run
+ * concurrently against the same model
+ */
+struct _sim;
+typedef struct _task {
+	fiber_t		*fiber;
+	struct _sim	*sp;
+	void		(*fn)(struct _sim *sp);
+	const char	*name;
+	uint64_t	delay_until;
+	struct _task	*next;
+} task_t;
+
+typedef struct _sim {
 	Vconan		*tb;
 	uart_recv_t	*urp;
 	uart_send_t	*usp;
+	frame_rx_t	*frx;		/* frames from the host link */
 	as5311_t	*as5311[NAS5311];
 	sd_t		*sd;
 	ether_t		*ether;
+	daq_demux_t	*daq;		/* records of the last daq frame */
 	uint64_t	last_change;
 	watch_t		*wp;
 	uint64_t	cycle;
-	jmp_buf		main_jb;
-	jmp_buf		test_jb;
-	vluint8_t	*signal8p;
-	vluint8_t	signal8v;
-	uint64_t	delay_until;
+	task_t		*tasks;
+	task_t		*current;	/* task currently running */
+	task_t		*link_owner;	/* task owning the host link */
+	struct _host_pipe *pipe;	/* pipelined host link, if running */
 	tmcuart_t	*tmcuart[NUART];
+	sched_t		*sched;		/* BFMs to call from step() */
+	int		fast_forward;	/* skip step() while nothing happens */
+	const char	*ckpt_prefix;	/* save a checkpoint after each stage */
+	const char	*restored;	/* stage the model was restored after */
 } sim_t;
 
-static void tmcuart_tick(sim_t *sp);
-static void as5311_tick(sim_t *sp);
-static void sd_tick(sim_t *sp);
-static void ether_tick(sim_t *sp);
 static void wait_for_uart_send(sim_t *sp);
+static void yield(sim_t *sp);
+static void link_acquire(sim_t *sp);
+static void link_release(sim_t *sp);
 static void fail(const char *msg, ...);
 static int get_packet(sim_t *sp, ether_t *eth, uint32_t *ret_data, int ret_max);
+static daq_demux_t *get_daq_packet(sim_t *sp, ether_t *eth, uint32_t *buf,
+	int max);
 
-watch_t *
-watch_init(Vconan *tb)
-{
-	watch_t *wp = (watch_t *)calloc(sizeof(*wp), 1);
-	wp->we = (watch_entry_t *)calloc(sizeof(*wp->we), NSIGS * 10);
-	wp->tb = tb;
-
-	return wp;
-}
-
-static int
-sig_to_len(int sig)
-{
-	int len;
-
-	switch (vsigs[sig].type) {
-	case sigC: len = 1; break;
-	case sigS: len = 2; break;
-	case sigI: len = 4; break;
-	case sigQ: len = 8; break;
-	case sigW: len = 4; break;
-	default:
-		printf("inval sig type\n");
-		exit(1);
-	}
-
-	return len * vsigs[sig].num;
-}
-
-static void *
-watch_get_value(watch_t *wp, int sig)
-{
-	int len = sig_to_len(sig);
-	Vconan *tb = wp->tb;
-	void *v = malloc(len);
-
-	memcpy(v, (uint8_t *)tb + vsigs[sig].offset, len);
-
-	return v;
-}
-
-static int
-watch_cmp_value(int sig, void *v1, void *v2, uint64_t *mask)
-{
-	int len = sig_to_len(sig);
-
-	return memcmp(v1, v2, len);
-}
+/*
+ * log categories of the BFMs, chatter goes to LOG_DEBUG
+ */
+enum {
+	LOGC_HOST,
+	LOGC_TMCUART,
+	LOGC_SD,
+	LOGC_ETHER,
+	LOGC_NUM
+};
+
+static const char *log_names[LOGC_NUM] = {
+	"host", "tmcuart", "sd", "ether"
+};
+
+/* transactions of all BFMs, with --txlog */
+static const char *txlog_file;
+static txlog_t *txl;
 
-static int
-find_signal(const char *name, int *start)
+/*
+ * BFM scheduler. Change detection runs once per step(), after the model
+ * has been evaluated. A new entry is called in the next step() to pick
+ * up its initial state
+ */
+static sched_t *
+sched_add(sim_t *sp, const char *name, uint64_t (*tick)(sim_t *sp, void *arg),
+	void *arg, int prof)
 {
-	int i;
-	const char *err_str;
-	int err_off;
-	int ret;
-	pcre *comp = pcre_compile(name, 0, &err_str, &err_off, NULL);
+	sched_t *se = (sched_t *)calloc(1, sizeof(*se));
+	sched_t **sep;
 
-	if (comp == NULL) {
-		printf("name %s not a valid regexp: %s\n", name, err_str);
-		exit(1);
-	}
-
-	for (i = *start; i < NSIGS; ++i) {
-		ret = pcre_exec(comp, NULL, vsigs[i].name,
-			strlen(vsigs[i].name), 0, 0, NULL, 0);
-		if (ret == PCRE_ERROR_NOMATCH)
-			continue;
-		if (ret < 0) {
-			printf("pcre match failed with %d\n", ret);
-			exit(1);
-		}
-		*start = i + 1;
+	se->name = name;
+	se->tick = tick;
+	se->arg = arg;
+	se->prof = prof;
+	se->wake = 0;
 
-		return i;
-	}
+	for (sep = &sp->sched; *sep != NULL; sep = &(*sep)->next)
+		;
+	*sep = se;
 
-	return -1;
+	return se;
 }
 
 static void
-watch_add(watch_t *wp, const char *name, const char *nick, uint64_t *mask,
-	int format, int flags)
+sched_sense(sched_t *se, vluint8_t *sig)
 {
-	int _r = 0;
-	int at_least_one = 0;
-	int sig;
-
-	while ((sig = find_signal(name, &_r)) >= 0) {
-		if (nick)
-			printf("watch: adding %s as %s\n", vsigs[sig].name, nick);
-		else
-			printf("watch: adding %s as <unnamed>\n", vsigs[sig].name);
-		wp->we[wp->n].sig = sig;
-		wp->we[wp->n].nick = nick ? strdup(nick) : NULL;
-		wp->we[wp->n].flags = flags;
-		wp->we[wp->n].format = format;
-		wp->we[wp->n].val = watch_get_value(wp, sig);
-		/* TODO: save mask */
-		++wp->n;
-		if (wp->n == NSIGS * 10) {
-			printf("too many signals in watchlist\n");
-			exit(1);
-		}
-		at_least_one = 1;
-		nick = NULL;
-	}
-	if (!at_least_one) {
-		printf("name %s doesn't match any signal\n", name);
-		exit(0);
+	if (se->nsense == SCHED_MAXSENSE) {
+		printf("too many signals for %s\n", se->name);
+		exit(1);
 	}
+	se->last[se->nsense] = *sig;
+	se->sense[se->nsense++] = sig;
 }
 
 static void
-watch_remove(watch_t *wp, const char *name)
+sched_remove(sim_t *sp, sched_t *se)
 {
-	int _r = 0;
-	int sig;
-	int i;
+	sched_t **sep;
 
-	while ((sig = find_signal(name, &_r)) >= 0) {
-		for (i = 0; i < wp->n; ++i) {
-			if (wp->we[i].sig == sig) {
-				free(wp->we[i].nick);
-				free(wp->we[i].val);
-				memmove(wp->we + i, wp->we + i + 1, sizeof(*wp->we) * (wp->n - i));
-				--wp->n;
-				break;
-			}
-		}
-	}
+	for (sep = &sp->sched; *sep != se; sep = &(*sep)->next)
+		;
+	*sep = se->next;
+	free(se);
 }
 
+/*
+ * call the BFM in the next step(), e.g. after a task handed it work
+ */
 static void
-watch_clear(watch_t *wp)
+sched_wake(sched_t *se)
 {
-	int i;
-
-	for (i = 0; i < wp->n; ++i) {
-		free(wp->we[i].nick);
-		free(wp->we[i].val);
-	}
-	wp->n = 0;
-}
-
-#define C_BLACK "\e[30m"
-#define C_RED "\e[31m"
-#define C_GREEN "\e[32m"
-#define C_YELLOW "\e[33m"
-#define C_BLUE "\e[34m"
-#define C_MAGENTA "\e[35m"
-#define C_CYAN "\e[36m"
-#define C_WHITE "\e[37m"
-#define C_RESET "\e[0m"
-static void
-print_value(watch_entry_t *we, int do_color)
-{
-	int len = sig_to_len(we->sig);
-	const char *c = NULL;
-	char outbuf[1000];
-	uint64_t v;
-	int type = vsigs[we->sig].type;
-
-	if (color_disabled)
-		do_color = COLOR_NONE;
-	if (do_color == COLOR_CHANGED && we->cmp)
-		c = C_RED;
-	else if (do_color == COLOR_ALWAYS)
-		c = C_GREEN;
-	if (we->nick)
-		printf(" %s %s", we->nick, c ? c : "");
-	else
-		printf(" %s", c ? c : "");
-
-	for (int i = 0; i < vsigs[we->sig].num; ++i) {
-		uint64_t val;
-
-		if (i > 0)
-			printf("/");
-		if (type == sigC)
-			val = ((uint8_t *)we->val)[i];
-		else if (type == sigS)
-			val = ((uint16_t *)we->val)[i];
-		else if (type == sigI)
-			val = ((uint32_t *)we->val)[i];
-		else if (type == sigQ)
-			val = ((uint64_t *)we->val)[i];
-		else if (type == sigW)
-			val = ((uint32_t *)we->val)[i];
-
-		if (we->format == FORM_HEX) {
-			printf("%lx", val);
-		} else if (we->format == FORM_DEC) {
-			printf("%ld", val);
-		} else if (we->format == FORM_BIN) {
-			int first = 0;
-			int i;
-
-			for (i = 63; i >= 0; --i) {
-				int bit = (val & (1ul << 63)) != 0;
-
-				val <<= 1;
-
-				if (bit == 0 && !first)
-					continue;
-				first = 1;
-				printf("%d", bit);
-			}
-			if (!first)
-				printf("0");
-		} else {
-			printf("invalid format %d\n", we->format);
-			exit(1);
-		}
-	}
-
-	if (c)
-		printf("%s", C_RESET);
+	if (se != NULL)
+		se->wake = 0;
 }
 
-static void
-do_watch(watch_t *wp, uint64_t cycle)
+static int
+sched_changed(sched_t *se)
 {
 	int i;
-	int same = 1;
-	int header_done;
-	void *v;
-
-	if (cycle - wp->last_cycle > 1000000)
-		fail("abort due to inactivity\n");
-
-	/*
-	 * compare signals
-	 */
-	for (i = 0; i < wp->n; ++i) {
-		watch_entry_t *we = wp->we + i;
-		int ret = 0;
-		void *v = NULL;
-
-		v = watch_get_value(wp, we->sig);
-		ret = watch_cmp_value(we->sig, we->val, v, we->mask);
-		if (ret != 0 && (we->flags & WF_WATCH))
-			same = 0;
-		we->cmp = ret;
-		free(we->val);
-		we->val = v;
-	}
-
-	if (same)
-		return;
-
-	uint64_t diff = cycle - wp->last_cycle;
 
-	/* print all fixed values */
-	header_done = 0;
-	for (i = 0; i < wp->n; ++i) {
-		watch_entry_t *we = wp->we + i;
-		int flags = we->flags;
+	for (i = 0; i < se->nsense; ++i)
+		if (*se->sense[i] != se->last[i])
+			return 1;
 
-		if (flags & WF_PRINT) {
-			if (!header_done) {
-				printf("% 10d % 6d", cycle, diff);
-				header_done = 1;
-			}
-			print_value(we, COLOR_CHANGED);
-		}
-	}
-	if (header_done)
-		printf("\n");
-
-	header_done = 0;
-	/* print watch-only first */
-	for (i = 0; i < wp->n; ++i) {
-		watch_entry_t *we = wp->we + i;
-		int flags = we->flags;
-
-		if (flags & WF_WATCH && we->cmp && ~flags & WF_PRINT) {
-			if (!header_done) {
-				printf("% 10d % 6d changed", cycle, diff);
-				header_done = 1;
-			}
-			print_value(we, COLOR_NONE);
-		}
-	}
-	if (header_done)
-		printf("\n");
-
-	wp->last_cycle = cycle;
-}
-
-uint16_t
-crc16_ccitt(uint8_t *buf, uint_fast8_t len)
-{
-	uint16_t crc = 0xffff;
-	while (len--) {
-		uint8_t data = *buf++;
-		data ^= crc & 0xff;
-		data ^= data << 4;
-		crc = ((((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4)
-		       ^ ((uint16_t)data << 3));
-	}
-	return crc;
+	return 0;
 }
 
-// Encode an integer as a variable length quantity (vlq)
-static uint8_t *
-encode_int(uint8_t *p, uint32_t v)
+/*
+ * first cycle any BFM has to be called without a signal change
+ */
+static uint64_t
+sched_next(sim_t *sp)
 {
-	int32_t sv = v;
+	uint64_t wake = SCHED_NEVER;
+	sched_t *se;
 
-	if (sv < (3L<<5)  && sv >= -(1L<<5))
-		goto f4;
-	if (sv < (3L<<12) && sv >= -(1L<<12))
-		goto f3;
-	if (sv < (3L<<19) && sv >= -(1L<<19))
-		goto f2;
-	if (sv < (3L<<26) && sv >= -(1L<<26))
-		goto f1;
-	*p++ = (v>>28) | 0x80;
-f1:	*p++ = ((v>>21) & 0x7f) | 0x80;
-f2:	*p++ = ((v>>14) & 0x7f) | 0x80;
-f3:	*p++ = ((v>>7) & 0x7f) | 0x80;
-f4:	*p++ = v & 0x7f;
+	for (se = sp->sched; se != NULL; se = se->next)
+		if (se->wake < wake)
+			wake = se->wake;
 
-	return p;
+	return wake;
 }
 
-// Parse an integer that was encoded as a "variable length quantity"
 static int
-parse_int(const uint8_t *buf, int pos, int len, uint32_t *val)
+sched_pending(sim_t *sp)
 {
-	int last = pos + len;
-	uint8_t c;
-	uint32_t v;
-
-	if (pos >= last)
-		goto err;
-
-	c = buf[pos++];
-	v = c & 0x7f;
+	sched_t *se;
 
-	if ((c & 0x60) == 0x60)
-		v |= -0x20;
-	while (c & 0x80) {
-		if (pos >= last)
-			goto err;
-		c = buf[pos++];
-		v = (v<<7) | (c & 0x7f);
-	}
-
-	*val = v;
+	for (se = sp->sched; se != NULL; se = se->next)
+		if (sched_changed(se))
+			return 1;
 
-	return pos - (last - len);
-
-err:
-	printf("parse_int failed, buffer too short\n");
-	exit(1);
+	return 0;
 }
 
+
 /*
  * UART send
  */
@@ -628,6 +410,12 @@ uart_send_tick(uart_send_t *usp, int *want_dump)
 	if (--usp->cnt != 0)
 		return 0;
 
+	if (usp->bit == 0 && usp->cts != NULL && !*usp->cts) {
+		/* receiver full, try again in the next cycle */
+		usp->cnt = 1;
+		++usp->cts_stalls;
+		return 0;
+	}
 	if (usp->bit == 0) {
 		/* start bit */
 		*usp->tx = 0;
@@ -664,83 +452,61 @@ uart_send(uart_send_t *usp, uint8_t *buf, int len)
 	usp->pos = 0;
 	usp->len = len;
 	memcpy(usp->buf, buf, len);
+	sched_wake(usp->se);
 
-	printf("uart_send (%s):", usp->name);
+	LOG(LOGC_HOST, LOG_DEBUG, "uart_send (%s):", usp->name);
 	for (int i = 0; i < len; ++i)
-		printf(" %02x", buf[i]);
-	printf("\n");
+		LOG(LOGC_HOST, LOG_DEBUG, " %02x", buf[i]);
+	LOG(LOGC_HOST, LOG_DEBUG, "\n");
 }
 
+/* sends a frame built by cmd_frame() with the current seq */
 static void
-uart_send_packet(uart_send_t *usp, uint8_t *data, int len)
+uart_send_frame(uart_send_t *usp, uint8_t *frame, int len)
 {
-	uint16_t crc;
-	uint8_t packet[len + 5];
-
-	packet[0] = len + 5;
-	packet[1] = 0x10 | usp->seq;
 	usp->seq = (usp->seq + 1) & 0x0f;
-	memcpy(packet + 2, data, len);
-	crc = crc16_ccitt(packet, len + 2);
-	packet[len + 2] = crc >> 8;
-	packet[len + 3] = crc & 0xff;
-	packet[len + 4] = 0x7e;
-	uart_send(usp, packet, len + 5);
+	txlog_write(txl, TX_HOST_TX, 0, frame, len);
+	uart_send(usp, frame, len);
 }
 
 /*
- * num positive: number of parameters
- * num negative: number of parameters of which the last one is a string
+ * send command CMD and keep the host link until the response has been
+ * received with wait_for_uart_vlq(). args as for cmd_encode(), checked
+ * against cmdtab of command.v at compile time
  */
+template <int CMD, typename... A>
 static void
-uart_send_vlq_va(sim_t *sp, int num, va_list ap)
+uart_send_cmd(sim_t *sp, A... args)
 {
-	uint8_t buf[256]; 	/* just enough */
-	uint8_t *p = buf;
-	uint32_t arg;
-	int i;
-	int n = num < 0 ? -num : num;
-
-printf("num %d n %d\n", num, n);
-	for (i = 0; i < n; ++i) {
-		arg = va_arg(ap, uint32_t);
-printf("arg %d\n", arg);
-		p = encode_int(p, arg);
-	}
-	if (num < 0) {
-printf("add string len %d\n", arg);
-		/* arg, the value of the last parameter, is the length of the following string */
-		for (i = 0; i < arg; ++i)
-			*p++ = (uint8_t)va_arg(ap, uint32_t);
-	}
+	uint8_t frame[cmd_def<CMD>::frame_max];
+	int len;
 
-	uart_send_packet(sp->usp, buf, p - buf);
+	link_acquire(sp);
+	len = cmd_frame<CMD>(frame, sp->usp->seq, args...);
+	uart_send_frame(sp->usp, frame, len);
 }
 
+/*
+ * send a command that has no response. Returns immediately, the link is
+ * handed on as soon as the frame is shifted out
+ */
+template <int CMD, typename... A>
 static void
-uart_send_vlq(sim_t *sp, int num, ...)
+uart_post_cmd(sim_t *sp, A... args)
 {
-	va_list ap;
-	va_start(ap, num);
+	static_assert(!cmd_def<CMD>::has_response, "command has a response");
 
-	uart_send_vlq_va(sp, num, ap);
-
-        va_end(ap);
+	uart_send_cmd<CMD>(sp, args...);
+	link_release(sp);
 }
 
+template <int CMD, typename... A>
 static void
-uart_send_vlq_and_wait(sim_t *sp, int num, ...)
+uart_send_cmd_and_wait(sim_t *sp, A... args)
 {
-	va_list ap;
-	va_start(ap, num);
-
-	uart_send_vlq_va(sp, num, ap);
-
-        va_end(ap);
-
-	uint8_t buf[num * 5];
-
+	uart_send_cmd<CMD>(sp, args...);
 	wait_for_uart_send(sp);
+	link_release(sp);
 }
 
 /*
@@ -801,7 +567,8 @@ uart_recv_tick(uart_recv_t *urp, int *want_dump)
 			exit(1);
 		}
 		urp->buf[urp->pos++] = urp->byte;
-printf("received (%s) 0x%02x\n", urp->name, urp->byte);
+		LOG(LOGC_HOST, LOG_DEBUG, "received (%s) 0x%02x\n", urp->name,
+			urp->byte);
 	}
 
 	*want_dump = 1;
@@ -809,184 +576,974 @@ printf("received (%s) 0x%02x\n", urp->name, urp->byte);
 	return urp->bit == 0;
 }
 
-static int
-uart_frame_done(uart_recv_t *urp)
+static frame_rx_t *
+frame_rx_init(void)
 {
-	int len;
+	frame_rx_t *fr = (frame_rx_t *)calloc(1, sizeof(*fr));
 
-	if (urp->pos < 5)
-		return 0;
+	fr->last = &fr->first;
 
-	len = urp->buf[0];
+	return fr;
+}
 
-	if (urp->pos < len)
-		return 0;
+static void
+frame_error(frame_rx_t *fr, const char *msg, int val)
+{
+	++fr->errors;
+	LOG(LOGC_HOST, LOG_ERR, "dropping frame: %s %d\n", msg, val);
+	fr->sync = 1;
+}
 
-	if (urp->pos > len) {
-		printf("frame longer than header indicates\n");
-		exit(1);
-	}
-	if (urp->buf[len - 1] != 0x7e) {
-		printf("frame not properly terminated\n");
-		exit(1);
-	}
-	uint16_t crc = crc16_ccitt(urp->buf, len - 3);
-	if ((urp->buf[len - 3] != (crc >> 8)) ||
-	    (urp->buf[len - 2] != (crc & 0xff))) {
-		printf("received bad crc\n");
-		exit(1);
+static void
+frame_split(frame_rx_t *fr, uint64_t cycle)
+{
+	unsigned int avail;
+	rx_frame_t *f;
+	uint16_t crc;
+	int len;
+	int i;
+
+	for (;;) {
+		if (fr->sync) {
+			while (fr->tail != fr->head &&
+			       fr->ring[fr->tail % RXRING] != 0x7e)
+				++fr->tail;
+			if (fr->tail == fr->head)
+				return;
+			++fr->tail;
+			fr->sync = 0;
+		}
+		avail = fr->head - fr->tail;
+		if (avail == 0)
+			return;
+		len = fr->ring[fr->tail % RXRING];
+		if (len < 5 || len > MAXPACKET) {
+			frame_error(fr, "bad length", len);
+			continue;
+		}
+		if (avail < (unsigned int)len)
+			return;
+
+		f = (rx_frame_t *)malloc(sizeof(*f));
+		for (i = 0; i < len; ++i)
+			f->buf[i] = fr->ring[(fr->tail + i) % RXRING];
+		f->len = len;
+		if (f->buf[len - 1] != 0x7e) {
+			free(f);
+			frame_error(fr, "not terminated, length", len);
+			continue;
+		}
+		crc = crc16_ccitt(f->buf, len - 3);
+		if (f->buf[len - 3] != (crc >> 8) ||
+		    f->buf[len - 2] != (crc & 0xff)) {
+			free(f);
+			frame_error(fr, "bad crc, length", len);
+			continue;
+		}
+		fr->tail += len;
+		if (f->buf[1] != 0x10 + fr->expected_seq) {
+			/* keep the frame, continue from its seq */
+			++fr->errors;
+			LOG(LOGC_HOST, LOG_ERR, "received seq %d, expected %d\n",
+				f->buf[1] & 0x0f, fr->expected_seq);
+		}
+		fr->expected_seq = (f->buf[1] + 1) & 0x0f;
+		txlog_write(txl, TX_HOST_RX, 0, f->buf, len);
+
+		f->cycle = cycle;
+		f->next = NULL;
+		*fr->last = f;
+		fr->last = &f->next;
+		++fr->nframes;
 	}
-	if (urp->buf[1] != (0x10 + urp->expected_seq)) {
-		printf("received bad seq\n");
-		exit(1);
+}
+
+/*
+ * bytes from the host link. Everything but a partial frame of at most
+ * MAXPACKET bytes is split right away, so the ring never fills up
+ */
+static void
+frame_put(frame_rx_t *fr, uint64_t cycle, const uint8_t *data, int len)
+{
+	int i;
+
+	for (i = 0; i < len; ++i) {
+		fr->ring[fr->head++ % RXRING] = data[i];
+		frame_split(fr, cycle);
 	}
+}
 
-	return 1;
+/* oldest frame or NULL, to be freed by the caller */
+static rx_frame_t *
+frame_pop(frame_rx_t *fr)
+{
+	rx_frame_t *f = fr->first;
+
+	if (f == NULL)
+		return NULL;
+	fr->first = f->next;
+	if (fr->first == NULL)
+		fr->last = &fr->first;
+	--fr->nframes;
+
+	return f;
 }
 
 /*
- * main tick loop
+ * the host link BFMs run every cycle while they transfer data, otherwise
+ * they only wait for a start bit or for a packet to send
  */
-static void test(sim_t *sp);
-static sim_t *
-init(Vconan *tb)
+static uint64_t
+host_recv_tick(sim_t *sp, void *arg)
 {
-	sim_t *sp = (sim_t *)calloc(1, sizeof(*sp));
-	uint64_t d = HZ / 250000;	/* uart divider */
-
-	sp->tb = tb;
-	sp->urp = uart_recv_init(&tb->fpga2, d, "conan");
-	sp->usp = uart_send_init(&tb->fpga1, d, "conan");
-	sp->last_change = 0;
-	sp->cycle = 0;
+	uart_recv_t *urp = (uart_recv_t *)arg;
+	int want_dump = 0;
 
-	sp->wp = watch_init(tb);
-	tb->fpga5 = 0;
+	if (uart_recv_tick(urp, &want_dump)) {
+		frame_put(sp->frx, sp->cycle, urp->buf, urp->pos);
+		urp->pos = 0;
+	}
+	if (urp->bit != 0 || *urp->rx == 0)
+		return sp->cycle + 1;
 
-	return sp;
+	return SCHED_NEVER;
 }
 
-static void
-yield(sim_t *sp)
+static uint64_t
+host_send_tick(sim_t *sp, void *arg)
 {
-	if (setjmp(sp->test_jb) == 0)
-		longjmp(sp->main_jb, 1);
+	uart_send_t *usp = (uart_send_t *)arg;
+	int want_dump = 0;
+
+	uart_send_tick(usp, &want_dump);
+	if (!uart_send_done(usp))
+		return sp->cycle + 1;
+
+	return SCHED_NEVER;
 }
 
-static void
-timer_tick(sim_t *sp)
+/*
+ * transaction level host link, with --tlm. Frames are put byte by byte
+ * directly into the receive path of u_framing and taken from its send
+ * path, the UARTs are bypassed. Framing, crc and sequence numbers are
+ * still checked on both sides. The receiver needs 8 cycles per byte for
+ * the crc, so bytes are spaced TLM_SPACING cycles apart instead of the
+ * ~2000 of a bit level transfer
+ */
+#define TLM_SPACING	10
+static int tlm;
+
+static uint64_t
+tlm_send_tick(sim_t *sp, void *arg)
 {
+	uart_send_t *usp = (uart_send_t *)arg;
 	Vconan *tb = sp->tb;
 
-	if ((sp->cycle % 65536) != 0)
-		return;
-	tb->fpga5 = !tb->fpga5;
+	/* a byte is valid for a single cycle */
+	tb->tlm_rx_valid = 0;
+	if (uart_send_done(usp))
+		return SCHED_NEVER;
+	if (sp->cycle < usp->next)
+		return usp->next;
+	if (usp->cts != NULL && !*usp->cts) {
+		++usp->cts_stalls;
+		return sp->cycle + 1;
+	}
+
+	tb->tlm_rx_data = usp->buf[usp->pos++];
+	tb->tlm_rx_valid = 1;
+	--usp->len;
+	usp->next = sp->cycle + TLM_SPACING;
+
+	return sp->cycle + 1;
 }
 
-static void
-step(sim_t *sp, uint64_t cycle)
+static uint64_t
+tlm_recv_tick(sim_t *sp, void *arg)
 {
-	int ret;
+	uart_recv_t *urp = (uart_recv_t *)arg;
 	Vconan *tb = sp->tb;
-	int want_dump = 0;
 
-	sp->cycle = cycle;
+	if (!tb->tlm_tx_valid)
+		return SCHED_NEVER;
 
-	uart_recv_tick(sp->urp, &want_dump);
-	uart_send_tick(sp->usp, &want_dump);
-	timer_tick(sp);
-	tmcuart_tick(sp);
-	as5311_tick(sp);
-	sd_tick(sp);
-	ether_tick(sp);
+	LOG(LOGC_HOST, LOG_DEBUG, "received (%s) 0x%02x\n", urp->name,
+		tb->tlm_tx_data);
+	frame_put(sp->frx, sp->cycle, &tb->tlm_tx_data, 1);
 
-	/* watch output before test, so we might see failure reasons */
-	do_watch(sp->wp, cycle);
+	return SCHED_NEVER;
+}
 
-	/* continue test procedure */
-	ret = setjmp(sp->main_jb);
-	if (ret == 0)
-		longjmp(sp->test_jb, 1);
-	if (ret == 1)
-		want_dump = 1;
+static uint64_t
+timer_tick(sim_t *sp, void *arg)
+{
+	Vconan *tb = sp->tb;
 
-	fflush(stdout);
+	if ((sp->cycle % 65536) == 0)
+		tb->fpga5 = !tb->fpga5;
+
+	return (sp->cycle + 65536) & ~0xffffull;
 }
 
 static void
-delay(sim_t *sp, uint64_t ticks)
+yield(sim_t *sp)
 {
-	sp->delay_until = sp->cycle + ticks;
-
-	while (sp->cycle < sp->delay_until)
-		yield(sp);
+	fiber_yield(sp->current->fiber);
 }
 
 static void
-wait_for_uart_send(sim_t *sp)
+task_main(void *arg)
 {
-	while (!uart_send_done(sp->usp))
-		yield(sp);
+	task_t *t = (task_t *)arg;
+	sim_t *sp = t->sp;
+
+	t->fn(sp);
+
+	/* drop whatever the task still holds */
+	link_release(sp);
+	watch_clear(sp->wp);
 }
 
-static void
-wait_for_uart_recv(sim_t *sp)
+static task_t *
+spawn(sim_t *sp, void (*fn)(sim_t *sp), const char *name)
 {
-	while (!uart_frame_done(sp->urp))
-		yield(sp);
+	task_t *t = (task_t *)calloc(1, sizeof(*t));
+	task_t **tp;
+
+	t->sp = sp;
+	t->fn = fn;
+	t->name = name;
+	t->fiber = fiber_create(task_main, t, 0, name);
+
+	/* starts running with the next round of step() */
+	for (tp = &sp->tasks; *tp != NULL; tp = &(*tp)->next)
+		;
+	*tp = t;
+
+	return t;
 }
 
+/*
+ * wait for all given tasks to finish and free them
+ */
 static void
-wait_for_uart_vlq(sim_t *sp, int _n, uint32_t *vlq)
+join(sim_t *sp, task_t **tasks, int n)
 {
-	int ret;
+	task_t **tp;
+	int running;
 	int i;
-	int pos = 2;
-	int len;
-	int n = _n > 0 ? _n : -_n ;
 
-	wait_for_uart_recv(sp);
-	len = sp->urp->pos - 5;
+	do {
+		running = 0;
+		for (i = 0; i < n; ++i)
+			if (!fiber_done(tasks[i]->fiber))
+				running = 1;
+		if (running)
+			yield(sp);
+	} while (running);
+
 	for (i = 0; i < n; ++i) {
-		ret = parse_int(sp->urp->buf, pos, len, vlq + i);
-		pos += ret;
-		len -= ret;
+		for (tp = &sp->tasks; *tp != tasks[i]; tp = &(*tp)->next)
+			;
+		*tp = tasks[i]->next;
+		fiber_free(tasks[i]->fiber);
+		free(tasks[i]);
 	}
-	if (_n < 0) {
-		for (i = 0; i < vlq[n - 1]; ++i) {
-			vlq[i + n] = sp->urp->buf[pos++];
-			len -= 1;
-		}
-	}
-	if (len != 0) {
-		printf("parsing recv buffer has leftover %d\n", len);
-		exit(1);
+}
+
+/*
+ * the host link is shared between concurrently running tasks. It is free
+ * when nobody waits for a response and the last frame is shifted out
+ */
+static void
+link_acquire(sim_t *sp)
+{
+	while (sp->link_owner != sp->current &&
+	       (sp->link_owner != NULL || !uart_send_done(sp->usp)))
+		yield(sp);
+	sp->link_owner = sp->current;
+}
+
+static void
+link_release(sim_t *sp)
+{
+	if (sp->link_owner == sp->current)
+		sp->link_owner = NULL;
+}
+
+/*
+ * profiler: timestamp counter around each part of the main loop,
+ * accounted to the currently running test section. Only active with
+ * --profile, written as JSON at exit
+ */
+enum {
+	PROF_EVAL,
+	PROF_UART_RECV,
+	PROF_UART_SEND,
+	PROF_TIMER,
+	PROF_TMCUART,
+	PROF_AS5311,
+	PROF_SD,
+	PROF_ETHER,
+	PROF_WATCH,
+	PROF_TASKS,
+	PROF_NUM
+};
+static const char *prof_names[PROF_NUM] = {
+	"eval", "uart_recv_tick", "uart_send_tick", "timer_tick",
+	"tmcuart_tick", "as5311_tick", "sd_tick", "ether_tick", "do_watch",
+	"tasks"
+};
+
+#define PROF_MAXSECT	32
+typedef struct {
+	const char	*name;
+	uint64_t	cycles;		/* simulated cycles */
+	uint64_t	steps;		/* cycles with step() */
+	uint64_t	ticks;		/* total time in section */
+	uint64_t	comp[PROF_NUM];
+} prof_sect_t;
+
+static struct {
+	int		on;
+	const char	*file;
+	prof_sect_t	sect[PROF_MAXSECT];
+	int		nsect;
+	prof_sect_t	*cur;
+	uint64_t	start_cycle;	/* of the current section */
+	uint64_t	start_ticks;
+	uint64_t	first_ticks;
+	struct timespec	first_time;
+	uint64_t	cycle;
+} prof;
+
+static inline uint64_t
+prof_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+#define PROF(c, stmt) do {					\
+	if (prof.on) {						\
+		uint64_t _t = prof_now();			\
+		stmt;						\
+		prof.cur->comp[c] += prof_now() - _t;		\
+	} else {						\
+		stmt;						\
+	}							\
+} while (0)
+
+static void
+prof_close(void)
+{
+	uint64_t now = prof_now();
+
+	prof.cur->cycles += prof.cycle - prof.start_cycle;
+	prof.cur->ticks += now - prof.start_ticks;
+	prof.start_cycle = prof.cycle;
+	prof.start_ticks = now;
+}
+
+/*
+ * account everything from now on to the named section
+ */
+static void
+prof_section(const char *name)
+{
+	int i;
+
+	if (!prof.on)
+		return;
+	prof_close();
+	for (i = 0; i < prof.nsect; ++i)
+		if (strcmp(prof.sect[i].name, name) == 0)
+			break;
+	if (i == prof.nsect) {
+		if (prof.nsect == PROF_MAXSECT)
+			i = 0;	/* fold the rest into the first */
+		else
+			prof.sect[prof.nsect++].name = name;
+	}
+	prof.cur = prof.sect + i;
+}
+
+static void
+prof_dump(void)
+{
+	uint64_t ticks = prof_now() - prof.first_ticks;
+	struct timespec now;
+	prof_sect_t total;
+	double hz;
+	FILE *fp;
+	int i;
+	int j;
+
+	if (!prof.on)
+		return;
+	prof_close();
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	hz = ticks / ((now.tv_sec - prof.first_time.tv_sec) +
+		(now.tv_nsec - prof.first_time.tv_nsec) / 1e9);
+
+	memset(&total, 0, sizeof(total));
+	total.name = "total";
+	for (i = 0; i < prof.nsect; ++i) {
+		total.cycles += prof.sect[i].cycles;
+		total.steps += prof.sect[i].steps;
+		total.ticks += prof.sect[i].ticks;
+		for (j = 0; j < PROF_NUM; ++j)
+			total.comp[j] += prof.sect[i].comp[j];
+	}
+
+	fp = fopen(prof.file, "w");
+	if (fp == NULL) {
+		printf("failed to open %s\n", prof.file);
+		return;
+	}
+	fprintf(fp, "{\n  \"ticks_per_second\": %.0f,\n  \"sections\": [\n",
+		hz);
+	for (i = 0; i <= prof.nsect; ++i) {
+		prof_sect_t *ps = i < prof.nsect ? prof.sect + i : &total;
+		uint64_t other = ps->ticks;
+
+		fprintf(fp, "    {\n      \"name\": \"%s\",\n", ps->name);
+		fprintf(fp, "      \"cycles\": %lu,\n", ps->cycles);
+		fprintf(fp, "      \"steps\": %lu,\n", ps->steps);
+		fprintf(fp, "      \"wall\": %.6f,\n", ps->ticks / hz);
+		fprintf(fp, "      \"cycles_per_second\": %.0f,\n",
+			ps->ticks ? ps->cycles * hz / ps->ticks : 0.0);
+		fprintf(fp, "      \"components\": {\n");
+		for (j = 0; j < PROF_NUM; ++j) {
+			other -= ps->comp[j];
+			fprintf(fp, "        \"%s\": { \"wall\": %.6f, "
+				"\"share\": %.4f },\n", prof_names[j],
+				ps->comp[j] / hz, ps->ticks ?
+				(double)ps->comp[j] / ps->ticks : 0.0);
+		}
+		/* loop overhead, fiber switches, fast-forward checks */
+		fprintf(fp, "        \"other\": { \"wall\": %.6f, "
+			"\"share\": %.4f }\n", other / hz,
+			ps->ticks ? (double)other / ps->ticks : 0.0);
+		fprintf(fp, "      }\n    }%s\n", i < prof.nsect ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+	fclose(fp);
+}
+
+static void
+prof_init(const char *file)
+{
+	memset(&prof, 0, sizeof(prof));
+	prof.on = 1;
+	prof.file = file;
+	prof.nsect = 1;
+	prof.sect[0].name = "setup";
+	prof.cur = prof.sect;
+	clock_gettime(CLOCK_MONOTONIC, &prof.first_time);
+	prof.first_ticks = prof.start_ticks = prof_now();
+}
+
+static void
+sched_run(sim_t *sp)
+{
+	sched_t *se;
+	int i;
+
+	for (se = sp->sched; se != NULL; se = se->next) {
+		if (se->wake > sp->cycle && !sched_changed(se))
+			continue;
+		for (i = 0; i < se->nsense; ++i)
+			se->last[i] = *se->sense[i];
+		PROF(se->prof, se->wake = se->tick(sp, se->arg));
+	}
+}
+
+/*
+ * main tick loop
+ */
+static void test(sim_t *sp);
+static sim_t *
+init(Vconan *tb)
+{
+	sim_t *sp = (sim_t *)calloc(1, sizeof(*sp));
+	uint64_t d = HZ / BAUD;	/* uart divider */
+
+	sp->tb = tb;
+	sp->urp = uart_recv_init(&tb->fpga2, d, "conan");
+	sp->usp = uart_send_init(&tb->fpga1, d, "conan");
+	sp->frx = frame_rx_init();
+	sp->daq = daq_demux_new(DAQ_DEPTH);
+	sp->last_change = 0;
+	sp->cycle = 0;
+
+	sp->wp = watch_init(tb);
+	tb->fpga5 = 0;
+
+	tb->tlm_en = tlm;
+	if (tlm) {
+		sched_sense(sched_add(sp, "uart_recv", tlm_recv_tick, sp->urp,
+			PROF_UART_RECV), &tb->tlm_tx_valid);
+		sp->usp->se = sched_add(sp, "uart_send", tlm_send_tick,
+			sp->usp, PROF_UART_SEND);
+	} else {
+		sched_sense(sched_add(sp, "uart_recv", host_recv_tick,
+			sp->urp, PROF_UART_RECV), sp->urp->rx);
+		sp->usp->se = sched_add(sp, "uart_send", host_send_tick,
+			sp->usp, PROF_UART_SEND);
+	}
+	sched_add(sp, "timer", timer_tick, NULL, PROF_TIMER);
+
+	return sp;
+}
+
+static void
+step(sim_t *sp, uint64_t cycle)
+{
+	Vconan *tb = sp->tb;
+	task_t *t;
+
+	sp->cycle = cycle;
+	if (prof.on) {
+		prof.cycle = cycle;
+		++prof.cur->steps;
+	}
+
+	sched_run(sp);
+
+	/* watch output before test, so we might see failure reasons */
+	PROF(PROF_WATCH, do_watch(sp->wp, cycle));
+
+	/* continue test procedures */
+	for (t = sp->tasks; t != NULL; t = t->next) {
+		if (fiber_done(t->fiber))
+			continue;
+		sp->current = t;
+		sp->wp->owner = t;
+		/* includes time spent in the section switch, if any */
+		PROF(PROF_TASKS, fiber_resume(t->fiber));
+	}
+	sp->current = NULL;
+}
+
+/*
+ * idle fast-forward: if no BFM is due and all tasks sleep in delay(),
+ * nothing but the model itself has to run until the first wake-up.
+ * Returns the cycle at which step() has to run again, or 0 if it has to
+ * run in the next cycle
+ */
+static uint64_t
+ff_wake(sim_t *sp)
+{
+	uint64_t wake;
+	task_t *t;
+
+	if (!sp->fast_forward)
+		return 0;
+
+	/* the trace has to see every cycle */
+	if (sp->wp->trace != NULL)
+		return 0;
+
+	wake = sched_next(sp);
+	if (wake <= sp->cycle + 1)
+		return 0;
+
+	for (t = sp->tasks; t != NULL; t = t->next) {
+		if (fiber_done(t->fiber))
+			continue;
+		if (t->delay_until <= sp->cycle + 1)
+			return 0;
+		if (t->delay_until < wake)
+			wake = t->delay_until;
+	}
+
+	/* keep the inactivity abort where it would have been */
+	if (sp->wp->last_cycle + 1000001 < wake)
+		wake = sp->wp->last_cycle + 1000001;
+
+	return wake;
+}
+
+/*
+ * correctness guard for fast-forward: BFMs have to see changes on their
+ * signals and watched signals have to be printed when they change
+ */
+static int
+ff_guard(sim_t *sp)
+{
+	if (sched_pending(sp))
+		return 1;
+
+	return watch_changed(sp->wp);
+}
+
+static void
+delay(sim_t *sp, uint64_t ticks)
+{
+	task_t *t = sp->current;
+
+	t->delay_until = sp->cycle + ticks;
+
+	while (sp->cycle < t->delay_until)
+		yield(sp);
+}
+
+static void
+wait_for_uart_send(sim_t *sp)
+{
+	while (!uart_send_done(sp->usp))
+		yield(sp);
+}
+
+/* next frame from the fpga, to be freed by the caller */
+static rx_frame_t *
+wait_for_uart_recv(sim_t *sp)
+{
+	while (sp->frx->first == NULL)
+		yield(sp);
+	if (sp->frx->errors)
+		fail("%d bad frames received\n", sp->frx->errors);
+
+	return frame_pop(sp->frx);
+}
+
+static void
+wait_for_uart_vlq(sim_t *sp, int _n, uint32_t *vlq)
+{
+	rx_frame_t *f;
+	int used;
+	int i;
+	int pos = 2;
+	int len;
+	int n = _n > 0 ? _n : -_n ;
+
+	link_acquire(sp);
+	f = wait_for_uart_recv(sp);
+	len = f->len - 5;
+	if (vlq_decode_n(f->buf + pos, len, vlq, n, &used) != n) {
+		printf("parsing recv buffer failed, buffer too short\n");
+		exit(1);
+	}
+	pos += used;
+	len -= used;
+	if (_n < 0) {
+		for (i = 0; i < vlq[n - 1]; ++i) {
+			vlq[i + n] = f->buf[pos++];
+			len -= 1;
+		}
+	}
+	if (len != 0) {
+		printf("parsing recv buffer has leftover %d\n", len);
+		exit(1);
 	}
-	/* clear recv buffer, bump seq */
-	sp->urp->pos = 0;
-	sp->urp->expected_seq = (sp->urp->expected_seq + 1) & 0x0f;
-	printf("received {");
+	free(f);
+	LOG(LOGC_HOST, LOG_DEBUG, "received {");
 	for (i = 0; i < n; ++i)
-		printf(" %d", vlq[i]);
-	printf(" }\n");
+		LOG(LOGC_HOST, LOG_DEBUG, " %d", vlq[i]);
+	LOG(LOGC_HOST, LOG_DEBUG, " }\n");
+	link_release(sp);
+}
+
+static void
+wait_for_hit(sim_t *sp, trigger_t *tp)
+{
+	task_t *t = sp->current;
+
+	t->delay_until = SCHED_NEVER;
+	while (tp->hits == 0)
+		yield(sp);
+	t->delay_until = sp->cycle;
+	watch_trigger_remove(sp->wp, tp);
+}
+
+/*
+ * wait until the expression becomes true, see watch_trigger. Other than
+ * polling in a loop, this does not keep the harness from fast-forwarding,
+ * step() runs again as soon as a signal of the expression changes
+ */
+static void
+wait_for_trigger(sim_t *sp, const char *expr)
+{
+	wait_for_hit(sp, watch_trigger(sp->wp, NULL, expr, NULL, NULL));
+}
+
+/*
+ * the same for signal D of vsd being val. Location and size come from
+ * the descriptor, nothing is parsed or looked up
+ */
+template <typename D>
+static void
+wait_for_signal(sim_t *sp, uint64_t val)
+{
+	static_assert(D::num == 1 && !D::wide,
+		"only single signals up to 64 bits");
+
+	wait_for_hit(sp, watch_trigger_eq(sp->wp, vsigs[D::id].name,
+		vsig_ptr<D>(sp->tb), D::elem_len, val, NULL, NULL));
+}
+
+/*
+ * pipelined host link, driving the board like the production host does:
+ * a queue of outgoing frames of which up to window are sent but not yet
+ * acknowledged. framing.v sends no acknowledgements, a frame counts as
+ * acknowledged once u_framing committed it, read from its recv_next_seq.
+ * There is no retransmit: a bad or repeated seq leaves u_framing in its
+ * error state until clr, which is not driven, so a frame outstanding for
+ * HOST_TIMEOUT cycles fails the test. Responses are matched to the
+ * oldest request waiting for the same response type, command.v answers
+ * in order. Bytes are held back while u_framing drops cts.
+ * The pipeline owns the host link from host_pipe_start() to
+ * host_pipe_stop()
+ */
+#define HOST_QUEUE	64		/* frames, power of 2 */
+#define HOST_MAXWINDOW	15		/* seq is only 4 bits */
+#define HOST_TIMEOUT	200000		/* cycles without progress */
+#define HOST_MAXRSP	8
+
+typedef struct {
+	uint8_t		buf[MAXPACKET];	/* the frame */
+	int		len;
+	int		seq;
+	int		rsp_type;	/* expected response, -1 for none */
+	int		nrsp;		/* values in the response */
+	int		answered;
+	void		(*done)(sim_t *sp, void *arg, uint32_t *rsp);
+	void		*arg;
+} host_req_t;
+
+typedef struct _host_pipe {
+	host_req_t	q[HOST_QUEUE];
+	/* head <= acked <= sent <= tail, all free running */
+	unsigned int	head;		/* oldest still needed */
+	unsigned int	acked;		/* oldest not acknowledged */
+	unsigned int	sent;		/* next to send */
+	unsigned int	tail;		/* next free */
+	int		window;
+	uint64_t	progress;	/* last cycle something moved */
+	uint64_t	frames;
+	uint64_t	bytes;
+	sched_t		*se;
+} host_pipe_t;
+
+static int host_window = 8;
+
+static void
+host_pipe_response(sim_t *sp, host_pipe_t *hp, rx_frame_t *f)
+{
+	uint32_t rsp[HOST_MAXRSP];
+	host_req_t *r = NULL;
+	unsigned int idx;
+	int n;
+
+	n = rsp_decode(f->buf + 2, f->len - 5, rsp);
+	if (n < 1)
+		fail("malformed response\n");
+	for (idx = hp->head; idx != hp->sent; ++idx) {
+		r = &hp->q[idx % HOST_QUEUE];
+		if (r->rsp_type == (int)rsp[0] && !r->answered)
+			break;
+	}
+	if (idx == hp->sent)
+		fail("unexpected response %d\n", rsp[0]);
+	if (n != r->nrsp)
+		fail("response %d has %d values, expected %d\n", rsp[0], n,
+			r->nrsp);
+
+	free(f);
+	r->answered = 1;
+	if (r->done != NULL)
+		r->done(sp, r->arg, rsp);
+}
+
+static uint64_t
+host_pipe_tick(sim_t *sp, void *arg)
+{
+	host_pipe_t *hp = (host_pipe_t *)arg;
+	uart_send_t *usp = sp->usp;
+	Vconan *tb = sp->tb;
+	int next = tb->conan__DOT__u_framing__DOT__recv_next_seq;
+	host_req_t *r;
+	rx_frame_t *f;
+
+	/* acknowledgements, a frame not yet committed has seq == next */
+	while (hp->acked != hp->sent &&
+	       hp->q[hp->acked % HOST_QUEUE].seq != next) {
+		++hp->acked;
+		hp->progress = sp->cycle;
+	}
+	if (!uart_send_done(usp))
+		hp->progress = sp->cycle;
+
+	if (hp->acked != hp->sent &&
+	    sp->cycle - hp->progress > HOST_TIMEOUT)
+		fail("seq %d not acknowledged%s\n",
+			hp->q[hp->acked % HOST_QUEUE].seq,
+			tb->conan__DOT__u_framing__DOT__error ?
+			", framing error" : "");
+
+	if (uart_send_done(usp) && hp->sent != hp->tail &&
+	    (int)(hp->sent - hp->acked) < hp->window) {
+		r = &hp->q[hp->sent % HOST_QUEUE];
+		txlog_write(txl, TX_HOST_TX, 0, r->buf, r->len);
+		uart_send(usp, r->buf, r->len);
+		++hp->sent;
+		++hp->frames;
+		hp->bytes += r->len;
+	}
+
+	if (sp->frx->errors)
+		fail("%d bad frames received\n", sp->frx->errors);
+	while ((f = frame_pop(sp->frx)) != NULL)
+		host_pipe_response(sp, hp, f);
+
+	while (hp->head != hp->acked) {
+		r = &hp->q[hp->head % HOST_QUEUE];
+		if (r->rsp_type >= 0 && !r->answered)
+			break;
+		++hp->head;
+	}
+
+	return sp->cycle + 1;
+}
+
+static host_pipe_t *
+host_pipe_start(sim_t *sp, int window)
+{
+	host_pipe_t *hp = (host_pipe_t *)calloc(1, sizeof(*hp));
+
+	if (window < 1 || window > HOST_MAXWINDOW)
+		fail("window %d out of range 1..%d\n", window, HOST_MAXWINDOW);
+	link_acquire(sp);
+	hp->window = window;
+	hp->progress = sp->cycle;
+	sp->usp->cts = &sp->tb->conan__DOT__u_framing__DOT__cts;
+	hp->se = sched_add(sp, "host_pipe", host_pipe_tick, hp,
+		PROF_UART_SEND);
+	sp->pipe = hp;
+
+	return hp;
+}
+
+/*
+ * queue command CMD, args as for cmd_encode(). rsp_type is the response
+ * expected for it or -1, done gets called with its nrsp values when it
+ * arrives. Only waits while the queue is full
+ */
+template <int CMD, typename... A>
+static void
+host_post(sim_t *sp, host_pipe_t *hp, int rsp_type, int nrsp,
+	void (*done)(sim_t *sp, void *arg, uint32_t *rsp), void *arg,
+	A... args)
+{
+	host_req_t *r;
+
+	if ((rsp_type >= 0) != cmd_def<CMD>::has_response)
+		fail("command %d: response %d does not match cmdtab\n", CMD,
+			rsp_type);
+	if (nrsp > HOST_MAXRSP)
+		fail("response with %d values too long\n", nrsp);
+	while (hp->tail - hp->head == HOST_QUEUE)
+		yield(sp);
+
+	r = &hp->q[hp->tail % HOST_QUEUE];
+	r->seq = sp->usp->seq;
+	sp->usp->seq = (sp->usp->seq + 1) & 0x0f;
+	r->len = cmd_frame<CMD>(r->buf, r->seq, args...);
+	r->rsp_type = rsp_type;
+	r->nrsp = nrsp;
+	r->answered = 0;
+	r->done = done;
+	r->arg = arg;
+	++hp->tail;
 }
 
+/* waits until everything is acknowledged and answered */
 static void
-wait_for_signal8(sim_t *sp, vluint8_t *signal, vluint8_t val)
+host_pipe_drain(sim_t *sp, host_pipe_t *hp)
 {
-	sp->signal8p = signal;
-	sp->signal8v = val;
-	while (*sp->signal8p != sp->signal8v)
+	while (hp->head != hp->tail)
 		yield(sp);
 }
 
+static void
+host_pipe_stop(sim_t *sp, host_pipe_t *hp)
+{
+	host_pipe_drain(sp, hp);
+	sched_remove(sp, hp->se);
+	sp->usp->cts = NULL;
+	sp->pipe = NULL;
+	free(hp);
+	link_release(sp);
+}
+
+/*
+ * flight recorder, always running. Dumped when a test fails or gets
+ * interrupted, so failures can be looked at in detail even when nothing
+ * was printed
+ */
+#define MAXRECORD	16
+static const char *record_patterns[MAXRECORD];
+static int record_npatterns;
+static int record_depth = 4096;
+static const char *record_out = "flight";
+static recorder_t *flight;
+static volatile sig_atomic_t interrupted;
+
+static const char *record_default[] = {
+	"^fpga[0-9]+$",
+	"^(step|dir)[0-9]+$",
+	"u_framing.(rx|tx)$",
+	"u_command.msg_state$",
+	NULL
+};
+
+static void
+record_dump(void)
+{
+	recorder_dump(flight, record_out, "conan", 1000000000000ull / HZ);
+}
+
+static void
+record_init(Vconan *tb)
+{
+	int i;
+
+	if (record_depth == 0)
+		return;
+	flight = recorder_init(tb, record_depth);
+	if (record_npatterns == 0)
+		for (i = 0; record_default[i] != NULL; ++i)
+			recorder_add(flight, record_default[i]);
+	for (i = 0; i < record_npatterns; ++i)
+		if (recorder_add(flight, record_patterns[i]) == 0)
+			printf("recorder: no signal matches %s\n",
+				record_patterns[i]);
+	recorder_start(flight);
+}
+
+static void
+record_sigint(int sig)
+{
+	interrupted = 1;
+}
+
 static void
 fail(const char *msg, ...)
 {
 	va_list ap;
 	va_start(ap, msg);
+	/* everything printed so far first, then synchronously */
+	log_stop();
 	printf("test failed: ");
 	vprintf(msg, ap);
+	record_dump();
 	exit(1);
 }
 
@@ -1008,7 +1565,7 @@ test_version(sim_t *sp)
 
 	/* send version request */
 	uint32_t rsp[8];
-	uart_send_vlq(sp, 1, CMD_GET_VERSION);
+	uart_send_cmd<CMD_GET_VERSION>(sp);
 	wait_for_uart_vlq(sp, 6, rsp);
 
 	if (rsp[0] != 0 || rsp[1] != 0x42) {
@@ -1045,7 +1602,7 @@ test_time(sim_t *sp)
 
 	/* send version request */
 	uint32_t rsp[3];
-	uart_send_vlq(sp, 1, CMD_GET_TIME);
+	uart_send_cmd<CMD_GET_TIME>(sp);
 	wait_for_uart_vlq(sp, 3, rsp);
 	if (rsp[0] != 1) {
 		printf("received incorrect version rsp\n");
@@ -1059,7 +1616,7 @@ test_time(sim_t *sp)
 		sync_cycle - sp->cycle, sync_cycle, sync_cycle);
 	delay(sp, sync_cycle - sp->cycle + 100);
 
-	uart_send_vlq_and_wait(sp, 3, CMD_SYNC_TIME, (uint32_t)(sync_cycle & 0xffffffffull),
+	uart_send_cmd_and_wait<CMD_SYNC_TIME>(sp, (uint32_t)(sync_cycle & 0xffffffffull),
 		(uint32_t)(sync_cycle >> 32));
 
 	delay(sp, 100);
@@ -1073,21 +1630,165 @@ test_time(sim_t *sp)
 	watch_clear(wp);
 }
 
+/*
+ * command dispatch under load: many small requests back to back. Needs
+ * --tlm, at 250 kbaud each command costs tens of thousands of cycles
+ */
+#define DISPATCH_CMDS	100000
+
 static void
-test_pwm_check_cycle(sim_t *sp, int period, int duty)
+test_dispatch(sim_t *sp)
 {
-	Vconan *tb = sp->tb;
+	uint64_t start = sp->cycle;
+	uint64_t last = 0;
+	uint64_t t;
+	uint32_t rsp[8];
 	int i;
-	uint64_t curr;
 
-	wait_for_signal8(sp, &tb->conan__DOT__pwm1, 0);
-	wait_for_signal8(sp, &tb->conan__DOT__pwm1, 1);
-	for (i = 0; i < 3; ++i) {
-		curr = sp->cycle;
-		wait_for_signal8(sp, &tb->conan__DOT__pwm1, 0);
-		if (sp->cycle - curr != duty)
+	if (!tlm)
+		fail("dispatch needs --tlm, the bit level link is too slow\n");
+	for (i = 0; i < DISPATCH_CMDS; ++i) {
+		if (i & 1) {
+			uart_send_cmd<CMD_GET_VERSION>(sp);
+			wait_for_uart_vlq(sp, 6, rsp);
+			if (rsp[0] != RSP_GET_VERSION || rsp[1] != 0x42)
+				fail("bad version response to command %d\n", i);
+			continue;
+		}
+		uart_send_cmd<CMD_GET_TIME>(sp);
+		wait_for_uart_vlq(sp, 3, rsp);
+		t = rsp[1] + rsp[2] * (1ull << 32);
+		if (rsp[0] != RSP_GET_TIME || t <= last)
+			fail("bad time response to command %d\n", i);
+		last = t;
+	}
+	printf("dispatched %d commands in %lu cycles, %.1f cycles/command\n",
+		DISPATCH_CMDS, sp->cycle - start,
+		(double)(sp->cycle - start) / DISPATCH_CMDS);
+}
+
+/*
+ * the same load through the pipelined host model, measures how many
+ * commands framing.v and command.v take with --window frames in flight
+ */
+typedef struct {
+	uint64_t	last;
+	int		cnt;
+} pipeline_state_t;
+
+static void
+pipeline_time(sim_t *sp, void *arg, uint32_t *rsp)
+{
+	pipeline_state_t *ps = (pipeline_state_t *)arg;
+	uint64_t t = rsp[1] + rsp[2] * (1ull << 32);
+
+	if (t <= ps->last)
+		fail("time response %d not increasing\n", ps->cnt);
+	ps->last = t;
+	++ps->cnt;
+}
+
+static void
+test_pipeline(sim_t *sp)
+{
+	pipeline_state_t ps = { 0, 0 };
+	uint64_t start = sp->cycle;
+	host_pipe_t *hp;
+	uint64_t frames;
+	int i;
+
+	sp->usp->cts_stalls = 0;
+	hp = host_pipe_start(sp, host_window);
+	for (i = 0; i < DISPATCH_CMDS; ++i)
+		host_post<CMD_GET_TIME>(sp, hp, RSP_GET_TIME, 3, pipeline_time,
+			&ps);
+	host_pipe_drain(sp, hp);
+	frames = hp->frames;
+	host_pipe_stop(sp, hp);
+	if (ps.cnt != DISPATCH_CMDS)
+		fail("got %d of %d responses\n", ps.cnt, DISPATCH_CMDS);
+	printf("pipelined %d commands with window %d in %lu cycles, "
+		"%.1f cycles/command\n", DISPATCH_CMDS, host_window,
+		sp->cycle - start, (double)(sp->cycle - start) / DISPATCH_CMDS);
+	printf("%lu frames sent, %lu cycles waiting for cts\n", frames,
+		sp->usp->cts_stalls);
+}
+
+/*
+ * host link benchmark, for the baud sweep (make bench_baud): round trip
+ * time of GET_TIME, and the rate at which QUEUE_STEP commands are taken
+ * with a full pipeline. The step clocks are set far into the future, so
+ * the steppers only queue and the link, framing.v and command.v are all
+ * that is measured. The step queues hold MOVE_COUNT (1024) moves each
+ */
+#define LINK_SAMPLES	100
+#define LINK_STEPS	1000
+#define LINK_CHANNELS	6
+
+static void
+test_link(sim_t *sp)
+{
+	uint64_t lat_min = ~0ull;
+	uint64_t lat_max = 0;
+	uint64_t lat_sum = 0;
+	uint64_t start;
+	uint64_t cycles;
+	uint64_t bytes;
+	uint32_t rsp[3];
+	host_pipe_t *hp;
+	double rate;
+	double line;
+	int i;
+
+	for (i = 0; i < LINK_SAMPLES; ++i) {
+		start = sp->cycle;
+		uart_send_cmd<CMD_GET_TIME>(sp);
+		wait_for_uart_vlq(sp, 3, rsp);
+		cycles = sp->cycle - start;
+		lat_sum += cycles;
+		if (cycles < lat_min)
+			lat_min = cycles;
+		if (cycles > lat_max)
+			lat_max = cycles;
+	}
+
+	for (i = 0; i < LINK_CHANNELS; ++i) {
+		uart_send_cmd_and_wait<CMD_CONFIG_STEPPER>(sp, i, 1);
+		uart_send_cmd_and_wait<CMD_RESET_STEP_CLOCK>(sp, i,
+			(uint32_t)(sp->cycle + 0x40000000));
+	}
+	hp = host_pipe_start(sp, host_window);
+	start = sp->cycle;
+	for (i = 0; i < LINK_STEPS; ++i)
+		host_post<CMD_QUEUE_STEP>(sp, hp, -1, 0, NULL, NULL,
+			i % LINK_CHANNELS, 100, 1, 0);
+	host_pipe_drain(sp, hp);
+	cycles = sp->cycle - start;
+	bytes = hp->bytes;
+	host_pipe_stop(sp, hp);
+
+	/* commands per second, and what the wire could carry at most */
+	rate = (double)LINK_STEPS * HZ / cycles;
+	line = (double)BAUD / 10 / ((double)bytes / LINK_STEPS);
+	printf("link: baud %d get_time %.1f/%.1f/%.1f us (min/avg/max) "
+		"queue_step %.0f/s, %.0f%% of the line rate\n", BAUD,
+		lat_min * 1e6 / HZ, (double)lat_sum / LINK_SAMPLES * 1e6 / HZ,
+		lat_max * 1e6 / HZ, rate, rate * 100 / line);
+}
+
+static void
+test_pwm_check_cycle(sim_t *sp, int period, int duty)
+{
+	int i;
+	uint64_t curr;
+
+	wait_for_trigger(sp, "rise(pwm1)");
+	for (i = 0; i < 3; ++i) {
+		curr = sp->cycle;
+		wait_for_signal<vsd::pwm1>(sp, 0);
+		if (sp->cycle - curr != duty)
 			fail("pwm duty period mismatch, expected %d, got %d\n", duty, sp->cycle - curr);
-		wait_for_signal8(sp, &tb->conan__DOT__pwm1, 1);
+		wait_for_signal<vsd::pwm1>(sp, 1);
 		if (sp->cycle - curr != period)
 			fail("pwm period mismatch, expected %d got %d\n", period, sp->cycle - curr);
 	}
@@ -1154,7 +1855,7 @@ test_pwm(sim_t *sp)
 		fail("wrong pwm startup value\n");
 
 	/* CONFIGURE_PWM, channel, value, default_value, max_duration */
-	uart_send_vlq_and_wait(sp, 5, CMD_CONFIG_PWM, 0, 1, 0, 200000);
+	uart_send_cmd_and_wait<CMD_CONFIG_PWM>(sp, 0, 1, 0, 200000);
 	delay(sp, 100);
 
 
@@ -1164,14 +1865,16 @@ test_pwm(sim_t *sp)
 		yield(sp);
 	}
 
-	uart_send_vlq(sp, 5, CMD_SCHEDULE_PWM, 0, (uint32_t)(sp->cycle + 100000), 100, 900);
+	link_acquire(sp);	/* schedule relative to when we can send */
+	uart_post_cmd<CMD_SCHEDULE_PWM>(sp, 0, (uint32_t)(sp->cycle + 100000), 100, 900);
 	delay(sp, 100);
 	test_pwm_check_cycle(sp, 1000, 100);
 
 	/* give it 100000 cycles to process the message */
+	link_acquire(sp);
 	uint32_t sched = sp->cycle + 100000;
 	printf("schedule for %d\n", sched);
-	uart_send_vlq(sp, 5, CMD_SCHEDULE_PWM, 0, (uint32_t)(sp->cycle + 100000), 555, 445);
+	uart_post_cmd<CMD_SCHEDULE_PWM>(sp, 0, (uint32_t)(sp->cycle + 100000), 555, 445);
 	delay(sp, 50000);
 	/* see that it's not yet scheduled */
 	if (sp->cycle > sched - 5000)
@@ -1192,36 +1895,41 @@ test_pwm(sim_t *sp)
 			fail("pwm failed to fall back to default\n");
 		yield(sp);
 	}
+	link_acquire(sp);
 	sched = sp->cycle + 50000;
-	uart_send_vlq(sp, 5, CMD_SCHEDULE_PWM, 0, sched, 111, 889);
+	uart_post_cmd<CMD_SCHEDULE_PWM>(sp, 0, sched, 111, 889);
 	delay(sp, 50000);
 	test_pwm_check_cycle(sp, 1000, 111);
+	link_acquire(sp);
 	sched = sp->cycle + 50000;
-	uart_send_vlq(sp, 5, CMD_SCHEDULE_PWM, 0, sched, 1, 0);	/* always on */
+	uart_post_cmd<CMD_SCHEDULE_PWM>(sp, 0, sched, 1, 0);	/* always on */
 	delay(sp, 51000);
 	for (i = 0; i < 10000; ++i) {
 		if (tb->conan__DOT__pwm1 != 1)
 			fail("pwm not always on\n");
 		yield(sp);
 	}
+	link_acquire(sp);
 	sched = sp->cycle + 50000;
-	uart_send_vlq(sp, 5, CMD_SCHEDULE_PWM, 0, sched, 0, 1);	/* always off */
+	uart_post_cmd<CMD_SCHEDULE_PWM>(sp, 0, sched, 0, 1);	/* always off */
 	delay(sp, 51000);
 	for (i = 0; i < 10000; ++i) {
 		if (tb->conan__DOT__pwm1 != 0)
 			fail("pwm not always off\n");
 		yield(sp);
 	}
+	link_acquire(sp);
 	sched = sp->cycle + 50000;
-	uart_send_vlq(sp, 5, CMD_SCHEDULE_PWM, 0, sched, 0, 1);	/* same again */
+	uart_post_cmd<CMD_SCHEDULE_PWM>(sp, 0, sched, 0, 1);	/* same again */
 	delay(sp, 49000);
 	for (i = 0; i < 10000; ++i) {
 		if (tb->conan__DOT__pwm1 != 0)
 			fail("pwm not always off (2nd schedule)\n");
 		yield(sp);
 	}
+	link_acquire(sp);
 	sched = sp->cycle + 50000;
-	uart_send_vlq(sp, 5, CMD_SCHEDULE_PWM, 0, sched, 222, 778);
+	uart_post_cmd<CMD_SCHEDULE_PWM>(sp, 0, sched, 222, 778);
 	delay(sp, 50000);
 	test_pwm_check_cycle(sp, 1000, 222);
 
@@ -1248,7 +1956,7 @@ test_pwm(sim_t *sp)
 		{ 401284864, 4800000, 0 },
 	};
 	uint32_t base = testv[0].clock;
-	uart_send_vlq_and_wait(sp, 5, CMD_CONFIG_PWM, 0, 1, 0, 24000000);
+	uart_send_cmd_and_wait<CMD_CONFIG_PWM>(sp, 0, 1, 0, 24000000);
 	delay(sp, 50000);
 	sched = sp->cycle + 50000;
 	for (i = 0; i < sizeof(testv) / sizeof(struct _testv); ++i) {
@@ -1264,7 +1972,7 @@ test_pwm(sim_t *sp)
 		}
 
 		printf("diff: %u\n", testv[i].clock - testv[i - 1].clock);
-		uart_send_vlq(sp, 5, CMD_SCHEDULE_PWM, 0, sched, on, off);
+		uart_post_cmd<CMD_SCHEDULE_PWM>(sp, 0, sched, on, off);
 		delay(sp, diff);
 	}
 #endif
@@ -1362,13 +2070,13 @@ test_stepper(sim_t *sp)
 #endif
 
 	uint32_t start = sp->cycle;
-	uart_send_vlq_and_wait(sp, 3, CMD_CONFIG_STEPPER, 0, 1); /* dedge */
-	uart_send_vlq_and_wait(sp, 3, CMD_RESET_STEP_CLOCK, 0, start);
-	uart_send_vlq_and_wait(sp, 5, CMD_QUEUE_STEP, 0, 250000, 1, 0);
-	uart_send_vlq_and_wait(sp, 5, CMD_QUEUE_STEP, 0, 1000, 10, -10);
-	uart_send_vlq_and_wait(sp, 5, CMD_QUEUE_STEP, 0, 100, 10, 0);
-	uart_send_vlq_and_wait(sp, 3, CMD_SET_NEXT_STEP_DIR, 0, 1);
-	uart_send_vlq_and_wait(sp, 5, CMD_QUEUE_STEP, 0, 200, 10, 10);
+	uart_send_cmd_and_wait<CMD_CONFIG_STEPPER>(sp, 0, 1); /* dedge */
+	uart_send_cmd_and_wait<CMD_RESET_STEP_CLOCK>(sp, 0, start);
+	uart_send_cmd_and_wait<CMD_QUEUE_STEP>(sp, 0, 250000, 1, 0);
+	uart_send_cmd_and_wait<CMD_QUEUE_STEP>(sp, 0, 1000, 10, -10);
+	uart_send_cmd_and_wait<CMD_QUEUE_STEP>(sp, 0, 100, 10, 0);
+	uart_send_cmd_and_wait<CMD_SET_NEXT_STEP_DIR>(sp, 0, 1);
+	uart_send_cmd_and_wait<CMD_QUEUE_STEP>(sp, 0, 200, 10, 10);
 
 	start += 250000 - 10;
 
@@ -1387,7 +2095,7 @@ test_stepper(sim_t *sp)
 	_check_stepdir(sp, 2000, 1, 0, 1, &step1, NULL, 0);
 
 	/* check position */
-	uart_send_vlq(sp, 2, CMD_STEPPER_GET_POS, 0);
+	uart_send_cmd<CMD_STEPPER_GET_POS>(sp, 0);
 	uint32_t rsp[4];
 	wait_for_uart_vlq(sp, 3, rsp);
 	if (rsp[0] != RSP_STEPPER_GET_POS)
@@ -1398,7 +2106,7 @@ test_stepper(sim_t *sp)
 		fail("stepper pos does not match: %d != %d\n", rsp[1], steppos);
 
 	tb->endstop2 = 0;
-	uart_send_vlq(sp, 2, CMD_ENDSTOP_QUERY, 1);
+	uart_send_cmd<CMD_ENDSTOP_QUERY>(sp, 1);
 	wait_for_uart_vlq(sp, 4, rsp);
 	if (rsp[0] != RSP_ENDSTOP_STATE)
 		fail("received incorrect rsp to ENDSTOP_QUERY\n");
@@ -1410,7 +2118,7 @@ test_stepper(sim_t *sp)
 		fail("endstop state not 0\n");
 
 	tb->endstop2 = 1;
-	uart_send_vlq(sp, 2, CMD_ENDSTOP_QUERY, 1);
+	uart_send_cmd<CMD_ENDSTOP_QUERY>(sp, 1);
 	wait_for_uart_vlq(sp, 4, rsp);
 	if (rsp[0] != RSP_ENDSTOP_STATE)
 		fail("received incorrect rsp to ENDSTOP_QUERY\n");
@@ -1424,23 +2132,23 @@ test_stepper(sim_t *sp)
 	/*
 	 * test homing
 	 */
-	uart_send_vlq_and_wait(sp, 3, CMD_ENDSTOP_SET_STEPPER, 1, 0);
-	uart_send_vlq_and_wait(sp, 3, CMD_CONFIG_STEPPER, 0, 1); /* dedge */
-	uart_send_vlq_and_wait(sp, 3, CMD_SET_NEXT_STEP_DIR, 0, 0);
+	uart_send_cmd_and_wait<CMD_ENDSTOP_SET_STEPPER>(sp, 1, 0);
+	uart_send_cmd_and_wait<CMD_CONFIG_STEPPER>(sp, 0, 1); /* dedge */
+	uart_send_cmd_and_wait<CMD_SET_NEXT_STEP_DIR>(sp, 0, 0);
 	start = sp->cycle;
-	uart_send_vlq_and_wait(sp, 3, CMD_RESET_STEP_CLOCK, 0, start);
-	uart_send_vlq_and_wait(sp, 5, CMD_QUEUE_STEP, 0, 200000, 1, 0);
+	uart_send_cmd_and_wait<CMD_RESET_STEP_CLOCK>(sp, 0, start);
+	uart_send_cmd_and_wait<CMD_QUEUE_STEP>(sp, 0, 200000, 1, 0);
 	/* during this move we'll stop the homing */
-	uart_send_vlq_and_wait(sp, 5, CMD_QUEUE_STEP, 0, 1000, 100, 0);
+	uart_send_cmd_and_wait<CMD_QUEUE_STEP>(sp, 0, 1000, 100, 0);
 	/* this move has to be flushed */
-	uart_send_vlq_and_wait(sp, 5, CMD_QUEUE_STEP, 0, 888, 88, 0);
+	uart_send_cmd_and_wait<CMD_QUEUE_STEP>(sp, 0, 888, 88, 0);
 	start += 200000;
 	printf("schedule start for %d (test homing)\n", start);
 	/* CMD_ENDSTOP_HOME in: <endstop-channel> <time> <sample_count> <pin_value> */
-	uart_send_vlq_and_wait(sp, 5, CMD_ENDSTOP_HOME, 1, start, 10, 0);
+	uart_send_cmd_and_wait<CMD_ENDSTOP_HOME>(sp, 1, start, 10, 0);
 
 	/* see that endstop is reported as homing */
-	uart_send_vlq(sp, 2, CMD_ENDSTOP_QUERY, 1);
+	uart_send_cmd<CMD_ENDSTOP_QUERY>(sp, 1);
 	wait_for_uart_vlq(sp, 4, rsp);
 	if (rsp[0] != RSP_ENDSTOP_STATE)
 		fail("received incorrect rsp to ENDSTOP_QUERY\n");
@@ -1492,19 +2200,19 @@ test_stepper(sim_t *sp)
 	printf("test homing abort\n");
 	tb->endstop2 = 1;
 	start = sp->cycle;
-	uart_send_vlq_and_wait(sp, 3, CMD_RESET_STEP_CLOCK, 0, start);
-	uart_send_vlq_and_wait(sp, 5, CMD_QUEUE_STEP, 0, 150000, 1, 0);
-	uart_send_vlq_and_wait(sp, 5, CMD_QUEUE_STEP, 0, 1000, 100, 0);
+	uart_send_cmd_and_wait<CMD_RESET_STEP_CLOCK>(sp, 0, start);
+	uart_send_cmd_and_wait<CMD_QUEUE_STEP>(sp, 0, 150000, 1, 0);
+	uart_send_cmd_and_wait<CMD_QUEUE_STEP>(sp, 0, 1000, 100, 0);
 	start += 150000;
 	printf("schedule start for %d (homing abort)\n", start);
-	uart_send_vlq_and_wait(sp, 5, CMD_ENDSTOP_HOME, 1, start, 10, 0);
+	uart_send_cmd_and_wait<CMD_ENDSTOP_HOME>(sp, 1, start, 10, 0);
 
 	/* wait for the scheduled time to arrive */
 	delay(sp, start - sp->cycle);
 	/* abort homing */
-	uart_send_vlq_and_wait(sp, 5, CMD_ENDSTOP_HOME, 1, 0, 0, 0);
+	uart_send_cmd_and_wait<CMD_ENDSTOP_HOME>(sp, 1, 0, 0, 0);
 
-	uart_send_vlq(sp, 2, CMD_ENDSTOP_QUERY, 1);
+	uart_send_cmd<CMD_ENDSTOP_QUERY>(sp, 1);
 	wait_for_uart_vlq(sp, 4, rsp);
 	if (rsp[0] != RSP_ENDSTOP_STATE || rsp[1] != 1 || rsp[2] != 0 || rsp[3] != 1)
 		fail("homing abort failed\n");
@@ -1518,12 +2226,12 @@ test_stepper(sim_t *sp)
 	 * test regular move after homing again, this time without dedge
 	 */
 	printf("test move without dedge\n");
-	uart_send_vlq_and_wait(sp, 3, CMD_CONFIG_STEPPER, 0, 0);
+	uart_send_cmd_and_wait<CMD_CONFIG_STEPPER>(sp, 0, 0);
 	start = sp->cycle;
-	uart_send_vlq_and_wait(sp, 3, CMD_RESET_STEP_CLOCK, 0, start);
-	uart_send_vlq_and_wait(sp, 5, CMD_QUEUE_STEP, 0, 150000, 1, 0);
-	uart_send_vlq_and_wait(sp, 5, CMD_QUEUE_STEP, 0, 1000, 10, -10);
-	uart_send_vlq_and_wait(sp, 5, CMD_QUEUE_STEP, 0, 500, 10, 10);
+	uart_send_cmd_and_wait<CMD_RESET_STEP_CLOCK>(sp, 0, start);
+	uart_send_cmd_and_wait<CMD_QUEUE_STEP>(sp, 0, 150000, 1, 0);
+	uart_send_cmd_and_wait<CMD_QUEUE_STEP>(sp, 0, 1000, 10, -10);
+	uart_send_cmd_and_wait<CMD_QUEUE_STEP>(sp, 0, 500, 10, 10);
 
 	start += 150000 - 10;
 
@@ -1543,9 +2251,9 @@ test_stepper(sim_t *sp)
 			fail("stepper moved after finish\n");
 
 	start = sp->cycle;
-	uart_send_vlq_and_wait(sp, 3, CMD_RESET_STEP_CLOCK, 0, start);
+	uart_send_cmd_and_wait<CMD_RESET_STEP_CLOCK>(sp, 0, start);
 	/* send a command in the past */
-	uart_send_vlq_and_wait(sp, 5, CMD_QUEUE_STEP, 0, 1000, 1, 0);
+	uart_send_cmd_and_wait<CMD_QUEUE_STEP>(sp, 0, 1000, 1, 0);
 	wait_for_uart_vlq(sp, 3, rsp);
 	if (rsp[0] != RSP_SHUTDOWN || rsp[1] != 1)
 		fail("failed to shutdown\n");
@@ -1583,28 +2291,6 @@ tmcuart_free(tmcuart_t *tu)
 	free(tu);
 }
 
-static uint8_t
-tmcuart_crc(uint8_t *b, int l)
-{
-	int i;
-	int j;
-	uint8_t crc = 0;
-	uint8_t currentByte;
-
-	for (i = 0; i < l; i++) {
-		currentByte = b[i];
-		for (j = 0; j < 8; j++) {
-			if ((crc >> 7) ^ (currentByte & 0x01))
-				crc = (crc << 1) ^ 0x07;
-			else
-				crc = (crc << 1);
-			currentByte = currentByte >> 1;
-		}
-	}
-
-	return crc;
-}
-
 static void
 tmcuart_reset(tmcuart_t *tu)
 {
@@ -1614,104 +2300,123 @@ tmcuart_reset(tmcuart_t *tu)
 	tu->last_pos = 0;
 }
 
-static void
-tmcuart_tick(sim_t *sp)
+static uint64_t
+tmcuart_tick(sim_t *sp, void *arg)
 {
-	int i;
+	tmcuart_t *tu = (tmcuart_t *)arg;
+	uart_send_t *usp = tu->usp;
+	uart_recv_t *urp = tu->urp;
+	int want_dump = 0; /* dummy */
 	uint8_t crc;
 
-	for (i = 0; i < NUART; ++i) {
-		int want_dump = 0; /* dummy */
-		tmcuart_t *tu = sp->tmcuart[i];
-
-		if (tu == NULL)
-			continue;
-
-		uart_send_t *usp = tu->usp;
-		uart_recv_t *urp = tu->urp;
-
-		if (tu->state == TU_READ) {
-			tu->uart_in = *tu->line_in;
-		} else if (tu->state == TU_WRITE) {
-			*tu->line_out = tu->uart_out;
-		}
-		uart_send_tick(usp, &want_dump);
-		uart_recv_tick(urp, &want_dump);
-
-		if (tu->state == TU_READ && urp->pos) {
-			if (urp->pos != tu->last_pos)
-				tu->last_change = sp->cycle;
-			if (tu->last_change && (sp->cycle - tu->last_change) >
-			    HZ / 250000 * 63) {
-				printf("tmcuart reset\n");
-				tmcuart_reset(tu);
-			}
+	if (tu->state == TU_READ) {
+		tu->uart_in = *tu->line_in;
+	} else if (tu->state == TU_WRITE) {
+		*tu->line_out = tu->uart_out;
+	}
+	uart_send_tick(usp, &want_dump);
+	uart_recv_tick(urp, &want_dump);
+
+	if (tu->state == TU_READ && urp->pos) {
+		if (urp->pos != tu->last_pos)
+			tu->last_change = sp->cycle;
+		if (tu->last_change && (sp->cycle - tu->last_change) >
+		    HZ / 250000 * 63) {
+			LOG(LOGC_TMCUART, LOG_INFO, "tmcuart reset\n");
+			tmcuart_reset(tu);
 		}
+	}
 
-		if (tu->state == TU_IGNORE) {
-			/* already examined the packet, it's bad */
-		} else if (tu->state == TU_READ && urp->pos == 4) {
-			if ((urp->buf[0] & 0x0f) == 0x05 &&
-			    urp->buf[1] == 0x00 &&
-			    (urp->buf[2] & 0x80) == 0) {
-				/* read request, check crc */
-				crc = tmcuart_crc(urp->buf, 3);
-				if (urp->buf[3] == crc) {
-					tu->state = TU_TURNAROUND;
-					tu->delay = HZ / 250000 * 8; /* 8 bit times turnaround */
-				} else {
-					printf("crc mismatch, ignore: %02x != %02x\n", urp->buf[3], crc);
-					tu->state = TU_IGNORE;
-				}
-			}
-		} else if (tu->state == TU_READ && urp->pos == 8) {
-			/* check write */
-			if ((urp->buf[0] & 0x0f) == 0x05 &&
-			    urp->buf[1] == 0x00 &&
-			    (urp->buf[2] & 0x80) == 0x80) {
-				/* read request, check crc */
-				crc = tmcuart_crc(urp->buf, 7);
-				if (urp->buf[7] == crc) {
-					int reg = urp->buf[2] & 0x7f;
-					uint32_t data = (urp->buf[3] << 24) | (urp->buf[4] << 16) |
-							(urp->buf[5] << 8) | urp->buf[6];
-					tu->regs[reg] = data;
-					printf("writing %x to reg %d\n", data, reg);
-					++tu->regs[IFCNT];
-					tmcuart_reset(tu);
-				} else {
-					printf("crc mismatch, ignore: %02x != %02x\n", urp->buf[7], crc);
-					tu->state = TU_IGNORE;
-				}
+	if (tu->state == TU_IGNORE) {
+		/* already examined the packet, it's bad */
+	} else if (tu->state == TU_READ && urp->pos == 4) {
+		if ((urp->buf[0] & 0x0f) == 0x05 &&
+		    urp->buf[1] == 0x00 &&
+		    (urp->buf[2] & 0x80) == 0) {
+			/* read request, check crc */
+			crc = crc8_tmc(urp->buf, 3);
+			if (urp->buf[3] == crc) {
+				txlog_write(txl, TX_TMC_REQ, tu->chan, urp->buf, 4);
+				tu->state = TU_TURNAROUND;
+				tu->delay = HZ / 250000 * 8; /* 8 bit times turnaround */
 			} else {
-				tmcuart_reset(tu);
+				LOG(LOGC_TMCUART, LOG_ERR, "crc mismatch, ignore: %02x != %02x\n", urp->buf[3], crc);
+				tu->state = TU_IGNORE;
 			}
-		} else if (tu->state == TU_TURNAROUND && --tu->delay == 0) {
-			uint8_t outbuf[8];
-			int reg = urp->buf[2] & 0x7f;
-
-			printf("received valid read for reg %d\n", reg);
-			outbuf[0] = 0xa0;
-			outbuf[1] = 0xff;
-			outbuf[2] = reg << 1;
-			outbuf[3] = tu->regs[reg] >> 24;
-			outbuf[4] = (tu->regs[reg] >> 16) & 0xff;
-			outbuf[5] = (tu->regs[reg] >> 8) & 0xff;
-			outbuf[6] = tu->regs[reg] & 0xff;
-			outbuf[7] = tmcuart_crc(outbuf, 7);
-			uart_send(usp, outbuf, 8);
-			urp->pos = 0;
-			tu->state = TU_WRITE;
-		} else if (tu->state == TU_WRITE) {
-			if (uart_send_done(usp)) {
-				tu->state = TU_TURNBACK;
-				tu->delay = HZ / 250000 * 12;
+		}
+	} else if (tu->state == TU_READ && urp->pos == 8) {
+		/* check write */
+		if ((urp->buf[0] & 0x0f) == 0x05 &&
+		    urp->buf[1] == 0x00 &&
+		    (urp->buf[2] & 0x80) == 0x80) {
+			/* read request, check crc */
+			crc = crc8_tmc(urp->buf, 7);
+			if (urp->buf[7] == crc) {
+				int reg = urp->buf[2] & 0x7f;
+				uint32_t data = (urp->buf[3] << 24) | (urp->buf[4] << 16) |
+						(urp->buf[5] << 8) | urp->buf[6];
+				tu->regs[reg] = data;
+				txlog_write(txl, TX_TMC_REQ, tu->chan, urp->buf, 8);
+				LOG(LOGC_TMCUART, LOG_DEBUG, "writing %x to reg %d\n", data, reg);
+				++tu->regs[IFCNT];
+				tmcuart_reset(tu);
+			} else {
+				LOG(LOGC_TMCUART, LOG_ERR, "crc mismatch, ignore: %02x != %02x\n", urp->buf[7], crc);
+				tu->state = TU_IGNORE;
 			}
-		} else if (tu->state == TU_TURNBACK && --tu->delay == 0) {
-			tu->state = TU_READ;
-			printf("tmcuart(%s) ready to read again\n", tu->usp->name);
+		} else {
+			tmcuart_reset(tu);
 		}
+	} else if (tu->state == TU_TURNAROUND && --tu->delay == 0) {
+		uint8_t outbuf[8];
+		int reg = urp->buf[2] & 0x7f;
+
+		LOG(LOGC_TMCUART, LOG_DEBUG, "received valid read for reg %d\n", reg);
+		outbuf[0] = 0xa0;
+		outbuf[1] = 0xff;
+		outbuf[2] = reg << 1;
+		outbuf[3] = tu->regs[reg] >> 24;
+		outbuf[4] = (tu->regs[reg] >> 16) & 0xff;
+		outbuf[5] = (tu->regs[reg] >> 8) & 0xff;
+		outbuf[6] = tu->regs[reg] & 0xff;
+		outbuf[7] = crc8_tmc(outbuf, 7);
+		txlog_write(txl, TX_TMC_REPLY, tu->chan, outbuf, 8);
+		uart_send(usp, outbuf, 8);
+		urp->pos = 0;
+		tu->state = TU_WRITE;
+	} else if (tu->state == TU_WRITE) {
+		if (uart_send_done(usp)) {
+			tu->state = TU_TURNBACK;
+			tu->delay = HZ / 250000 * 12;
+		}
+	} else if (tu->state == TU_TURNBACK && --tu->delay == 0) {
+		tu->state = TU_READ;
+		LOG(LOGC_TMCUART, LOG_DEBUG, "tmcuart(%s) ready to read again\n",
+			tu->usp->name);
 	}
+
+	/* idle, wait for a start bit */
+	if (tu->state == TU_READ && tu->urp->bit == 0 && tu->urp->pos == 0 &&
+	    uart_send_done(tu->usp) && *tu->line_in == 1)
+		return SCHED_NEVER;
+
+	return sp->cycle + 1;
+}
+
+static void
+tmcuart_attach(sim_t *sp, int i, tmcuart_t *tu)
+{
+	sp->tmcuart[i] = tu;
+	tu->chan = i;
+	tu->se = sched_add(sp, tu->usp->name, tmcuart_tick, tu, PROF_TMCUART);
+	sched_sense(tu->se, tu->line_in);
+}
+
+static void
+tmcuart_detach(sim_t *sp, int i)
+{
+	sched_remove(sp, sp->tmcuart[i]->se);
+	sp->tmcuart[i]->se = NULL;
 }
 
 static void
@@ -1726,12 +2431,12 @@ test_tmcuart(sim_t *sp)
 	 * RSP_TMCUART_READ in <status> <data>
 	 */
 
-	sp->tmcuart[0] = tmcuart_init(sp, &tb->uart1, &tb->uart1_in, "uart1");
-	sp->tmcuart[1] = tmcuart_init(sp, &tb->uart2, &tb->uart2_in, "uart2");
-	sp->tmcuart[2] = tmcuart_init(sp, &tb->uart3, &tb->uart3_in, "uart3");
-	sp->tmcuart[3] = tmcuart_init(sp, &tb->uart4, &tb->uart4_in, "uart4");
-	sp->tmcuart[4] = tmcuart_init(sp, &tb->uart5, &tb->uart5_in, "uart5");
-	sp->tmcuart[5] = tmcuart_init(sp, &tb->uart6, &tb->uart6_in, "uart6");
+	tmcuart_attach(sp, 0, tmcuart_init(sp, &tb->uart1, &tb->uart1_in, "uart1"));
+	tmcuart_attach(sp, 1, tmcuart_init(sp, &tb->uart2, &tb->uart2_in, "uart2"));
+	tmcuart_attach(sp, 2, tmcuart_init(sp, &tb->uart3, &tb->uart3_in, "uart3"));
+	tmcuart_attach(sp, 3, tmcuart_init(sp, &tb->uart4, &tb->uart4_in, "uart4"));
+	tmcuart_attach(sp, 4, tmcuart_init(sp, &tb->uart5, &tb->uart5_in, "uart5"));
+	tmcuart_attach(sp, 5, tmcuart_init(sp, &tb->uart6, &tb->uart6_in, "uart6"));
 #if 0
 tmcuart_init(sim_t *sp, vluint8_t *in, vluint8_t *out, vluint8_t *en, int mask)
         CData/*5:0*/ conan__DOT__u_command__DOT__u_tmcuart__DOT__uart__out__out0;
@@ -1767,7 +2472,7 @@ tmcuart_init(sim_t *sp, vluint8_t *in, vluint8_t *out, vluint8_t *en, int mask)
 
 	/* read version */
 	uint32_t rsp[4];
-	uart_send_vlq(sp, 4, CMD_TMCUART_READ, 2, 0, IOIN);
+	uart_send_cmd<CMD_TMCUART_READ>(sp, 2, 0, IOIN);
 	wait_for_uart_vlq(sp, 4, rsp);
 	if (rsp[0] != RSP_TMCUART_READ)
 		fail("tmcuart read version failed\n");
@@ -1779,7 +2484,7 @@ tmcuart_init(sim_t *sp, vluint8_t *in, vluint8_t *out, vluint8_t *en, int mask)
 		fail("tmcuart read bad version %x\n", rsp[2]);
 
 	/* timeout on a different slave */
-	uart_send_vlq(sp, 4, CMD_TMCUART_READ, 2, 1, IOIN);
+	uart_send_cmd<CMD_TMCUART_READ>(sp, 2, 1, IOIN);
 	wait_for_uart_vlq(sp, 4, rsp);
 	if (rsp[0] != RSP_TMCUART_READ)
 		fail("tmcuart test timeout\n");
@@ -1794,7 +2499,7 @@ tmcuart_init(sim_t *sp, vluint8_t *in, vluint8_t *out, vluint8_t *en, int mask)
 
 	/* read version again */
 	printf("read version again\n");
-	uart_send_vlq(sp, 4, CMD_TMCUART_READ, 2, 0, IOIN);
+	uart_send_cmd<CMD_TMCUART_READ>(sp, 2, 0, IOIN);
 	wait_for_uart_vlq(sp, 4, rsp);
 	if (rsp[0] != RSP_TMCUART_READ)
 		fail("tmcuart read version failed\n");
@@ -1806,10 +2511,10 @@ tmcuart_init(sim_t *sp, vluint8_t *in, vluint8_t *out, vluint8_t *en, int mask)
 		fail("tmcuart read bad version %x\n", rsp[2]);
 
 	/* write */
-	uart_send_vlq_and_wait(sp, 5, CMD_TMCUART_WRITE, 2, 0, 10, 0x1234);
+	uart_send_cmd_and_wait<CMD_TMCUART_WRITE>(sp, 2, 0, 10, 0x1234);
 
 	/* read */
-	uart_send_vlq(sp, 4, CMD_TMCUART_READ, 2, 0, 10);
+	uart_send_cmd<CMD_TMCUART_READ>(sp, 2, 0, 10);
 	wait_for_uart_vlq(sp, 4, rsp);
 	if (rsp[0] != RSP_TMCUART_READ)
 		fail("tmcuart read version failed\n");
@@ -1823,6 +2528,7 @@ tmcuart_init(sim_t *sp, vluint8_t *in, vluint8_t *out, vluint8_t *en, int mask)
 	delay(sp, 1000);
 	watch_clear(sp->wp);
 	for (i = 0; i < 6; ++i) {
+		tmcuart_detach(sp, i);
 		free(sp->tmcuart[i]);
 		sp->tmcuart[i] = NULL;
 	}
@@ -1839,37 +2545,38 @@ test_gpio(sim_t *sp)
 	watch_add(sp->wp, "u_command.msg_state", "msg_state", NULL, FORM_DEC, WF_ALL);
 
 	/* directly set gpio */
-	uart_send_vlq_and_wait(sp, 3, CMD_SET_DIGITAL_OUT, 2, 1);
+	uart_send_cmd_and_wait<CMD_SET_DIGITAL_OUT>(sp, 2, 1);
 	delay(sp, 100);
 	if (!(tb->conan__DOT__gpio & 4))
 		fail("failed to set gpio 2\n");
 
-	uart_send_vlq_and_wait(sp, 3, CMD_SET_DIGITAL_OUT, 2, 0);
+	uart_send_cmd_and_wait<CMD_SET_DIGITAL_OUT>(sp, 2, 0);
 	delay(sp, 100);
 	if ((tb->conan__DOT__gpio & 4))
 		fail("failed to reset gpio 2\n");
 
 	/* set via update */
-	uart_send_vlq_and_wait(sp, 3, CMD_UPDATE_DIGITAL_OUT, 2, 1);
+	uart_send_cmd_and_wait<CMD_UPDATE_DIGITAL_OUT>(sp, 2, 1);
 	delay(sp, 100);
 	if (!(tb->conan__DOT__gpio & 4))
 		fail("failed to set gpio 2 via update\n");
 
-	uart_send_vlq_and_wait(sp, 3, CMD_UPDATE_DIGITAL_OUT, 2, 0);
+	uart_send_cmd_and_wait<CMD_UPDATE_DIGITAL_OUT>(sp, 2, 0);
 	delay(sp, 100);
 	if ((tb->conan__DOT__gpio & 4))
 		fail("failed to clr gpio 2 via update\n");
 
 	/* CONFIGURE_GPIO, channel,  value, default_value, max_duration */
-	uart_send_vlq_and_wait(sp, 5, CMD_CONFIG_DIGITAL_OUT, 2, 1, 1, 50000);
+	uart_send_cmd_and_wait<CMD_CONFIG_DIGITAL_OUT>(sp, 2, 1, 1, 50000);
 	delay(sp, 100);
 	if (!(tb->conan__DOT__gpio & 4))
 		fail("failed to set gpio 2 via configure\n");
 
 	/* give it 100000 cycles to process the message */
+	link_acquire(sp);	/* schedule relative to when we can send */
 	uint32_t sched = sp->cycle + 100000;
 	printf("schedule for %d\n", sched);
-	uart_send_vlq(sp, 4, CMD_SCHEDULE_DIGITAL_OUT, 2, (uint32_t)(sp->cycle + 100000), 0);
+	uart_post_cmd<CMD_SCHEDULE_DIGITAL_OUT>(sp, 2, (uint32_t)(sp->cycle + 100000), 0);
 	delay(sp, 50000);
 	/* see that it's not yet scheduled */
 	if (sp->cycle > sched - 5000)
@@ -1927,7 +2634,6 @@ static void
 test_dro(sim_t *sp)
 {
 	Vconan *tb = sp->tb;
-	int i;
 	uint32_t rsp[5];
 	uint32_t starttime;
 	uint32_t idle = HZ / 1000; /* 1ms */
@@ -1942,7 +2648,7 @@ test_dro(sim_t *sp)
 	watch_add(sp->wp, "chain_out_out2", "dclk_in", NULL, FORM_DEC, WF_ALL);
 	watch_add(sp->wp, "chain_out_out1", "ddo_in", NULL, FORM_DEC, WF_ALL);
 
-	uart_send_vlq_and_wait(sp, 4, CMD_CONFIG_DRO, 0, idle, 0);
+	uart_send_cmd_and_wait<CMD_CONFIG_DRO>(sp, 0, idle, 0);
 
 	starttime = dro_send(sp, 0x000000, 24, idle);
 
@@ -1973,7 +2679,7 @@ test_dro(sim_t *sp)
 		fail("dro data bad bits %x\n", rsp[4]);
 
 	/* now send via daq */
-	uart_send_vlq_and_wait(sp, 4, CMD_CONFIG_DRO, 0, idle, 1);
+	uart_send_cmd_and_wait<CMD_CONFIG_DRO>(sp, 0, idle, 1);
 
 	uint32_t buf[500];
 	ether_t eth = { 0 };
@@ -1982,43 +2688,23 @@ test_dro(sim_t *sp)
 	eth.tx0 = &tb->pmod1_4;
 	eth.tx1 = &tb->pmod1_3;
 	starttime = dro_send(sp, 0x674531, 24, idle);
-	int len = get_packet(sp, &eth, buf, sizeof(buf) / sizeof(*buf));
-	int got_it = 0;
-	for (i = 0; i < len; ++i) {
-		uint32_t d = buf[i];
-		uint8_t type = d >> 24;
-
-		printf("type %d\n", type);
-		switch (type) {
-		case 0x08:
-		case 0x0a:
-		case 0xff:
-			break;
-		case 0x09:
-		case 0x0b:
-			if (i + 1 == len)
-				fail("incomplete mcu packet\n");
-			++i;
-			break;
-		case 0x30:
-			printf("received dro packet\n");
-			i += 2;
-			got_it = 1;
-			break;
-		case 0x40:
-			i += 1 + (d & 0xff);
-			if (i >= len)
-				fail("incomplete mcu packet\n");
-			break;
-		default:
-			fail("unknown daq packet type %d\n", type);
-			break;
-		}
-	}
-	if (!got_it)
+	daq_demux_t *dm = get_daq_packet(sp, &eth, buf,
+		sizeof(buf) / sizeof(*buf));
+	const daq_rec_t *r = daq_next(dm, DAQS_DRO);
+	if (r == NULL)
 		fail("no dro packet in daq packet\n");
+	printf("received dro packet\n");
+	if (r->chan != 0)
+		fail("dro daq bad channel %d\n", r->chan);
+	if ((uint32_t)r->time != starttime)
+		fail("dro daq bad starttime %d != %d\n", (uint32_t)r->time,
+			starttime);
+	if (r->val != 0x674531)
+		fail("dro daq bad data %x\n", r->val);
+	if (r->bits != 24)
+		fail("dro daq bad bits %x\n", r->bits);
 		
-	uart_send_vlq_and_wait(sp, 4, CMD_CONFIG_DRO, 0, 0, 0);
+	uart_send_cmd_and_wait<CMD_CONFIG_DRO>(sp, 0, 0, 0);
 
 	watch_clear(sp->wp);
 }
@@ -2027,7 +2713,6 @@ static void
 test_signal(sim_t *sp)
 {
 	Vconan *tb = sp->tb;
-	int i;
 	uint32_t rsp[5];
 	uint32_t buf[500];
 
@@ -2055,13 +2740,13 @@ test_signal(sim_t *sp)
 	watch_add(sp->wp, "u_signal.st_len", "len", NULL, FORM_DEC, WF_ALL);
 
 	/* drain existing packets */
-	uart_send_vlq_and_wait(sp, 3, CMD_ETHER_SET_STATE, 0, 1);
+	uart_send_cmd_and_wait<CMD_ETHER_SET_STATE>(sp, 0, 1);
 	delay(sp, 20000);
 
-	uart_send_vlq_and_wait(sp, 3, CMD_ETHER_SET_STATE, 0, 2); /* set running */
+	uart_send_cmd_and_wait<CMD_ETHER_SET_STATE>(sp, 0, 2); /* set running */
 
 	/* enable signal unit */
-	uart_send_vlq_and_wait(sp, 3, CMD_CONFIG_SIGNAL, 1, 0xffffffff);
+	uart_send_cmd_and_wait<CMD_CONFIG_SIGNAL>(sp, 1, 0xffffffff);
 
 	ether_t eth = { 0 };
 	eth.rx_clk = &tb->pmod2_2;
@@ -2069,47 +2754,23 @@ test_signal(sim_t *sp)
 	eth.tx0 = &tb->pmod1_4;
 	eth.tx1 = &tb->pmod1_3;
 
-	int len = get_packet(sp, &eth, buf, sizeof(buf) / sizeof(*buf));
+	daq_demux_t *dm = get_daq_packet(sp, &eth, buf,
+		sizeof(buf) / sizeof(*buf));
+	const daq_rec_t *r;
 	int got_it = 0;
-	for (i = 0; i < len; ++i) {
-		uint32_t d = buf[i];
-		uint8_t type = d >> 24;
-
-		printf("type %d\n", type);
-		switch (type) {
-		case 0x08:
-		case 0x0a:
-		case 0xff:
-			break;
-		case 0x09:
-		case 0x0b:
-			if (i + 1 == len)
-				fail("incomplete mcu packet\n");
-			++i;
-			break;
-		case 0x30:
-			i += 2;
-			got_it = 1;
-			break;
-		case 0x40:
-			printf("received signal packet len %d\n", (d >> 8) & 0xff);
-			i += 1 + (d & 0xff);
-			got_it = 1;
-			break;
-		default:
-			fail("unknown daq packet type %d\n", type);
-			break;
-		}
+	while ((r = daq_next(dm, DAQS_SIGNAL)) != NULL) {
+		printf("received signal packet len %d\n", r->len);
+		got_it = 1;
 	}
 	if (!got_it)
-		fail("no dro packet in daq packet\n");
+		fail("no signal packet in daq packet\n");
 
 #if 0
 printf("sleeping\n"); sleep(1000);
 #endif
 
 #if 0
-	uart_send_vlq_and_wait(sp, 3, CMD_ETHER_SET_STATE, 0, 1);
+	uart_send_cmd_and_wait<CMD_ETHER_SET_STATE>(sp, 0, 1);
 #endif
 
 	watch_clear(sp->wp);
@@ -2133,14 +2794,14 @@ test_drain(sim_t *sp)
 	watch_add(sp->wp, "u_mac.discard_len$", "discard_len", NULL, FORM_DEC, WF_ALL);
 
 	/* drain existing packets */
-	uart_send_vlq_and_wait(sp, 3, CMD_ETHER_SET_STATE, 0, 1);
+	uart_send_cmd_and_wait<CMD_ETHER_SET_STATE>(sp, 0, 1);
 	delay(sp, 40000);
 
 	if (tb->conan__DOT__u_command__DOT__u_daq__DOT__rptr !=
 	    tb->conan__DOT__u_command__DOT__u_daq__DOT__wptr)
 		fail("daq queue not drained\n");
 
-	uart_send_vlq_and_wait(sp, 3, CMD_ETHER_SET_STATE, 0, 2); /* set running */
+	uart_send_cmd_and_wait<CMD_ETHER_SET_STATE>(sp, 0, 2); /* set running */
 
 	watch_clear(sp->wp);
 }
@@ -2149,7 +2810,6 @@ static void
 test_abz(sim_t *sp)
 {
 	Vconan *tb = sp->tb;
-	int i;
 	uint32_t rsp[5];
 	uint32_t buf[500];
 
@@ -2179,7 +2839,7 @@ test_abz(sim_t *sp)
 
 
 	/* enable signal unit */
-	uart_send_vlq_and_wait(sp, 3, CMD_CONFIG_ABZ, 1, 0xffffffff);
+	uart_send_cmd_and_wait<CMD_CONFIG_ABZ>(sp, 1, 0xffffffff);
 
 	ether_t eth = { 0 };
 	eth.rx_clk = &tb->pmod2_2;
@@ -2187,46 +2847,18 @@ test_abz(sim_t *sp)
 	eth.tx0 = &tb->pmod1_4;
 	eth.tx1 = &tb->pmod1_3;
 
-	int len = get_packet(sp, &eth, buf, sizeof(buf) / sizeof(*buf));
-	int got_it = 0;
-	for (i = 0; i < len; ++i) {
-		uint32_t d = buf[i];
-		uint8_t type = d >> 24;
-
-		printf("type %d\n", type);
-		switch (type) {
-		case 0x08:
-		case 0x0a:
-		case 0xff:
-			break;
-		case 0x09:
-		case 0x0b:
-			if (i + 1 == len)
-				fail("incomplete mcu packet\n");
-			++i;
-			break;
-		case 0x30:
-			i += 2;
-			break;
-		case 0x40:
-			printf("received signal packet len %d\n", d & 0xff);
-			i += 1 + (d & 0xff);
-			break;
-		case 0x48:
-			printf("received abz packet len %d\n", d & 0xff);
-			i += 1 + (d & 0xff);
-			got_it = 1;
-			break;
-		default:
-			fail("unknown daq packet type %d at %d\n", type, i);
-			break;
-		}
-	}
-	if (!got_it)
+	daq_demux_t *dm = get_daq_packet(sp, &eth, buf,
+		sizeof(buf) / sizeof(*buf));
+	const daq_rec_t *r;
+	while ((r = daq_next(dm, DAQS_SIGNAL)) != NULL)
+		printf("received signal packet len %d\n", r->len);
+	if (daq_pending(dm, DAQS_ABZ) == 0)
 		fail("no abz packet in daq packet\n");
+	while ((r = daq_next(dm, DAQS_ABZ)) != NULL)
+		printf("received abz packet len %d\n", r->len);
 
 	/* disable abz unit again */
-	uart_send_vlq_and_wait(sp, 3, CMD_CONFIG_ABZ, 0, 0);
+	uart_send_cmd_and_wait<CMD_CONFIG_ABZ>(sp, 0, 0);
 
 #if 0
 printf("sleeping\n"); sleep(1000);
@@ -2235,44 +2867,60 @@ printf("sleeping\n"); sleep(1000);
 	watch_clear(sp->wp);
 }
 
-static void
-as5311_tick(sim_t *sp)
+static uint64_t
+as5311_tick(sim_t *sp, void *arg)
 {
-	int i;
-	as5311_t *as;
-
-	for (i = 0; i < NAS5311; ++i) {
-		as = sp->as5311[i];
-
-		if (as == NULL)
-			continue;
+	as5311_t *as = (as5311_t *)arg;
+	int state = as->state;
 
-		if (as->state == AS_IDLE && *as->cs == 0) {
-			if (*as->clk == 0) {
-				/* magnet data */
-				as->data = (as->magnet++ << 6) | 0x25;
-				as->state = AS_CLK_LO;
-			} else {
-				/* sensor data */
-				as->data = (as->sensor++ << 6) | 0x25;
-				as->state = AS_CLK_HI;
-			}
-			as->cnt = 18;
-		} else if (as->state == AS_CLK_HI && *as->clk == 0) {
+	if (as->state == AS_IDLE && *as->cs == 0) {
+		if (*as->clk == 0) {
+			/* magnet data */
+			as->data = (as->magnet++ << 6) | 0x25;
 			as->state = AS_CLK_LO;
-		} else if (as->state == AS_CLK_LO && *as->clk == 1) {
-			*as->dout = (as->data >> 17) & 1;
-			as->data <<= 1;
-			if (--as->cnt == 0)
-				as->state = AS_WAIT_CS;
-			else
-				as->state = AS_CLK_HI;
-		} else if (as->state == AS_WAIT_CS && *as->cs == 1) {
-			as->state = AS_IDLE;
-		} else if (as->state != AS_IDLE && *as->cs == 1) {
-			fail("as5311 bad timing at cnt=%d\n", as->cnt);
+		} else {
+			/* sensor data */
+			as->data = (as->sensor++ << 6) | 0x25;
+			as->state = AS_CLK_HI;
 		}
+		as->cnt = 18;
+	} else if (as->state == AS_CLK_HI && *as->clk == 0) {
+		as->state = AS_CLK_LO;
+	} else if (as->state == AS_CLK_LO && *as->clk == 1) {
+		*as->dout = (as->data >> 17) & 1;
+		as->data <<= 1;
+		if (--as->cnt == 0)
+			as->state = AS_WAIT_CS;
+		else
+			as->state = AS_CLK_HI;
+	} else if (as->state == AS_WAIT_CS && *as->cs == 1) {
+		as->state = AS_IDLE;
+	} else if (as->state != AS_IDLE && *as->cs == 1) {
+		fail("as5311 bad timing at cnt=%d\n", as->cnt);
 	}
+
+	/* only one transition per cycle, check again if something happened */
+	if (as->state != state)
+		return sp->cycle + 1;
+
+	return SCHED_NEVER;
+}
+
+static void
+as5311_attach(sim_t *sp, int i, as5311_t *as)
+{
+	sp->as5311[i] = as;
+	as->se = sched_add(sp, "as5311", as5311_tick, as, PROF_AS5311);
+	sched_sense(as->se, as->cs);
+	sched_sense(as->se, as->clk);
+}
+
+static void
+as5311_detach(sim_t *sp, int i)
+{
+	sched_remove(sp, sp->as5311[i]->se);
+	sp->as5311[i]->se = NULL;
+	sp->as5311[i] = NULL;
 }
 
 static void
@@ -2291,7 +2939,7 @@ test_as5311(sim_t *sp)
 	as.cs = &tb->exp1_2;
 	as.dout = &tb->exp1_3;
 
-	sp->as5311[0] = &as;
+	as5311_attach(sp, 0, &as);
 
 	watch_add(sp->wp, "exp1_1$", "clk", NULL, FORM_DEC, WF_ALL);
 	watch_add(sp->wp, "exp1_2$", "cs", NULL, FORM_DEC, WF_ALL);
@@ -2307,7 +2955,7 @@ test_as5311(sim_t *sp)
 	watch_add(sp->wp, "u_as5311.next_mag", "n_mag", NULL, FORM_DEC, WF_ALL);
 
 	/* channel, divider, data interval, mag interval */
-	uart_send_vlq_and_wait(sp, 6, CMD_CONFIG_AS5311, 0, 10, 100000, 300000, 0);
+	uart_send_cmd_and_wait<CMD_CONFIG_AS5311>(sp, 0, 10, 100000, 300000, 0);
 
 	/* rsp: RSP_AS5311_DATA, channel, starttime, data, type (1=data, 0=mag) */
 	for (i = 0; i < 5; ++i) {
@@ -2345,7 +2993,7 @@ test_as5311(sim_t *sp)
 	watch_add(sp->wp, "daq_grant", "d_grant", NULL, FORM_HEX, WF_ALL);
 	watch_add(sp->wp, "daq_valid", "d_valid", NULL, FORM_HEX, WF_ALL);
 	watch_add(sp->wp, "pmod2_1", "tx_en", NULL, FORM_HEX, WF_ALL);
-	uart_send_vlq_and_wait(sp, 6, CMD_CONFIG_AS5311, 0, 10, 100000, 300000, 1);
+	uart_send_cmd_and_wait<CMD_CONFIG_AS5311>(sp, 0, 10, 100000, 300000, 1);
 
 	for (i = 0; i < 1000000; ++i) {
 		if (tb->pmod2_1)
@@ -2356,9 +3004,9 @@ test_as5311(sim_t *sp)
 		fail("no ethernet activity\n");
 
 	/* disable: channel, divider, data interval, mag interval */
-	uart_send_vlq_and_wait(sp, 6, CMD_CONFIG_AS5311, 0, 0, 0, 0, 0);
+	uart_send_cmd_and_wait<CMD_CONFIG_AS5311>(sp, 0, 0, 0, 0, 0);
 
-	sp->as5311[0] = NULL;
+	as5311_detach(sp, 0);
 
 	watch_clear(sp->wp);
 }
@@ -2456,9 +3104,9 @@ test_biss(sim_t *sp)
 	watch_add(sp->wp, "u_biss.in_cnt", "in_cnt", NULL, FORM_DEC, WF_ALL);
 	watch_add(sp->wp, "u_biss.param_data", "p_data", NULL, FORM_HEX, WF_ALL);
 
-	uart_send_vlq_and_wait(sp, 4, CMD_CONFIG_BISS, 0, freq, timeout);
+	uart_send_cmd_and_wait<CMD_CONFIG_BISS>(sp, 0, freq, timeout);
 
-	uart_send_vlq(sp, 4, CMD_BISS_FRAME, 0, 0, 24);
+	uart_send_cmd<CMD_BISS_FRAME>(sp, 0, 0, 24);
 
 	data = 0x123456;
 	cdm = biss_send(sp, data, 24, freq, timeout);
@@ -2487,7 +3135,7 @@ test_biss(sim_t *sp)
 	if (rsp[5] != ((data >> 0) & 0xff))
 		fail("biss frame bad byte 2 %02x\n", rsp[5]);
 
-	uart_send_vlq(sp, 4, CMD_BISS_FRAME, 0, 1, 25);
+	uart_send_cmd<CMD_BISS_FRAME>(sp, 0, 1, 25);
 
 	data = 0x654321;
 	cdm = biss_send(sp, 0x654321, 25, freq, timeout);
@@ -2518,13 +3166,8 @@ test_biss(sim_t *sp)
 }
 
 static void
-sd_tick(sim_t *sp)
+sd_clk(sim_t *sp, sd_t *sd)
 {
-	sd_t *sd = sp->sd;
-
-	if (sd == NULL)
-		return;
-
 	if (sd->last_clk == *sd->clk)
 		return;
 	sd->last_clk = *sd->clk;
@@ -2546,14 +3189,16 @@ sd_tick(sim_t *sp)
 			fail("sd: cmd line disabled during receive at bit %d\n", sd->bitcnt);
 		}
 
-		printf("sd: received cmd bit %d\n", *sd->cmd_out);
+		LOG(LOGC_SD, LOG_DEBUG, "sd: received cmd bit %d\n", *sd->cmd_out);
 		if (*sd->cmd_out)
 			sd->cmd_rcv[sd->bitcnt / 8] |= 1 << (7 - (sd->bitcnt & 7));
 
 		if (++sd->bitcnt == 48) {
-			printf("sd: received cmd %02x%02x%02x%02x%02x%02x\n",
+			LOG(LOGC_SD, LOG_DEBUG,
+				"sd: received cmd %02x%02x%02x%02x%02x%02x\n",
 				sd->cmd_rcv[0], sd->cmd_rcv[1], sd->cmd_rcv[2],
 				sd->cmd_rcv[3], sd->cmd_rcv[4], sd->cmd_rcv[5]);
+			txlog_write(txl, TX_SD_CMD, 0, sd->cmd_rcv, 6);
 
 			if (sd->cmd_rcv[0] == 0x01 || sd->cmd_rcv[0] == 0x02) {
 				if (sd->cmd_rcv[0] == 0x01) {
@@ -2565,6 +3210,8 @@ sd_tick(sim_t *sp)
 						"\x13\x24\x35\x46\x57\x68\x79\x8a\x9b\xac\xbd\xce\xdf\xe0\xf1\x02\x13",
 						17);
 				}
+				txlog_write(txl, TX_SD_RESP, 0, sd->sndbuf,
+					sd->sndbits / 8);
 				sd->cmd_state = SDC_SND_DELAY;
 				sd->bitcnt = 0;
 			} else {
@@ -2591,6 +3238,31 @@ printf("send bit %d at cnt %d sndbuf[0]=%02x\n", !!(sd->sndbuf[sd->bitcnt / 8] &
 	}
 }
 
+/* the card only acts on clock edges */
+static uint64_t
+sd_tick(sim_t *sp, void *arg)
+{
+	sd_clk(sp, (sd_t *)arg);
+
+	return SCHED_NEVER;
+}
+
+static void
+sd_attach(sim_t *sp, sd_t *sd)
+{
+	sp->sd = sd;
+	sd->se = sched_add(sp, "sd", sd_tick, sd, PROF_SD);
+	sched_sense(sd->se, sd->clk);
+}
+
+static void
+sd_detach(sim_t *sp)
+{
+	sched_remove(sp, sp->sd->se);
+	sp->sd->se = NULL;
+	sp->sd = NULL;
+}
+
 static void
 test_sd(sim_t *sp)
 {
@@ -2674,22 +3346,22 @@ test_sd(sim_t *sp)
 	watch_add(sp->wp, "u_sdc.u_sd_out_fifo.ram", "ramout", NULL, FORM_HEX, WF_ALL);
 #endif
 
-	sp->sd = &sd;
+	sd_attach(sp, &sd);
 
 	/* set clkdiv and enable clock */
-	uart_send_vlq_and_wait(sp, -3, CMD_SD_QUEUE, 0, 3, 0x83, 0x21, 0x90);
+	uart_send_cmd_and_wait<CMD_SD_QUEUE>(sp, 0, 0x83, 0x21, 0x90);
 	delay(sp, 100);
         if (tb->conan__DOT__u_command__DOT__u_sd__DOT__gensd__BRA__0__KET____DOT__u_sdc__DOT__clkdiv != 0x321)
 		fail("failed to set clkdiv\n");
 	/* TODO: test clock divider */
 	/* disable clock, set clkdiv to 120 and enable clock */
-	uart_send_vlq_and_wait(sp, -3, CMD_SD_QUEUE, 0, 4, 0xa0, 0x80, 120, 0x90);
+	uart_send_cmd_and_wait<CMD_SD_QUEUE>(sp, 0, 0xa0, 0x80, 120, 0x90);
 	delay(sp, 100);
         if (tb->conan__DOT__u_command__DOT__u_sd__DOT__gensd__BRA__0__KET____DOT__u_sdc__DOT__clkdiv != 120)
 		fail("failed to set clkdiv to 120\n");
 
 	for (i = 0; i < 2; ++i) {
-		uart_send_vlq_and_wait(sp, -3, CMD_SD_QUEUE, 0, 7, 0x10, 0x11, 0x22, 0x33, 0x44, 0x55, 0x67);
+		uart_send_cmd_and_wait<CMD_SD_QUEUE>(sp, 0, 0x10, 0x11, 0x22, 0x33, 0x44, 0x55, 0x67);
 
 		while (sd.cmd_rcv_ready == 0)
 			yield(sp);
@@ -2701,7 +3373,7 @@ test_sd(sim_t *sp)
 
 	for (i = 0; i < 2; ++i) {
 		/* send with 48 bit response */
-		uart_send_vlq_and_wait(sp, -3, CMD_SD_QUEUE, 0, 7, 0x11, 0x01, 0x22, 0x33, 0x44, 0x55, 0x67);
+		uart_send_cmd_and_wait<CMD_SD_QUEUE>(sp, 0, 0x11, 0x01, 0x22, 0x33, 0x44, 0x55, 0x67);
 
 		wait_for_uart_vlq(sp, -3, rsp);
 
@@ -2726,7 +3398,7 @@ test_sd(sim_t *sp)
 
 	for (i = 0; i < 2; ++i) {
 		/* send with 136 bit response */
-		uart_send_vlq_and_wait(sp, -3, CMD_SD_QUEUE, 0, 7, 0x12, 0x02, 0x22, 0x33, 0x44, 0x55, 0x67);
+		uart_send_cmd_and_wait<CMD_SD_QUEUE>(sp, 0, 0x12, 0x02, 0x22, 0x33, 0x44, 0x55, 0x67);
 
 		delay(sp, 1000);
 		wait_for_uart_vlq(sp, -3, rsp);
@@ -2755,7 +3427,7 @@ test_sd(sim_t *sp)
 	}
 
 	for (i = 0; i < 2; ++i) {
-		uart_send_vlq_and_wait(sp, -3, CMD_SD_QUEUE, 0, 7, 0x11, 0x11, 0x22, 0x33, 0x44, 0x55, 0x67);
+		uart_send_cmd_and_wait<CMD_SD_QUEUE>(sp, 0, 0x11, 0x11, 0x22, 0x33, 0x44, 0x55, 0x67);
 
 		delay(sp, 1000);
 		wait_for_uart_vlq(sp, -3, rsp);
@@ -2774,7 +3446,7 @@ test_sd(sim_t *sp)
 			fail("bad rsp cmd (not timeout)\n");
 	}
 
-	sp->sd = NULL;
+	sd_detach(sp);
 }
 
 #define ETH_IDLE	0
@@ -2782,14 +3454,19 @@ test_sd(sim_t *sp)
 #define ETH_RECV_1	2
 #define ETH_RECV_2	3
 #define ETH_SEND	4
+
 static void
-ether_tick(sim_t *sp)
+mdio_txlog(int op, int phy, int reg, uint16_t data)
 {
-	ether_t *eth = sp->ether;
+	uint8_t d[5] = { (uint8_t)op, (uint8_t)phy, (uint8_t)reg,
+		(uint8_t)(data & 0xff), (uint8_t)(data >> 8) };
 
-	if (eth == NULL)
-		return;
+	txlog_write(txl, TX_MDIO, 0, d, sizeof(d));
+}
 
+static void
+ether_mdc(sim_t *sp, ether_t *eth)
+{
 	if (eth->last_clk == *eth->mdc)
 		return;
 	eth->last_clk = *eth->mdc;
@@ -2799,7 +3476,7 @@ ether_tick(sim_t *sp)
 
 	if (eth->state == ETH_IDLE) {
 		if (*eth->mdio_en == 1 && *eth->mdio == 1) {
-			printf("preamble starts\n");
+			LOG(LOGC_ETHER, LOG_DEBUG, "preamble starts\n");
 			eth->preamble_bits = 0;
 			eth->state = ETH_PREAMBLE;
 		}
@@ -2808,18 +3485,19 @@ ether_tick(sim_t *sp)
 			fail("output disabled during preamble\n");
 		}
 		if (*eth->mdio == 0) {
-			printf("start bit received\n");
+			LOG(LOGC_ETHER, LOG_DEBUG, "start bit received\n");
 			eth->state = ETH_RECV_1;
 			eth->bitcnt = 13;
 			eth->rcvbuf = 0;
 		} else {
 			++eth->preamble_bits;
-			printf("preamble bit %d received\n", eth->preamble_bits);
+			LOG(LOGC_ETHER, LOG_DEBUG, "preamble bit %d received\n",
+				eth->preamble_bits);
 		}
 	} else if (eth->state == ETH_RECV_1 && *eth->mdc == 1) {
 		eth->rcvbuf = (eth->rcvbuf << 1) | *eth->mdio;
 		if (--eth->bitcnt == 0) {
-			printf("received %llx\n", eth->rcvbuf);
+			LOG(LOGC_ETHER, LOG_DEBUG, "received %llx\n", eth->rcvbuf);
 			if ((eth->rcvbuf & 0x1000) == 0) {
 				fail("SOF marker bad\n");
 			}
@@ -2830,6 +3508,7 @@ ether_tick(sim_t *sp)
 				if (eth->phy != 1)
 					fail("bad phy received\n");
 				eth->sndbuf = eth->regs[eth->reg];
+				mdio_txlog(2, eth->phy, eth->reg, eth->sndbuf);
 				eth->bitcnt = 18;
 				eth->state = ETH_SEND;
 			} else if ((eth->rcvbuf & 0xc00) == 0x400) {
@@ -2842,21 +3521,23 @@ ether_tick(sim_t *sp)
 		}
 	} else if (eth->state == ETH_RECV_2 && *eth->mdc == 1) {
 		eth->rcvbuf = (eth->rcvbuf << 1) | *eth->mdio;
-printf("bitcnt %d\n", eth->bitcnt);
+		LOG(LOGC_ETHER, LOG_DEBUG, "bitcnt %d\n", eth->bitcnt);
 		if (--eth->bitcnt == 0) {
-			printf("write received %llx\n", eth->rcvbuf);
+			LOG(LOGC_ETHER, LOG_DEBUG, "write received %llx\n", eth->rcvbuf);
 			eth->state = ETH_IDLE;
 			eth->phy = (eth->rcvbuf >> 23) & 0x1f;
 			eth->reg = (eth->rcvbuf >> 18) & 0x1f;
 			eth->data = eth->rcvbuf & 0xffff;
 			eth->regs[eth->reg] = eth->data;
+			mdio_txlog(1, eth->phy, eth->reg, eth->data);
 		}
 	} else if (eth->state == ETH_SEND && *eth->mdc == 0) {
 		*eth->mdio_in = !!(eth->sndbuf & 0x20000);
 		eth->sndbuf <<= 1;
-printf("snd bitcnt %d buf %x\n", eth->bitcnt, eth->sndbuf);
+		LOG(LOGC_ETHER, LOG_DEBUG, "snd bitcnt %d buf %x\n", eth->bitcnt,
+			eth->sndbuf);
 		if (--eth->bitcnt == 0) {
-			printf("send done\n");
+			LOG(LOGC_ETHER, LOG_DEBUG, "send done\n");
 			eth->state = ETH_IDLE;
 			eth->phy = 0;
 			eth->reg = 0;
@@ -2865,6 +3546,31 @@ printf("snd bitcnt %d buf %x\n", eth->bitcnt, eth->sndbuf);
 	}
 }
 
+/* the mdio side only acts on mdc edges */
+static uint64_t
+ether_tick(sim_t *sp, void *arg)
+{
+	ether_mdc(sp, (ether_t *)arg);
+
+	return SCHED_NEVER;
+}
+
+static void
+ether_attach(sim_t *sp, ether_t *eth)
+{
+	sp->ether = eth;
+	eth->se = sched_add(sp, "ether", ether_tick, eth, PROF_ETHER);
+	sched_sense(eth->se, eth->mdc);
+}
+
+static void
+ether_detach(sim_t *sp)
+{
+	sched_remove(sp, sp->ether->se);
+	sp->ether->se = NULL;
+	sp->ether = NULL;
+}
+
 static int
 get_packet(sim_t *sp, ether_t *eth, uint32_t *ret_data, int ret_max)
 {
@@ -2902,10 +3608,11 @@ get_packet(sim_t *sp, ether_t *eth, uint32_t *ret_data, int ret_max)
 		fail("packet too long\n");
 	plen = i;
 
-	printf("PACKET (%d): ", plen);
+	txlog_write(txl, TX_RMII, 0, p, plen);
+	LOG(LOGC_ETHER, LOG_DEBUG, "PACKET (%d): ", plen);
 	for (i = 0; i < plen; ++i)
-		printf("%02x ", p[i]);
-	printf("\n");
+		LOG(LOGC_ETHER, LOG_DEBUG, "%02x ", p[i]);
+	LOG(LOGC_ETHER, LOG_DEBUG, "\n");
 
 	/* check IPG */
 	for (i = 0; i < 12 * 4; ++i) {
@@ -2936,19 +3643,8 @@ get_packet(sim_t *sp, ether_t *eth, uint32_t *ret_data, int ret_max)
 		fail("seq %d != %d\n", ntohl(buf[5]) & 0xffff, *seq);
 #endif
 
-	/* calculate crc */
-	uint32_t crc = 0xffffffff;
-	for (i = 8; i < plen - 4; ++i) {
-		unsigned int byte, mask;
-
-		byte = p[i];
-		crc = crc ^ byte;
-		for (j = 7; j >= 0; j--) {
-			mask = -(crc & 1);
-			crc = (crc >> 1) ^ (0xEDB88320 & mask);
-		}
-	}
-	crc = ~crc;
+	/* fcs over everything after the preamble */
+	uint32_t crc = crc32(p + 8, plen - 12);
 	uint32_t recv_crc = buf[plen / 4 - 1]; /* no bswap */
 	if (recv_crc != crc)
 		fail("crc differ: recv %08x calc %08x\n", recv_crc, crc);
@@ -2963,6 +3659,31 @@ get_packet(sim_t *sp, ether_t *eth, uint32_t *ret_data, int ret_max)
 	return rlen;
 }
 
+/*
+ * the next frame, split by sp->daq into its records. Only the records of
+ * this frame are queued, the signal data points into buf
+ */
+static daq_demux_t *
+get_daq_packet(sim_t *sp, ether_t *eth, uint32_t *buf, int max)
+{
+	daq_demux_t *dm = sp->daq;
+	int len = get_packet(sp, eth, buf, max);
+	int i;
+
+	daq_demux_flush(dm);
+	if (daq_demux_frame(dm, buf, len) < 0)
+		fail("bad daq packet: %s\n", daq_demux_error(dm));
+	for (i = 0; i < DAQS_N; ++i) {
+		const daq_rec_t *r = daq_peek(dm, i);
+
+		if (r != NULL)
+			LOG(LOGC_ETHER, LOG_DEBUG, "daq %s: %d records\n",
+				daq_type_name(r->type), daq_pending(dm, i));
+	}
+
+	return dm;
+}
+
 static void
 test_ether(sim_t *sp)
 {
@@ -3005,10 +3726,10 @@ test_ether(sim_t *sp)
 	watch_add(sp->wp, "u_ether.bitcnt", "bitcnt", NULL, FORM_DEC, WF_ALL);
 	watch_add(sp->wp, "u_ether.bitdata", "bitdata", NULL, FORM_BIN, WF_ALL);
 
-	sp->ether = &eth;
+	ether_attach(sp, &eth);
 
 	/* check register is preset value */
-	uart_send_vlq(sp, 4, CMD_ETHER_MD_READ, 0, 1, 10);
+	uart_send_cmd<CMD_ETHER_MD_READ>(sp, 0, 1, 10);
 	wait_for_uart_vlq(sp, 3, rsp);
 	if (rsp[0] != RSP_ETHER_MD_READ)
 		fail("ether read failed\n");
@@ -3018,13 +3739,13 @@ test_ether(sim_t *sp)
 		fail("ether read bad register content %x\n", rsp[2]);
 
 	/* change register */
-	uart_send_vlq_and_wait(sp, 5, CMD_ETHER_MD_WRITE, 0, 1, 10, 0x1234);
+	uart_send_cmd_and_wait<CMD_ETHER_MD_WRITE>(sp, 0, 1, 10, 0x1234);
 	delay(sp, 20000);
 	if (eth.phy != 1 || eth.reg != 10 || eth.data != 0x1234)
 		fail("mdc did not receive correctly\n");
 
 	/* check changed content */
-	uart_send_vlq(sp, 4, CMD_ETHER_MD_READ, 0, 1, 10);
+	uart_send_cmd<CMD_ETHER_MD_READ>(sp, 0, 1, 10);
 	wait_for_uart_vlq(sp, 3, rsp);
 	if (rsp[0] != RSP_ETHER_MD_READ)
 		fail("ether read failed\n");
@@ -3033,7 +3754,7 @@ test_ether(sim_t *sp)
 	if (rsp[2] != 0x1234)
 		fail("ether read bad register content %x\n", rsp[2]);
 
-	uart_send_vlq_and_wait(sp, 6, CMD_CONFIG_ETHER, 0, 0x12345678, 0x9abc6655, 0x44332211, 0x5139);
+	uart_send_cmd_and_wait<CMD_CONFIG_ETHER>(sp, 0, 0x12345678, 0x9abc6655, 0x44332211, 0x5139);
 	delay(sp, 1000);
 	/* check mac addresses */
 	printf("src_mac %llx\n", tb->conan__DOT__u_command__DOT__u_ether__DOT__src_mac);
@@ -3068,13 +3789,13 @@ test_ether(sim_t *sp)
 	watch_add(sp->wp, "mculog_u.state", "m_state", NULL, FORM_DEC, WF_ALL);
 
 	/* drain existing packets */
-	uart_send_vlq_and_wait(sp, 3, CMD_ETHER_SET_STATE, 0, 1);
+	uart_send_cmd_and_wait<CMD_ETHER_SET_STATE>(sp, 0, 1);
 	delay(sp, 20000);
 
-	uart_send_vlq_and_wait(sp, 3, CMD_ETHER_SET_STATE, 0, 2); /* set running */
+	uart_send_cmd_and_wait<CMD_ETHER_SET_STATE>(sp, 0, 2); /* set running */
 	/* send something to the mcu to get some logging */
 	delay(sp, 10);
-	uart_send_vlq(sp, 1, CMD_GET_VERSION);
+	uart_send_cmd<CMD_GET_VERSION>(sp);
 	wait_for_uart_vlq(sp, 6, rsp);
 
 	len = get_packet(sp, &eth, buf, sizeof(buf) / sizeof(*buf));
@@ -3109,68 +3830,964 @@ test_ether(sim_t *sp)
 	delay(sp, 25000000);
 #endif
 	watch_clear(sp->wp);
-	sp->ether = NULL;
+	ether_detach(sp);
 }
 
+/*
+ * checkpoints: the verilated model plus the state of the host link BFMs.
+ * They are only taken between stages, when no test task is running and
+ * all other BFMs are detached, so nothing else needs to be saved
+ */
+#define CKPT_MAGIC	0x6b636e63	/* "cnck" */
+#define CKPT_VERSION	2
+
+typedef struct {
+	uint32_t	magic;
+	uint32_t	version;
+	char		stage[32];	/* stage completed before the save */
+	uint64_t	cycle;
+	uint64_t	last_change;
+	uint64_t	watch_cycle;
+	/* host link sender */
+	int32_t		us_cnt;
+	int32_t		us_bit;
+	int32_t		us_pos;
+	int32_t		us_len;
+	int32_t		us_seq;
+	uint8_t		us_byte;
+	uint8_t		us_buf[MAXPACKET];
+	/* host link receiver */
+	int32_t		ur_cnt;
+	int32_t		ur_bit;
+	int32_t		ur_pos;
+	int32_t		ur_expected_seq;
+	uint8_t		ur_byte;
+	uint8_t		ur_buf[MAXPACKET];
+} ckpt_hdr_t;
+
+#ifndef NO_SAVABLE
 static void
-test(sim_t *sp)
+checkpoint_save(sim_t *sp, const char *path, const char *stage)
 {
-	delay(sp, 1);	/* pass back control after initialization */
+	uart_send_t *usp = sp->usp;
+	uart_recv_t *urp = sp->urp;
+	ckpt_hdr_t hdr;
+	VerilatedSave os;
+
+	if (sp->tasks != NULL && sp->tasks->next != NULL)
+		fail("checkpoint with more than one task running\n");
+	if (sp->link_owner != NULL && sp->link_owner != sp->current)
+		fail("checkpoint while the host link is busy\n");
+	if (sp->pipe != NULL)
+		fail("checkpoint while the host link is pipelined\n");
+	if (sp->frx->first != NULL || sp->frx->head != sp->frx->tail)
+		fail("checkpoint with frames from the fpga pending\n");
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = CKPT_MAGIC;
+	hdr.version = CKPT_VERSION;
+	snprintf(hdr.stage, sizeof(hdr.stage), "%s", stage);
+	hdr.cycle = sp->cycle;
+	hdr.last_change = sp->last_change;
+	hdr.watch_cycle = sp->wp->last_cycle;
+	hdr.us_cnt = usp->cnt;
+	hdr.us_bit = usp->bit;
+	hdr.us_pos = usp->pos;
+	hdr.us_len = usp->len;
+	hdr.us_seq = usp->seq;
+	hdr.us_byte = usp->byte;
+	memcpy(hdr.us_buf, usp->buf, sizeof(hdr.us_buf));
+	hdr.ur_cnt = urp->cnt;
+	hdr.ur_bit = urp->bit;
+	hdr.ur_pos = urp->pos;
+	hdr.ur_expected_seq = sp->frx->expected_seq;
+	hdr.ur_byte = urp->byte;
+	memcpy(hdr.ur_buf, urp->buf, sizeof(hdr.ur_buf));
+
+	os.open(path);
+	if (!os.isOpen())
+		fail("failed to open checkpoint %s\n", path);
+	os.write(&hdr, sizeof(hdr));
+	os << *sp->tb;
+	os.close();
+
+	printf("saved checkpoint %s after %s at cycle %ld\n", path, stage,
+		sp->cycle);
+}
+
+static void
+checkpoint_restore(sim_t *sp, const char *path)
+{
+	uart_send_t *usp = sp->usp;
+	uart_recv_t *urp = sp->urp;
+	ckpt_hdr_t hdr;
+	VerilatedRestore os;
+
+	os.open(path);
+	if (!os.isOpen()) {
+		printf("failed to open checkpoint %s\n", path);
+		exit(1);
+	}
+	os.read(&hdr, sizeof(hdr));
+	if (hdr.magic != CKPT_MAGIC || hdr.version != CKPT_VERSION) {
+		printf("%s is not a checkpoint of this testbench\n", path);
+		exit(1);
+	}
+	os >> *sp->tb;
+	os.close();
+	/* the link mode is chosen per run, not per checkpoint */
+	sp->tb->tlm_en = tlm;
+
+	hdr.stage[sizeof(hdr.stage) - 1] = 0;
+	sp->restored = strdup(hdr.stage);
+	sp->cycle = hdr.cycle;
+	sp->last_change = hdr.last_change;
+	sp->wp->last_cycle = hdr.watch_cycle;
+	usp->cnt = hdr.us_cnt;
+	usp->bit = hdr.us_bit;
+	usp->pos = hdr.us_pos;
+	usp->len = hdr.us_len;
+	usp->seq = hdr.us_seq;
+	usp->byte = hdr.us_byte;
+	memcpy(usp->buf, hdr.us_buf, sizeof(usp->buf));
+	urp->cnt = hdr.ur_cnt;
+	urp->bit = hdr.ur_bit;
+	urp->pos = hdr.ur_pos;
+	sp->frx->expected_seq = hdr.ur_expected_seq;
+	urp->byte = hdr.ur_byte;
+	memcpy(urp->buf, hdr.ur_buf, sizeof(urp->buf));
+
+	printf("restored checkpoint %s after %s at cycle %ld\n", path,
+		sp->restored, sp->cycle);
+}
+#else
+/* the multithreaded models are built without --savable */
+static void
+checkpoint_save(sim_t *sp, const char *path, const char *stage)
+{
+	fail("no checkpoints, the model is not savable\n");
+}
+
+static void
+checkpoint_restore(sim_t *sp, const char *path)
+{
+	printf("no checkpoints, the model is not savable\n");
+	exit(1);
+}
+#endif
 
+/*
+ * waveform traces, selected per test with --trace
+ */
+#define MAXGROUPS	16
+static const char *trace_tests;
+static const char *trace_dir = ".";
+static const char *trace_groups[MAXGROUPS];
+static int trace_ngroups;
+
+static int
+name_in_list(const char *list, const char *name)
+{
+	int len = strlen(name);
+	const char *p = list;
+
+	if (strcmp(list, "all") == 0)
+		return 1;
+	while (p != NULL && *p) {
+		if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == 0))
+			return 1;
+		p = strchr(p, ',');
+		if (p != NULL)
+			++p;
+	}
+
+	return 0;
+}
+
+static void
+trace_begin(sim_t *sp, const char *name)
+{
+	char path[1024];
+
+	if (trace_tests == NULL || !name_in_list(trace_tests, name))
+		return;
+	/* a window opened by --trace-when is still running */
+	if (sp->wp->trace != NULL)
+		return;
+	snprintf(path, sizeof(path), "%s/trace_%s.fst", trace_dir, name);
+	watch_trace_start(sp->wp, path, "conan", 1000000000000ull / HZ,
+		trace_groups, trace_ngroups);
+}
+
+static void
+trace_end(sim_t *sp)
+{
+	watch_trace_stop(sp->wp);
+}
+
+/*
+ * triggers from the command line. Each one traces while its expression
+ * is true, dumps the flight recorder or fails the test when it becomes
+ * true
+ */
+#define MAXTRIGGERS	16
+typedef struct _whendef {
+	const char	*expr;
+	trigger_fn_t	fn;
+} whendef_t;
+static whendef_t whendefs[MAXTRIGGERS];
+static int nwhendefs;
+static int trace_by_trigger;
+
+static void
+when_trace(trigger_t *tp, int level, uint64_t cycle, void *arg)
+{
+	sim_t *sp = (sim_t *)arg;
+	char path[1024];
+
+	if (level && sp->wp->trace == NULL) {
+		snprintf(path, sizeof(path), "%s/trace_at_%lu.fst", trace_dir,
+			cycle);
+		watch_trace_start(sp->wp, path, "conan", 1000000000000ull / HZ,
+			trace_groups, trace_ngroups);
+		trace_by_trigger = 1;
+	} else if (!level && trace_by_trigger) {
+		watch_trace_stop(sp->wp);
+		trace_by_trigger = 0;
+	}
+}
+
+static void
+when_snapshot(trigger_t *tp, int level, uint64_t cycle, void *arg)
+{
+	char prefix[1024];
+
+	if (!level)
+		return;
+	snprintf(prefix, sizeof(prefix), "%s_%lu", record_out, cycle);
+	recorder_dump(flight, prefix, "conan", 1000000000000ull / HZ);
+}
+
+static void
+when_break(trigger_t *tp, int level, uint64_t cycle, void *arg)
+{
+	if (level)
+		fail("breakpoint %s hit at cycle %lu\n", tp->expr, cycle);
+}
+
+static void
+when_add(const char *expr, trigger_fn_t fn)
+{
+	if (nwhendefs == MAXTRIGGERS) {
+		printf("too many triggers\n");
+		exit(1);
+	}
+	whendefs[nwhendefs].expr = expr;
+	whendefs[nwhendefs].fn = fn;
+	++nwhendefs;
+}
+
+static void
+when_arm(sim_t *sp)
+{
+	int i;
+
+	for (i = 0; i < nwhendefs; ++i)
+		watch_trigger(sp->wp, whendefs[i].expr, whendefs[i].expr,
+			whendefs[i].fn, sp);
+}
+
+/*
+ * run one stage of the sequential test, unless the model was restored
+ * from a checkpoint taken after it
+ */
+static void
+stage(sim_t *sp, const char *name, void (*fn)(sim_t *sp))
+{
+	char path[1024];
+
+	if (sp->restored != NULL) {
+		if (strcmp(sp->restored, name) == 0)
+			sp->restored = NULL;
+		return;
+	}
+	prof_section(name);
+	trace_begin(sp, name);
+	fn(sp);
+	trace_end(sp);
+	if (sp->ckpt_prefix != NULL) {
+		snprintf(path, sizeof(path), "%s_%s.ckpt", sp->ckpt_prefix,
+			name);
+		checkpoint_save(sp, path, name);
+	}
+}
+
+static void
+test_bringup(sim_t *sp)
+{
 	test_time(sp);	/* always needed as time sync */
 	test_version(sp);
-	test_ether(sp);
+}
+
+static void
+test_pwm_gpio(sim_t *sp)
+{
+	task_t *group[2];
+
+	/*
+	 * pwm and gpio use independent pins and expect no responses, so they
+	 * can share the time they spend waiting
+	 */
+	group[0] = spawn(sp, test_pwm, "pwm");
+	group[1] = spawn(sp, test_gpio, "gpio");
+	join(sp, group, 2);
+}
+
+static void
+test(sim_t *sp)
+{
+	stage(sp, "bringup", test_bringup);
+	stage(sp, "ether", test_ether);
 #if 0
-	test_sd(sp);
+	stage(sp, "sd", test_sd);
 #endif
-	test_pwm(sp);
-	test_gpio(sp);
-	test_tmcuart(sp);
-	test_signal(sp);
-	test_drain(sp);
-	test_abz(sp);
-	test_dro(sp);
-	test_as5311(sp);
-	test_biss(sp);
+	stage(sp, "pwm_gpio", test_pwm_gpio);
+	stage(sp, "tmcuart", test_tmcuart);
+	stage(sp, "signal", test_signal);
+	stage(sp, "drain", test_drain);
+	stage(sp, "abz", test_abz);
+	stage(sp, "dro", test_dro);
+	stage(sp, "as5311", test_as5311);
+	stage(sp, "biss", test_biss);
 	/* must be last, as it ends with a shutdown */
+	prof_section("stepper");
+	trace_begin(sp, "stepper");
 	test_stepper(sp);
+	trace_end(sp);
+
+	if (sp->restored != NULL)
+		fail("checkpoint stage %s unknown\n", sp->restored);
 
 	printf("test succeeded after %d cycles\n", sp->cycle);
 
 	exit(0);
 }
 
-int
-main(int argc, char **argv) {
-	// Initialize Verilators variables
-	Verilated::commandArgs(argc, argv);
+/*
+ * sharded runner: every selected test runs in its own process with its
+ * own model. A first process runs the bring-up and the ethernet setup
+ * and leaves checkpoints of both, the shards start from these. The
+ * parent only collects the results
+ */
+#define T_ETHER		1	/* needs ethernet configured and running */
+#define T_OPTIONAL	2	/* not part of "all" */
+
+typedef struct {
+	const char	*name;
+	void		(*fn)(sim_t *sp);
+	int		flags;
+} testdef_t;
+
+static testdef_t tests[] = {
+	{ "version",	test_version,	0 },
+	{ "ether",	test_ether,	0 },
+	{ "sd",		test_sd,	T_OPTIONAL },
+	{ "pwm",	test_pwm,	0 },
+	{ "gpio",	test_gpio,	0 },
+	{ "tmcuart",	test_tmcuart,	0 },
+	{ "signal",	test_signal,	T_ETHER },
+	{ "drain",	test_drain,	T_ETHER },
+	{ "abz",	test_abz,	T_ETHER },
+	{ "dro",	test_dro,	T_ETHER },
+	{ "as5311",	test_as5311,	T_ETHER },
+	{ "biss",	test_biss,	0 },
+	{ "stepper",	test_stepper,	0 },
+	{ "dispatch",	test_dispatch,	T_OPTIONAL },
+	{ "pipeline",	test_pipeline,	T_OPTIONAL },
+	{ "link",	test_link,	T_OPTIONAL },
+};
+#define NTESTS (sizeof(tests) / sizeof(*tests))
+
+typedef struct {
+	testdef_t	*td;
+	pid_t		pid;
+	int		fd;		/* result pipe */
+	int		status;		/* 0 pending, 1 passed, -1 failed */
+	uint64_t	cycles;
+	double		wall;
+	struct timespec	start;
+} shard_t;
+
+static testdef_t *shard_test;
+static int shard_fd = -1;
+/* read ends of running shards, a fork without exec inherits them */
+static fd_set shard_rfds;
+static char shard_ckpt[2][1024];	/* after bring-up, after ether */
+
+static double
+elapsed(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void
+shard_main(sim_t *sp)
+{
+	uint64_t cycles;
+
+	prof_section("bringup");
+	if (sp->restored == NULL)
+		test_time(sp);	/* always needed as time sync */
+	if ((shard_test->flags & T_ETHER) &&
+	    (sp->restored == NULL || strcmp(sp->restored, "ether") != 0)) {
+		prof_section("ether");
+		test_ether(sp);
+	}
+	sp->restored = NULL;
+	prof_section(shard_test->name);
+	trace_begin(sp, shard_test->name);
+	shard_test->fn(sp);
+	trace_end(sp);
+
+	printf("test succeeded after %d cycles\n", sp->cycle);
+	fflush(stdout);
+
+	cycles = sp->cycle;
+	if (write(shard_fd, &cycles, sizeof(cycles)) != sizeof(cycles))
+		exit(1);
+
+	exit(0);
+}
+
+/*
+ * first shard, prepares the checkpoints for the others
+ */
+static void
+shard_prepare(sim_t *sp)
+{
+	uint64_t cycles;
+
+	prof_section("bringup");
+	test_bringup(sp);
+	checkpoint_save(sp, shard_ckpt[0], "bringup");
+	prof_section("ether");
+	test_ether(sp);
+	checkpoint_save(sp, shard_ckpt[1], "ether");
+
+	cycles = sp->cycle;
+	if (write(shard_fd, &cycles, sizeof(cycles)) != sizeof(cycles))
+		exit(1);
+
+	exit(0);
+}
+
+static void simulate(void (*fn)(sim_t *sp), int fast_forward,
+	const char *restore);
+
+static void
+shard_start(shard_t *sh, const char *log_dir, int fast_forward,
+	const char *restore)
+{
+	char path[1024];
+	int fds[2];
+
+	if (pipe(fds) != 0) {
+		printf("pipe failed\n");
+		exit(1);
+	}
+	fflush(stdout);
+	clock_gettime(CLOCK_MONOTONIC, &sh->start);
+	sh->pid = fork();
+	if (sh->pid < 0) {
+		printf("fork failed\n");
+		exit(1);
+	}
+	if (sh->pid == 0) {
+		int fd;
+
+		close(fds[0]);
+		for (fd = 0; fd < FD_SETSIZE; ++fd)
+			if (FD_ISSET(fd, &shard_rfds))
+				close(fd);
+		snprintf(path, sizeof(path), "%s/vrun_%s.log", log_dir,
+			sh->td ? sh->td->name : "prepare");
+		if (freopen(path, "w", stdout) == NULL) {
+			fprintf(stderr, "failed to open %s\n", path);
+			exit(1);
+		}
+		color_disabled = 1;
+		if (prof.file != NULL) {
+			/* every shard writes its own profile */
+			snprintf(path, sizeof(path), "%s/profile_%s.json",
+				log_dir, sh->td ? sh->td->name : "prepare");
+			prof_init(strdup(path));
+		}
+		snprintf(path, sizeof(path), "%s/flight_%s", log_dir,
+			sh->td ? sh->td->name : "prepare");
+		record_out = strdup(path);
+		if (txlog_file != NULL) {
+			snprintf(path, sizeof(path), "%s/txlog_%s.bin",
+				log_dir, sh->td ? sh->td->name : "prepare");
+			txlog_file = strdup(path);
+		}
+		shard_test = sh->td;
+		shard_fd = fds[1];
+		simulate(sh->td ? shard_main : shard_prepare, fast_forward,
+			restore);
+		/* not reached */
+	}
+	close(fds[1]);
+	sh->fd = fds[0];
+	FD_SET(sh->fd, &shard_rfds);
+	printf("started %s (pid %d)\n", sh->td ? sh->td->name : "prepare",
+		sh->pid);
+}
+
+static int
+shard_wait(shard_t *sh)
+{
+	int status;
+
+	if (waitpid(sh->pid, &status, 0) < 0) {
+		printf("wait failed\n");
+		exit(1);
+	}
+	sh->wall = elapsed(&sh->start);
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+	    read(sh->fd, &sh->cycles, sizeof(sh->cycles)) ==
+	    sizeof(sh->cycles))
+		sh->status = 1;
+	else
+		sh->status = -1;
+	FD_CLR(sh->fd, &shard_rfds);
+	close(sh->fd);
+
+	return sh->status;
+}
+
+static int
+run_shards(const char *list, int jobs, const char *log_dir, int fast_forward)
+{
+	shard_t shards[NTESTS];
+	shard_t prep;
+	struct timespec start;
+	int nshards = 0;
+	int next = 0;
+	int running = 0;
+	int failed = 0;
+	uint64_t total = 0;
+	uint64_t longest = 0;
+	int i;
+
+#ifdef NO_SAVABLE
+	printf("shards start from checkpoints, the model is not savable\n");
+	return 1;
+#endif
+	if (jobs <= 0)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+	memset(shards, 0, sizeof(shards));
+	for (i = 0; i < NTESTS; ++i) {
+		testdef_t *td = tests + i;
+		int selected;
+
+		if (strcmp(list, "all") == 0)
+			selected = !(td->flags & T_OPTIONAL);
+		else
+			selected = name_in_list(list, td->name);
+		if (selected)
+			shards[nshards++].td = td;
+	}
+	if (nshards == 0) {
+		printf("no test matches %s\n", list);
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	prof.on = 0;	/* nothing to profile in the parent */
+
+	/* bring-up is common to all, run it only once */
+	snprintf(shard_ckpt[0], sizeof(shard_ckpt[0]), "%s/bringup.ckpt",
+		log_dir);
+	snprintf(shard_ckpt[1], sizeof(shard_ckpt[1]), "%s/ether.ckpt",
+		log_dir);
+	memset(&prep, 0, sizeof(prep));
+	shard_start(&prep, log_dir, fast_forward, NULL);
+	if (shard_wait(&prep) < 0) {
+		printf("bring-up FAILED, see %s/vrun_prepare.log\n", log_dir);
+		return 1;
+	}
+	printf("bring-up done after %.1fs, %lu cycles\n", prep.wall,
+		prep.cycles);
+
+	while (next < nshards || running > 0) {
+		int status;
+		pid_t pid;
+
+		while (next < nshards && running < jobs) {
+			shard_t *sh = shards + next++;
+
+			shard_start(sh, log_dir, fast_forward,
+				shard_ckpt[(sh->td->flags & T_ETHER) ? 1 : 0]);
+			++running;
+		}
+
+		pid = wait(&status);
+		if (pid < 0) {
+			printf("wait failed\n");
+			exit(1);
+		}
+		for (i = 0; i < nshards; ++i)
+			if (shards[i].pid == pid && shards[i].status == 0)
+				break;
+		if (i == nshards)
+			continue;
+
+		shard_t *sh = shards + i;
+		sh->wall = elapsed(&sh->start);
+		if (WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+		    read(sh->fd, &sh->cycles, sizeof(sh->cycles)) ==
+		    sizeof(sh->cycles)) {
+			sh->status = 1;
+		} else {
+			sh->status = -1;
+		}
+		FD_CLR(sh->fd, &shard_rfds);
+		close(sh->fd);
+		--running;
+		printf("%s %s after %.1fs\n", sh->td->name,
+			sh->status > 0 ? "passed" : "FAILED", sh->wall);
+	}
+
+	printf("\n%-10s %-6s %14s %10s\n", "test", "result", "cycles", "wall");
+	for (i = 0; i < nshards; ++i) {
+		shard_t *sh = shards + i;
+
+		printf("%-10s %-6s %14lu %9.1fs\n", sh->td->name,
+			sh->status > 0 ? "pass" : "FAIL", sh->cycles, sh->wall);
+		if (sh->status < 0)
+			++failed;
+		total += sh->cycles;
+		if (sh->cycles > longest)
+			longest = sh->cycles;
+	}
+	printf("%d of %d tests passed, %lu cycles total, %lu longest, "
+		"%.1fs wall with %d jobs\n", nshards - failed, nshards, total,
+		longest, elapsed(&start), jobs);
+
+	return failed ? 1 : 0;
+}
+
+static const char *ckpt_prefix;
+
+/*
+ * benchmark mode: run the full test without fast-forward for a fixed
+ * number of cycles and report the simulation speed. The harness around
+ * eval() runs in one thread, so the speed of eval() alone, taken from
+ * the profiler, is reported as well. Only that one shows how the model
+ * scales with threads
+ */
+#ifndef BENCH_THREADS
+#define BENCH_THREADS 1
+#endif
+static uint64_t bench_cycles;
+static uint64_t bench_start_cycle;
+static uint64_t bench_end_cycle;
+static uint64_t bench_start_ticks;
+static uint64_t bench_start_eval;
+static struct timespec bench_start;
+
+static uint64_t
+bench_eval_ticks(void)
+{
+	uint64_t ticks = 0;
+	int i;
+
+	for (i = 0; i < prof.nsect; ++i)
+		ticks += prof.sect[i].comp[PROF_EVAL];
+
+	return ticks;
+}
+
+static void
+bench_report(void)
+{
+	uint64_t cycles = bench_end_cycle - bench_start_cycle;
+	double t = elapsed(&bench_start);
+	double hz = (prof_now() - bench_start_ticks) / t;
+	double te = (bench_eval_ticks() - bench_start_eval) / hz;
+
+	printf("bench: %d threads, %lu cycles in %.2fs, %.0f cycles/s, "
+		"eval %.2fs, %.0f cycles/s\n", BENCH_THREADS, cycles, t,
+		cycles / t, te, cycles / te);
+	fflush(stdout);
+}
+
+static void
+simulate(void (*fn)(sim_t *sp), int fast_forward, const char *restore)
+{
 	uint64_t cycle = 100000;
+	uint64_t ff_until = 0;
 	sim_t *sp;
 
 	// Create an instance of our module under test
 	Vconan *tb = new Vconan;
 
+	/* from here on, output is written by a separate thread */
+	log_start();
+
 	sp = init(tb);
+	sp->fast_forward = fast_forward;
+	sp->ckpt_prefix = ckpt_prefix;
+	if (restore != NULL) {
+		checkpoint_restore(sp, restore);
+		cycle = sp->cycle;
+	}
+	record_init(tb);
+	when_arm(sp);
+	if (txlog_file != NULL)
+		txl = txlog_open(txlog_file, &sp->cycle);
+	signal(SIGINT, record_sigint);
+	if (bench_cycles) {
+		/* times eval(), without writing a profile unless asked to */
+		if (!prof.on)
+			prof_init(NULL);
+		bench_start_cycle = bench_end_cycle = cycle;
+		bench_start_eval = bench_eval_ticks();
+		bench_start_ticks = prof_now();
+		clock_gettime(CLOCK_MONOTONIC, &bench_start);
+		/* also report if the test finishes early */
+		atexit(bench_report);
+	}
 
-	if (setjmp(sp->main_jb) == 0)
-		test(sp);	/* initialize test procedure */
-	/*
-	 * hack: this alloc reserves 64k of stack for test().
-	 * it prevents the region where the stack frame from test
-	 * resides from being overwritten
-	 */
-	alloca(65536);
+	spawn(sp, fn, "test");
 
 	// Tick the clock until we are done
 	while(!Verilated::gotFinish()) {
 		tb->clk_48mhz = 1;
-		tb->eval();
+		PROF(PROF_EVAL, tb->eval());
 		tb->clk_48mhz = 0;
-		tb->eval();
+		PROF(PROF_EVAL, tb->eval());
 		++cycle;
+		if (flight != NULL)
+			recorder_sample(flight, cycle);
+		if (interrupted) {
+			printf("interrupted at cycle %lu\n", cycle);
+			record_dump();
+			exit(1);
+		}
+		if (bench_cycles) {
+			bench_end_cycle = cycle;
+			if (cycle - bench_start_cycle >= bench_cycles)
+				exit(0);
+		}
+		if (cycle < ff_until && !ff_guard(sp)) {
+			/* nothing to do for the harness in this cycle */
+			sp->cycle = cycle;
+			prof.cycle = cycle;
+			continue;
+		}
 		step(sp, cycle);
 		/* push in values changed by step() */
-		tb->eval();
+		PROF(PROF_EVAL, tb->eval());
+		ff_until = ff_wake(sp);
 	}
 	exit(0);
 }
+
+static void
+usage(const char *name)
+{
+	printf("usage: %s [options]\n", name);
+	printf("  --no-fast-forward   step the harness every cycle\n");
+	printf("  --test=LIST         run the comma separated tests (or all)\n");
+	printf("                      each in its own process\n");
+	printf("  --jobs=N            number of tests to run in parallel\n");
+	printf("  --log-dir=DIR       where to put vrun_<test>.log and the\n");
+	printf("                      bring-up checkpoints\n");
+	printf("  --save-checkpoints=PREFIX\n");
+	printf("                      save PREFIX_<stage>.ckpt after each\n");
+	printf("                      stage of the sequential test\n");
+	printf("  --restore=FILE      continue the sequential test from a\n");
+	printf("                      checkpoint\n");
+	printf("  --profile=FILE      write the time spent per test and\n");
+	printf("                      component as JSON to FILE at exit,\n");
+	printf("                      shards use <log-dir>/profile_<test>.json\n");
+	printf("  --trace=LIST        write trace_<test>.fst with all watched\n");
+	printf("                      signals for the given tests (or all)\n");
+	printf("  --trace-group=REGEX also trace all signals matching REGEX\n");
+	printf("  --trace-dir=DIR     where to put the traces\n");
+	printf("  --trace-when=EXPR   trace while EXPR is true, into\n");
+	printf("                      trace_at_<cycle>.fst\n");
+	printf("  --snapshot-when=EXPR\n");
+	printf("                      dump the flight recorder to\n");
+	printf("                      PREFIX_<cycle> whenever EXPR becomes true\n");
+	printf("  --break-when=EXPR   fail as soon as EXPR becomes true\n");
+	printf("                      EXPR is over signals, e.g.\n");
+	printf("                      \"u_signal.state == 3 && rise(step1)\"\n");
+	printf("  --record=REGEX      keep signals matching REGEX in the\n");
+	printf("                      flight recorder instead of the default\n");
+	printf("                      set\n");
+	printf("  --record-depth=N    cycles kept by the flight recorder,\n");
+	printf("                      0 to disable it (default 4096)\n");
+	printf("  --record-out=PREFIX where the recorder is dumped on failure,\n");
+	printf("                      as PREFIX.txt and PREFIX.fst, shards\n");
+	printf("                      use <log-dir>/flight_<test>\n");
+	printf("  --txlog=FILE        write all BFM transactions to FILE, for\n");
+	printf("                      txdump. Shards use\n");
+	printf("                      <log-dir>/txlog_<test>.bin\n");
+	printf("  --tlm               transaction level host link, frames\n");
+	printf("                      bypass the UART, for command throughput\n");
+	printf("                      tests like dispatch\n");
+	printf("  --window=N          frames in flight for the pipelined\n");
+	printf("                      host, 1 to 15 (default 8)\n");
+	printf("  --log=CAT=LEVEL,... log level per category, LEVEL is err,\n");
+	printf("                      info (default) or debug, CAT is all or\n");
+	printf("                     ");
+	for (int i = 0; i < LOGC_NUM; ++i)
+		printf(" %s", log_names[i]);
+	printf("\n");
+	printf("  --bench=CYCLES      simulate CYCLES cycles of the test\n");
+	printf("                      without fast-forward, report speed\n");
+	printf("tests:");
+	for (int i = 0; i < NTESTS; ++i)
+		printf(" %s", tests[i].name);
+	printf("\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv) {
+	// Initialize Verilators variables
+	Verilated::commandArgs(argc, argv);
+	int fast_forward = 1;
+	const char *test_list = NULL;
+	const char *log_dir = ".";
+	const char *restore = NULL;
+	const char *prof_file = NULL;
+	int jobs = 0;
+	int c;
+
+	static struct option long_options[] = {
+		{ "no-fast-forward", no_argument, NULL, 'F' },
+		{ "test", required_argument, NULL, 't' },
+		{ "jobs", required_argument, NULL, 'j' },
+		{ "log-dir", required_argument, NULL, 'l' },
+		{ "save-checkpoints", required_argument, NULL, 's' },
+		{ "restore", required_argument, NULL, 'r' },
+		{ "bench", required_argument, NULL, 'b' },
+		{ "profile", required_argument, NULL, 'p' },
+		{ "trace", required_argument, NULL, 'T' },
+		{ "trace-group", required_argument, NULL, 'g' },
+		{ "trace-dir", required_argument, NULL, 'd' },
+		{ "trace-when", required_argument, NULL, 'w' },
+		{ "snapshot-when", required_argument, NULL, 'S' },
+		{ "break-when", required_argument, NULL, 'B' },
+		{ "log", required_argument, NULL, 'L' },
+		{ "txlog", required_argument, NULL, 'X' },
+		{ "tlm", no_argument, NULL, 'M' },
+		{ "window", required_argument, NULL, 'W' },
+		{ "record", required_argument, NULL, 'R' },
+		{ "record-depth", required_argument, NULL, 'D' },
+		{ "record-out", required_argument, NULL, 'o' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while ((c = getopt_long(argc, argv, "j:", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'F':
+			fast_forward = 0;
+			break;
+		case 't':
+			test_list = optarg;
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			break;
+		case 'l':
+			log_dir = optarg;
+			break;
+		case 's':
+			ckpt_prefix = optarg;
+			break;
+		case 'r':
+			restore = optarg;
+			break;
+		case 'p':
+			prof_file = optarg;
+			break;
+		case 'T':
+			trace_tests = optarg;
+			break;
+		case 'g':
+			if (trace_ngroups == MAXGROUPS) {
+				printf("too many trace groups\n");
+				exit(1);
+			}
+			trace_groups[trace_ngroups++] = optarg;
+			break;
+		case 'd':
+			trace_dir = optarg;
+			break;
+		case 'w':
+			when_add(optarg, when_trace);
+			break;
+		case 'S':
+			when_add(optarg, when_snapshot);
+			break;
+		case 'B':
+			when_add(optarg, when_break);
+			break;
+		case 'X':
+			txlog_file = optarg;
+			break;
+		case 'M':
+			tlm = 1;
+			break;
+		case 'W':
+			host_window = atoi(optarg);
+			break;
+		case 'L':
+			log_config(optarg, log_names, LOGC_NUM);
+			break;
+		case 'R':
+			if (record_npatterns == MAXRECORD) {
+				printf("too many recorder patterns\n");
+				exit(1);
+			}
+			record_patterns[record_npatterns++] = optarg;
+			break;
+		case 'D':
+			record_depth = atoi(optarg);
+			break;
+		case 'o':
+			record_out = optarg;
+			break;
+		case 'b':
+			bench_cycles = strtoull(optarg, NULL, 0);
+			/* measure the model, not the skipped cycles */
+			fast_forward = 0;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (prof_file != NULL) {
+		prof_init(prof_file);
+		atexit(prof_dump);
+	}
+
+	if (test_list != NULL || jobs != 0)
+		exit(run_shards(test_list ? test_list : "all", jobs, log_dir,
+			fast_forward));
+
+	simulate(test, fast_forward, restore);
+
+	return 0;
+}
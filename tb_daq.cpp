@@ -1,15 +1,19 @@
 #include <stdlib.h>
 #include <stddef.h>
-#include <setjmp.h>
 #include <stdarg.h>
+#include <getopt.h>
+#include <time.h>
 #include <pcre.h>
 #include <arpa/inet.h>
 
 #include "Vtb_daq.h"
 #include "verilated.h"
 #include "vsyms.h"
-
-static int color_disabled = 0;
+#include "watch.h"
+#include "fiber.h"
+#include "log.h"
+#include "crc.h"
+#include "sigdec.h"
 
 #ifndef min
 #define min(a,b) ((a) < (b) ? (a) : (b))
@@ -17,344 +21,35 @@ static int color_disabled = 0;
 
 #define HZ 48000000
 
-#define WF_WATCH	1
-#define WF_PRINT	2
-#define WF_ALL		(WF_WATCH | WF_PRINT)
-
-#define FORM_BIN	1
-#define FORM_HEX	2
-#define FORM_DEC	3
-
-#define COLOR_NONE	1
-#define COLOR_CHANGED	2
-#define COLOR_ALWAYS	3
-
-typedef struct _watch_entry {
-	int		sig;	/* signal number */
-	char		*nick;
-	int		flags;
-	void		*val;
-	uint64_t	*mask;
-	int		format;
-	int		cmp;
-} watch_entry_t;
-
-typedef struct _watch {
-	watch_entry_t	*we;
-	int		n;
-	Vtb_daq		*tb;
-	uint64_t	last_cycle;
-} watch_t;
-
 typedef struct {
 	Vtb_daq		*tb;
 	uint64_t	last_change;
 	watch_t		*wp;
 	uint64_t	cycle;
-	jmp_buf		main_jb;
-	jmp_buf		test_jb;
-	vluint8_t	*signal8p;
-	vluint8_t	signal8v;
+	fiber_t		*test_fiber;
 	uint64_t	delay_until;
 } sim_t;
 
 static void fail(const char *msg, ...);
 static void signal_tick(sim_t *sp);
 
-watch_t *
-watch_init(Vtb_daq *tb)
-{
-	watch_t *wp = (watch_t *)calloc(sizeof(*wp), 1);
-	wp->we = (watch_entry_t *)calloc(sizeof(*wp->we), NSIGS * 10);
-	wp->tb = tb;
-
-	return wp;
-}
-
-static int
-sig_to_len(int sig)
-{
-	int len;
-
-	switch (vsigs[sig].type) {
-	case sigC: len = 1; break;
-	case sigS: len = 2; break;
-	case sigI: len = 4; break;
-	case sigQ: len = 8; break;
-	case sigW: len = 4; break;
-	default:
-		printf("inval sig type\n");
-		exit(1);
-	}
-
-	return len * vsigs[sig].num;
-}
-
-static void *
-watch_get_value(watch_t *wp, int sig)
-{
-	int len = sig_to_len(sig);
-	Vtb_daq *tb = wp->tb;
-	void *v = malloc(len);
-
-	memcpy(v, (uint8_t *)tb + vsigs[sig].offset, len);
-
-	return v;
-}
-
-static int
-watch_cmp_value(int sig, void *v1, void *v2, uint64_t *mask)
-{
-	int len = sig_to_len(sig);
-
-	return memcmp(v1, v2, len);
-}
-
-static int
-find_signal(const char *name, int *start)
-{
-	int i;
-	const char *err_str;
-	int err_off;
-	int ret;
-	pcre *comp = pcre_compile(name, 0, &err_str, &err_off, NULL);
-
-	if (comp == NULL) {
-		printf("name %s not a valid regexp: %s\n", name, err_str);
-		exit(1);
-	}
-
-	for (i = *start; i < NSIGS; ++i) {
-		ret = pcre_exec(comp, NULL, vsigs[i].name,
-			strlen(vsigs[i].name), 0, 0, NULL, 0);
-		if (ret == PCRE_ERROR_NOMATCH)
-			continue;
-		if (ret < 0) {
-			printf("pcre match failed with %d\n", ret);
-			exit(1);
-		}
-		*start = i + 1;
-
-		return i;
-	}
-
-	return -1;
-}
-
-static void
-watch_add(watch_t *wp, const char *name, const char *nick, uint64_t *mask,
-	int format, int flags)
-{
-	int _r = 0;
-	int at_least_one = 0;
-	int sig;
-
-	while ((sig = find_signal(name, &_r)) >= 0) {
-		if (nick)
-			printf("watch: adding %s as %s\n", vsigs[sig].name, nick);
-		else
-			printf("watch: adding %s as <unnamed>\n", vsigs[sig].name);
-		wp->we[wp->n].sig = sig;
-		wp->we[wp->n].nick = nick ? strdup(nick) : NULL;
-		wp->we[wp->n].flags = flags;
-		wp->we[wp->n].format = format;
-		wp->we[wp->n].val = watch_get_value(wp, sig);
-		/* TODO: save mask */
-		++wp->n;
-		if (wp->n == NSIGS * 10) {
-			printf("too many signals in watchlist\n");
-			exit(1);
-		}
-		at_least_one = 1;
-		nick = NULL;
-	}
-	if (!at_least_one) {
-		printf("name %s doesn't match any signal\n", name);
-		exit(0);
-	}
-}
-
-static void
-watch_remove(watch_t *wp, const char *name)
-{
-	int _r = 0;
-	int sig;
-	int i;
-
-	while ((sig = find_signal(name, &_r)) >= 0) {
-		for (i = 0; i < wp->n; ++i) {
-			if (wp->we[i].sig == sig) {
-				free(wp->we[i].nick);
-				free(wp->we[i].val);
-				memmove(wp->we + i, wp->we + i + 1, sizeof(*wp->we) * (wp->n - i));
-				--wp->n;
-				break;
-			}
-		}
-	}
-}
-
-static void
-watch_clear(watch_t *wp)
-{
-	int i;
-
-	for (i = 0; i < wp->n; ++i) {
-		free(wp->we[i].nick);
-		free(wp->we[i].val);
-	}
-	wp->n = 0;
-}
-
-#define C_BLACK "\e[30m"
-#define C_RED "\e[31m"
-#define C_GREEN "\e[32m"
-#define C_YELLOW "\e[33m"
-#define C_BLUE "\e[34m"
-#define C_MAGENTA "\e[35m"
-#define C_CYAN "\e[36m"
-#define C_WHITE "\e[37m"
-#define C_RESET "\e[0m"
-static void
-print_value(watch_entry_t *we, int do_color)
-{
-	int len = sig_to_len(we->sig);
-	const char *c = NULL;
-	char outbuf[1000];
-	uint64_t v;
-	int type = vsigs[we->sig].type;
-
-	if (color_disabled)
-		do_color = COLOR_NONE;
-	if (do_color == COLOR_CHANGED && we->cmp)
-		c = C_RED;
-	else if (do_color == COLOR_ALWAYS)
-		c = C_GREEN;
-	if (we->nick)
-		printf(" %s %s", we->nick, c ? c : "");
-	else
-		printf(" %s", c ? c : "");
-
-	for (int i = 0; i < vsigs[we->sig].num; ++i) {
-		uint64_t val;
-
-		if (i > 0)
-			printf("/");
-		if (type == sigC)
-			val = ((uint8_t *)we->val)[i];
-		else if (type == sigS)
-			val = ((uint16_t *)we->val)[i];
-		else if (type == sigI)
-			val = ((uint32_t *)we->val)[i];
-		else if (type == sigQ)
-			val = ((uint64_t *)we->val)[i];
-		else if (type == sigW)
-			val = ((uint32_t *)we->val)[i];
-
-		if (we->format == FORM_HEX) {
-			printf("%lx", val);
-		} else if (we->format == FORM_DEC) {
-			printf("%ld", val);
-		} else if (we->format == FORM_BIN) {
-			int first = 0;
-			int i;
-
-			for (i = 63; i >= 0; --i) {
-				int bit = (val & (1ul << 63)) != 0;
-
-				val <<= 1;
-
-				if (bit == 0 && !first)
-					continue;
-				first = 1;
-				printf("%d", bit);
-			}
-			if (!first)
-				printf("0");
-		} else {
-			printf("invalid format %d\n", we->format);
-			exit(1);
-		}
-	}
-
-	if (c)
-		printf("%s", C_RESET);
-}
-
-static void
-do_watch(watch_t *wp, uint64_t cycle)
-{
-	int i;
-	int same = 1;
-	int header_done;
-	void *v;
-
-	if (cycle - wp->last_cycle > 1000000)
-		fail("abort due to inactivity\n");
-
-	/*
-	 * compare signals
-	 */
-	for (i = 0; i < wp->n; ++i) {
-		watch_entry_t *we = wp->we + i;
-		int ret = 0;
-		void *v = NULL;
-
-		v = watch_get_value(wp, we->sig);
-		ret = watch_cmp_value(we->sig, we->val, v, we->mask);
-		if (ret != 0 && (we->flags & WF_WATCH))
-			same = 0;
-		we->cmp = ret;
-		free(we->val);
-		we->val = v;
-	}
-
-	if (same)
-		return;
-
-	uint64_t diff = cycle - wp->last_cycle;
-
-	/* print all fixed values */
-	header_done = 0;
-	for (i = 0; i < wp->n; ++i) {
-		watch_entry_t *we = wp->we + i;
-		int flags = we->flags;
-
-		if (flags & WF_PRINT) {
-			if (!header_done) {
-				printf("% 10d % 6d", cycle, diff);
-				header_done = 1;
-			}
-			print_value(we, COLOR_CHANGED);
-		}
-	}
-	if (header_done)
-		printf("\n");
-
-	header_done = 0;
-	/* print watch-only first */
-	for (i = 0; i < wp->n; ++i) {
-		watch_entry_t *we = wp->we + i;
-		int flags = we->flags;
-
-		if (flags & WF_WATCH && we->cmp && ~flags & WF_PRINT) {
-			if (!header_done) {
-				printf("% 10d % 6d changed", cycle, diff);
-				header_done = 1;
-			}
-			print_value(we, COLOR_NONE);
-		}
-	}
-	if (header_done)
-		printf("\n");
+/*
+ * log categories, chatter goes to LOG_DEBUG
+ */
+enum {
+	LOGC_ETHER,
+	LOGC_SIGNAL,
+	LOGC_NUM
+};
 
-	wp->last_cycle = cycle;
-}
+static const char *log_names[LOGC_NUM] = {
+	"ether", "signal"
+};
 
 /*
  * main tick loop
  */
-static void test(sim_t *sp);
+static void test(void *arg);
 static sim_t *
 init(Vtb_daq *tb)
 {
@@ -373,14 +68,12 @@ init(Vtb_daq *tb)
 static void
 yield(sim_t *sp)
 {
-	if (setjmp(sp->test_jb) == 0)
-		longjmp(sp->main_jb, 1);
+	fiber_yield(sp->test_fiber);
 }
 
 static void
 step(sim_t *sp, uint64_t cycle)
 {
-	int ret;
 	Vtb_daq *tb = sp->tb;
 	int want_dump = 0;
 
@@ -392,13 +85,7 @@ step(sim_t *sp, uint64_t cycle)
 	do_watch(sp->wp, cycle);
 
 	/* continue test procedure */
-	ret = setjmp(sp->main_jb);
-	if (ret == 0)
-		longjmp(sp->test_jb, 1);
-	if (ret == 1)
-		want_dump = 1;
-
-	fflush(stdout);
+	fiber_resume(sp->test_fiber);
 }
 
 static void
@@ -413,9 +100,7 @@ delay(sim_t *sp, uint64_t ticks)
 static void
 wait_for_signal8(sim_t *sp, vluint8_t *signal, vluint8_t val)
 {
-	sp->signal8p = signal;
-	sp->signal8v = val;
-	while (*sp->signal8p != sp->signal8v)
+	while (*signal != val)
 		yield(sp);
 }
 
@@ -424,6 +109,8 @@ fail(const char *msg, ...)
 {
 	va_list ap;
 	va_start(ap, msg);
+	/* everything printed so far first, then synchronously */
+	log_stop();
 	printf("test failed: ");
 	vprintf(msg, ap);
 	exit(1);
@@ -466,10 +153,10 @@ check_packet(sim_t *sp, uint32_t *exp_data, int exp_len, int *seq)
 		fail("packet too long\n");
 	plen = i;
 
-	printf("PACKET: ");
+	LOG(LOGC_ETHER, LOG_DEBUG, "PACKET: ");
 	for (i = 0; i < plen; ++i)
-		printf("%02x ", p[i]);
-	printf("\n");
+		LOG(LOGC_ETHER, LOG_DEBUG, "%02x ", p[i]);
+	LOG(LOGC_ETHER, LOG_DEBUG, "\n");
 
 	/* check IPG */
 	for (i = 0; i < 12 * 4; ++i) {
@@ -499,19 +186,8 @@ check_packet(sim_t *sp, uint32_t *exp_data, int exp_len, int *seq)
 		fail("seq %d != %d\n", ntohl(buf[5]) & 0xffff, *seq);
 	(*seq)++;
 
-	/* calculate crc */
-	uint32_t crc = 0xffffffff;
-	for (i = 8; i < plen - 4; ++i) {
-		unsigned int byte, mask;
-
-		byte = p[i];
-		crc = crc ^ byte;
-		for (j = 7; j >= 0; j--) {
-			mask = -(crc & 1);
-			crc = (crc >> 1) ^ (0xEDB88320 & mask);
-		}
-	}
-	crc = ~crc;
+	/* fcs over everything after the preamble */
+	uint32_t crc = crc32(p + 8, plen - 12);
 	uint32_t recv_crc = buf[plen / 4 - 1]; /* no bswap */
 	if (recv_crc != crc)
 		fail("crc differ: recv %08x calc %08x\n", recv_crc, crc);
@@ -757,187 +433,6 @@ signal_tick(sim_t *sp)
 	tb->sig_grant = tb->sig_req;
 }
 
-#define PST_SOP 0
-#define PST_IN_PACKET 1
-typedef struct _parser {
-	uint32_t	*buf;
-	int		len;	/* length of buffer */
-	int		ptr;	/* current pointer into buffer */
-	int		ix;	/* bit index in current word */
-	int		state;	/* parser state */
-	int		p_end;	/* end of current packet (excl.) */
-	int		rle_len;/* bit width of rle counter */
-	int		sig_width;/* bit width signal */
-	uint32_t	recv_systime; /* systime at start of packet */
-	int		resid_len;	/* residual from prev packet */
-	uint32_t	resid;
-	int		not_first_packet;
-	int		eos;	/* end of stream */
-	uint32_t	systime;
-	int		recv_off;
-	int		check_off;
-} parser_t;
-
-/*
- * can return a partial result. call as often as necessary
- */
-static int
-_get_bits(parser_t *p, int num, uint32_t *res)
-{
-	uint32_t ret = 0;
-	int i;
-
-	if (p->eos)
-		fail("data requested at end of stream\n");
-
-	if (p->state == PST_SOP) {
-		uint32_t h1;
-		uint32_t h2;
-		int off;
-
-		/* read start of packet */
-		if (p->ptr + 2 > p->len)
-			fail("not a full header in stream\n");
-		h1 = p->buf[p->ptr++];
-		h2 = p->buf[p->ptr++];
-		if ((h1 >> 24) != 0x40)
-			fail("not a signal packet (0x%02x)\n", h1 >> 24);
-		off = (h1 >> 18) & 0x1f;
-		p->p_end = p->ptr + (h1 & 0xff);
-		if (p->not_first_packet && ((h1 >> 13) & 0x1f) != p->rle_len)
-			fail("rle len changed\n");
-		p->rle_len = (h1 >> 13) & 0x1f;
-		if (p->not_first_packet && ((h1 >> 8) & 0x1f) != p->sig_width)
-			fail("sig width changed\n");
-		p->sig_width = (h1 >> 8) & 0x1f;
-		p->recv_systime = h2;
-		p->recv_off = off;
-		p->check_off = 1;
-		if (!p->not_first_packet) {
-			if (off != 0)
-				fail("offset in first packet\n");
-		}
-		p->not_first_packet = 1;
-		printf("SOP: off %d ptr %d end %d rle_len %d sig_width %d systime %d\n",
-			off, p->ptr, p->p_end, p->rle_len, p->sig_width, p->recv_systime);
-		p->state = PST_IN_PACKET;
-		*res = 0;
-		return 0;
-	}
-	if (p->state == PST_IN_PACKET) {
-		int n = min(32 - p->ix, num);
-
-		*res = (p->buf[p->ptr] >> (32 - p->ix - n));
-		*res &= (1 << n) - 1;
-		p->ix += n;
-
-		if (p->ix == 32) {
-			++p->ptr;
-			p->ix = 0;
-			if (p->ptr == p->p_end)
-				p->state = PST_SOP;
-			if (p->ptr == p->len)
-				p->eos = 1;
-		}
-		printf("new ix %d ptr %d res %x rlen %d\n", p->ix, p->ptr, *res, n);
-		return n;
-	}
-}
-
-static uint32_t
-get_bits(parser_t *p, int num)
-{
-	uint32_t r;
-	uint32_t res = 0;
-	int n;
-
-	while (num > 0) {
-		n = _get_bits(p, num, &r);
-		res <<= n;
-		res |= r;
-		num -= n;
-	};
-
-	return res;
-}
-
-static void
-check_offset(parser_t *p)
-{
-	uint32_t r;
-
-	/*
-	 * at start of packet, push header through to get current values
-	 * for the check below
-	 */
-	if (p->state == PST_SOP)
-		_get_bits(p, 0, &r);
-
-	if (!p->check_off)
-		return;
-
-	p->check_off = 0;
-
-	printf("own systime %d recv %d diff %d off %d recv %d\n",
-		p->systime, p->recv_systime, p->systime - p->recv_systime,
-		p->ix, p->recv_off);
-	if (p->systime != p->recv_systime || p->ix != p->recv_off)
-		fail("bad systime/ix in header\n");
-}
-
-static void
-expand_sig(parser_t *p, uint32_t *out, int outmax)
-{
-	int outlen = 0;
-	uint32_t slot;
-	uint32_t sample;
-	uint32_t scnt;
-	uint32_t pipeline[6] = { 0 };
-	int i;
-
-printf("rle_len %d sig_width %d\n", p->rle_len, p->sig_width);
-	while (1) {
-		check_offset(p);
-		slot = get_bits(p, 3);
-		if (slot == 0) {
-			sample = get_bits(p, p->sig_width);
-			printf("got direct %x\n", sample);
-			out[outlen++] = sample;
-			if (outlen == outmax)
-				return;
-			scnt = 1;
-			memmove(pipeline + 1, pipeline + 0, sizeof(*pipeline) * 6);
-			pipeline[0] = sample;
-		} else {
-			scnt = get_bits(p, 1);
-			if (scnt == 0) {
-				scnt = get_bits(p, 4);
-			} else {
-				scnt = get_bits(p, 1);
-				if (scnt == 0) {
-					scnt = get_bits(p, 8);
-				} else {
-					scnt = get_bits(p, 1);
-					if (scnt == 1)
-						fail("inval cnt encoding\n");
-					scnt = get_bits(p, p->rle_len);
-				}
-			}
-			printf("got slot %d cnt %d\n", slot, scnt);
-			sample = pipeline[slot - 1];
-			memmove(pipeline + 1, pipeline + 0, sizeof(*pipeline) * (slot - 1));
-			pipeline[0] = sample;
-			printf("sample %x cnt %d\n", sample, scnt);
-			for (i = 0; i < scnt; ++i) {
-				out[outlen++] = sample;
-				if (outlen == outmax)
-					return;
-			}
-		}
-		p->systime += scnt;
-	}
-}
-
 static void
 send_and_test_stimulus(sim_t *sp, uint32_t *buf, int len)
 {
@@ -953,21 +448,48 @@ send_and_test_stimulus(sim_t *sp, uint32_t *buf, int len)
 		yield(sp);
 		if (tb->sig_valid) {
 			result[rlen++] = tb->sig_data;
-			printf("recv: %08x\n", tb->sig_data);
+			LOG(LOGC_SIGNAL, LOG_DEBUG, "recv: %08x\n",
+				tb->sig_data);
 		}
 	}
-	printf("have result len %d\n", rlen);
-
-	parser_t p = { 0 };
-	p.buf = result;
-	p.len = rlen;
-	p.systime = systime;
+	LOG(LOGC_SIGNAL, LOG_INFO, "have result len %d\n", rlen);
 
 	int outlen = len + 3;
 	uint32_t *out = (uint32_t *)malloc(sizeof(*out) * outlen);
-	expand_sig(&p, out, outlen);
+	sigdec_t sd;
+	int pos = 0;
+	int n = 0;
+	int ret;
+
+	struct timespec t0;
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	sigdec_init(&sd);
+	if (rlen < 2 || ((result[0] >> 18) & 0x3f) != 0)
+		fail("offset in first packet\n");
+	if (result[1] != systime)
+		fail("bad systime in first header: %d != %d\n", result[1],
+			systime);
+	while (n < outlen) {
+		if (pos == rlen)
+			fail("stream ended after %d samples\n", n);
+		ret = sigdec_record(&sd, result + pos, rlen - pos);
+		if (ret < 0)
+			fail("bad signal packet at %d: %s\n", pos,
+				sigdec_error(&sd));
+		pos += ret;
+		while (n < outlen &&
+		    (ret = sigdec_samples(&sd, out + n, outlen - n)) > 0)
+			n += ret;
+		if (ret < 0)
+			fail("bad signal data: %s\n", sigdec_error(&sd));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
 
-	printf("expanded to %d samples\n", outlen);
+	double dt = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	LOG(LOGC_SIGNAL, LOG_INFO, "expanded to %d samples, %.1f Msamples/s\n",
+		outlen, outlen / dt / 1e6);
 
 	/* discard first 3 0-word, sig inserts it at the start */
 	if (out[0] != 0 || out[1] != 0 || out[2] != 0)
@@ -1075,9 +597,9 @@ printf("sleep\n"); sleep(1000);
 }
 
 static void
-test(sim_t *sp)
+test(void *arg)
 {
-	delay(sp, 1);	/* pass back control after initialization */
+	sim_t *sp = (sim_t *)arg;
 
 #if 0
 	test_daq(sp);
@@ -1095,20 +617,33 @@ main(int argc, char **argv) {
 	Verilated::commandArgs(argc, argv);
 	uint64_t cycle = 100000;
 	sim_t *sp;
+	int c;
+
+	static struct option long_options[] = {
+		{ "log", required_argument, 0, 'L' },
+		{ 0, 0, 0, 0 }
+	};
+	while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'L':
+			log_config(optarg, log_names, LOGC_NUM);
+			break;
+		default:
+			printf("usage: %s [--log=CAT=LEVEL,...]\n", argv[0]);
+			printf("  LEVEL is err, info (default) or debug, CAT is "
+				"all, ether or signal\n");
+			exit(1);
+		}
+	}
 
 	// Create an instance of our module under test
 	Vtb_daq *tb = new Vtb_daq;
 
-	sp = init(tb);
+	/* from here on, output is written by a separate thread */
+	log_start();
 
-	if (setjmp(sp->main_jb) == 0)
-		test(sp);	/* initialize test procedure */
-	/*
-	 * hack: this alloc reserves 64k of stack for test().
-	 * it prevents the region where the stack frame from test
-	 * resides from being overwritten
-	 */
-	alloca(65536);
+	sp = init(tb);
+	sp->test_fiber = fiber_create(test, sp, 0, "test");
 
 	// Tick the clock until we are done
 	while(!Verilated::gotFinish()) {
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "trace.h"
+
+/* use the gtkwave writer shipped with verilator, the same way it does */
+#define HAVE_LIBPTHREAD
+#define FST_WRITER_PARALLEL
+#define LZ4_DISABLE_DEPRECATE_WARNINGS
+#define FST_CONFIG_INCLUDE "fst_config.h"
+#include "gtkwave/fastlz.c"
+#include "gtkwave/fstapi.c"
+#include "gtkwave/lz4.c"
+
+typedef struct {
+	fstHandle	handle;
+	int		width;		/* in bits */
+	const uint8_t	*src;
+	int		len;		/* in bytes */
+	uint8_t		*last;		/* value at the last sample */
+	int		fresh;		/* not emitted yet */
+} trace_var_t;
+
+struct _trace {
+	void		*fst;
+	const char	*top;
+	uint64_t	period_ps;
+	trace_var_t	*vars;
+	int		n;
+	int		size;
+	char		*bits;		/* conversion buffer */
+	int		bits_size;
+	struct _trace	*next;		/* list of open traces */
+};
+
+static trace_t *traces;
+
+/*
+ * a trace is only readable after fstWriterClose, so also close traces
+ * still open when a test fails and exits
+ */
+static void
+trace_close_all(void)
+{
+	while (traces != NULL)
+		trace_close(traces);
+}
+
+trace_t *
+trace_open(const char *path, const char *top, uint64_t period_ps)
+{
+	trace_t *tp = (trace_t *)calloc(1, sizeof(*tp));
+
+	tp->fst = fstWriterCreate(path, 1);
+	if (tp->fst == NULL) {
+		printf("trace: failed to create %s\n", path);
+		exit(1);
+	}
+	fstWriterSetTimescale(tp->fst, -12);	/* ps */
+	fstWriterSetPackType(tp->fst, FST_WR_PT_LZ4);
+	/* compress and write from a separate thread */
+	fstWriterSetParallelMode(tp->fst, 1);
+	tp->top = top;
+	tp->period_ps = period_ps;
+
+	if (traces == NULL) {
+		static int registered;
+
+		if (!registered)
+			atexit(trace_close_all);
+		registered = 1;
+	}
+	tp->next = traces;
+	traces = tp;
+
+	return tp;
+}
+
+/*
+ * add a signal to the trace. Signals can be added at any time, adding
+ * the same one again is ignored
+ */
+void
+trace_var(trace_t *tp, const char *name, int width, const void *src, int len)
+{
+	trace_var_t *tv;
+	char scope[strlen(name) + 1];
+	const char *p;
+	const char *dot;
+	int depth = 0;
+	int i;
+
+	if (width > len * 8)
+		width = len * 8;
+	for (i = 0; i < tp->n; ++i)
+		if (tp->vars[i].src == src && tp->vars[i].width == width)
+			return;
+
+	if (tp->n == tp->size) {
+		tp->size = tp->size ? tp->size * 2 : 64;
+		tp->vars = (trace_var_t *)realloc(tp->vars,
+			tp->size * sizeof(*tp->vars));
+		if (tp->vars == NULL) {
+			printf("trace: out of memory\n");
+			exit(1);
+		}
+	}
+	if (width > tp->bits_size) {
+		tp->bits_size = width;
+		tp->bits = (char *)realloc(tp->bits, width + 1);
+	}
+
+	/* the hierarchy is repeated for each signal, gtkwave merges it */
+	fstWriterSetScope(tp->fst, FST_ST_VCD_MODULE, tp->top, NULL);
+	for (p = name; (dot = strchr(p, '.')) != NULL; p = dot + 1) {
+		memcpy(scope, p, dot - p);
+		scope[dot - p] = 0;
+		fstWriterSetScope(tp->fst, FST_ST_VCD_MODULE, scope, NULL);
+		++depth;
+	}
+
+	tv = tp->vars + tp->n++;
+	tv->handle = fstWriterCreateVar(tp->fst, FST_VT_VCD_WIRE,
+		FST_VD_IMPLICIT, width, p, 0);
+	tv->width = width;
+	tv->src = (const uint8_t *)src;
+	tv->len = len;
+	tv->last = (uint8_t *)malloc(len);
+	tv->fresh = 1;
+
+	for (i = 0; i <= depth; ++i)
+		fstWriterSetUpscope(tp->fst);
+}
+
+/*
+ * compare all traced signals against the last sample and write the
+ * changes
+ */
+void
+trace_sample(trace_t *tp, uint64_t cycle)
+{
+	int time_done = 0;
+	int i;
+	int b;
+
+	for (i = 0; i < tp->n; ++i) {
+		trace_var_t *tv = tp->vars + i;
+
+		if (!tv->fresh && memcmp(tv->last, tv->src, tv->len) == 0)
+			continue;
+		memcpy(tv->last, tv->src, tv->len);
+		tv->fresh = 0;
+
+		if (!time_done) {
+			fstWriterEmitTimeChange(tp->fst, cycle * tp->period_ps);
+			time_done = 1;
+		}
+		/* little endian in memory, msb first for the writer */
+		for (b = 0; b < tv->width; ++b)
+			tp->bits[tv->width - 1 - b] =
+				'0' + ((tv->last[b / 8] >> (b % 8)) & 1);
+		tp->bits[tv->width] = 0;
+		fstWriterEmitValueChange(tp->fst, tv->handle, tp->bits);
+	}
+}
+
+void
+trace_close(trace_t *tp)
+{
+	trace_t **tpp;
+	int i;
+
+	for (tpp = &traces; *tpp != tp; tpp = &(*tpp)->next)
+		;
+	*tpp = tp->next;
+
+	/* waits for the writer thread to finish */
+	fstWriterClose(tp->fst);
+	for (i = 0; i < tp->n; ++i)
+		free(tp->vars[i].last);
+	free(tp->vars);
+	free(tp->bits);
+	free(tp);
+}
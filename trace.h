@@ -0,0 +1,22 @@
+#ifndef __TRACE__H__
+#define __TRACE__H__
+
+#include <stdint.h>
+
+/*
+ * waveform trace of a selected set of signals into an FST file, as
+ * written by the fstapi that comes with verilator. Compression of the
+ * value change blocks runs in the writer thread of the fstapi, so the
+ * simulation only pays for sampling and comparing the traced signals.
+ * Signals are given as raw memory, the caller maps them from its symbol
+ * table. Dots in the name build the hierarchy.
+ */
+typedef struct _trace trace_t;
+
+trace_t *trace_open(const char *path, const char *top, uint64_t period_ps);
+void trace_var(trace_t *tp, const char *name, int width, const void *src,
+	int len);
+void trace_sample(trace_t *tp, uint64_t cycle);
+void trace_close(trace_t *tp);
+
+#endif
@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include "txlog.h"
+
+/*
+ * decoder for the transaction logs written by the testbench with
+ * --txlog. Prints, filters, or diffs the logs of two runs.
+ * A diff compares each stream, i.e. all records of the same type and
+ * channel, record by record. Streams of different interfaces can shift
+ * against each other without showing up as a difference, and the cycle
+ * stamps are only compared with --cycles.
+ */
+typedef struct _txent {
+	txrec_t		rec;
+	uint8_t		*data;
+} txent_t;
+
+typedef struct _txfile {
+	txent_t		*e;
+	int		n;
+} txfile_t;
+
+static const char *txlog_types[TX_NTYPES] = {
+	NULL, "host_tx", "host_rx", "rmii", "mdio", "tmc_req", "tmc_reply",
+	"sd_cmd", "sd_resp"
+};
+
+static unsigned int type_mask = ~0u;
+static int chan_filter = -1;
+static uint64_t cycle_from = 0;
+static uint64_t cycle_to = ~0ull;
+
+static int
+want(const txrec_t *rec)
+{
+	if (!(type_mask & (1u << rec->type)))
+		return 0;
+	if (chan_filter >= 0 && rec->chan != chan_filter)
+		return 0;
+
+	return rec->cycle >= cycle_from && rec->cycle <= cycle_to;
+}
+
+static void
+load(txfile_t *tf, const char *path)
+{
+	static uint8_t data[TXLOG_MAXDATA];
+	int size = 0;
+	txrec_t rec;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		printf("failed to open %s\n", path);
+		exit(1);
+	}
+	txlog_read_hdr(fp, path);
+	tf->e = NULL;
+	tf->n = 0;
+	while (txlog_read(fp, &rec, data)) {
+		if (!want(&rec))
+			continue;
+		if (tf->n == size) {
+			size = size ? size * 2 : 1024;
+			tf->e = (txent_t *)realloc(tf->e, size * sizeof(*tf->e));
+			if (tf->e == NULL) {
+				printf("out of memory\n");
+				exit(1);
+			}
+		}
+		tf->e[tf->n].rec = rec;
+		tf->e[tf->n].data = (uint8_t *)malloc(rec.len ? rec.len : 1);
+		memcpy(tf->e[tf->n].data, data, rec.len);
+		++tf->n;
+	}
+	fclose(fp);
+}
+
+static uint32_t
+be32(const uint8_t *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void
+hex(const uint8_t *p, int len, int max)
+{
+	int i;
+
+	for (i = 0; i < len && i < max; ++i)
+		printf(" %02x", p[i]);
+	if (len > max)
+		printf(" ... (%d bytes)", len);
+}
+
+/* one line per record, with the fields decoded where it helps */
+static void
+print_rec(const char *prefix, const txrec_t *rec, const uint8_t *d)
+{
+	printf("%s%12lu %-9s %d:", prefix, rec->cycle, txlog_types[rec->type],
+		rec->chan);
+	switch (rec->type) {
+	case TX_HOST_TX:
+	case TX_HOST_RX:
+		/* len, seq, payload, crc16, 0x7e */
+		if (rec->len < 5) {
+			hex(d, rec->len, 16);
+			break;
+		}
+		printf(" seq %d", d[1] & 0x0f);
+		hex(d + 2, rec->len - 5, 32);
+		break;
+	case TX_MDIO:
+		if (rec->len != 5) {
+			hex(d, rec->len, 16);
+			break;
+		}
+		printf(" %s phy %d reg %d data %04x",
+			d[0] == 1 ? "write" : "read", d[1], d[2],
+			d[3] | (d[4] << 8));
+		break;
+	case TX_TMC_REQ:
+		if (rec->len == 4)
+			printf(" read slave %d reg %d", d[1], d[2] & 0x7f);
+		else if (rec->len == 8)
+			printf(" write slave %d reg %d data %08x", d[1],
+				d[2] & 0x7f, be32(d + 3));
+		else
+			hex(d, rec->len, 16);
+		break;
+	case TX_TMC_REPLY:
+		if (rec->len == 8)
+			printf(" reg %d data %08x", d[2] >> 1, be32(d + 3));
+		else
+			hex(d, rec->len, 16);
+		break;
+	case TX_SD_CMD:
+		if (rec->len == 6)
+			printf(" cmd %d arg %08x crc %02x", d[0] & 0x3f,
+				be32(d + 1), d[5] >> 1);
+		else
+			hex(d, rec->len, 16);
+		break;
+	default:
+		printf(" len %d", rec->len);
+		hex(d, rec->len, 32);
+		break;
+	}
+	printf("\n");
+}
+
+static int
+same(const txent_t *a, const txent_t *b, int cycles)
+{
+	if (cycles && a->rec.cycle != b->rec.cycle)
+		return 0;
+
+	return a->rec.len == b->rec.len &&
+		memcmp(a->data, b->data, a->rec.len) == 0;
+}
+
+static int
+diff(txfile_t *a, txfile_t *b, int cycles, int max)
+{
+	static uint8_t present[TX_NTYPES][256];
+	int ndiff = 0;
+	int type;
+	int chan;
+	int i;
+
+	for (i = 0; i < a->n; ++i)
+		present[a->e[i].rec.type][a->e[i].rec.chan] = 1;
+	for (i = 0; i < b->n; ++i)
+		present[b->e[i].rec.type][b->e[i].rec.chan] = 1;
+
+	for (type = 1; type < TX_NTYPES; ++type) {
+		for (chan = 0; chan < 256; ++chan) {
+			int ia = 0;
+			int ib = 0;
+			int idx = 0;
+
+			if (!present[type][chan])
+				continue;
+
+			/* walk both streams in step */
+			for (;;) {
+				while (ia < a->n && (a->e[ia].rec.type != type ||
+				    a->e[ia].rec.chan != chan))
+					++ia;
+				while (ib < b->n && (b->e[ib].rec.type != type ||
+				    b->e[ib].rec.chan != chan))
+					++ib;
+				if (ia == a->n && ib == b->n)
+					break;
+				if (ia < a->n && ib < b->n &&
+				    same(a->e + ia, b->e + ib, cycles)) {
+					++ia;
+					++ib;
+					++idx;
+					continue;
+				}
+				if (ndiff++ < max) {
+					printf("%s %d, transaction %d:\n",
+						txlog_types[type], chan, idx);
+					if (ia < a->n)
+						print_rec("- ", &a->e[ia].rec,
+							a->e[ia].data);
+					else
+						printf("- (none)\n");
+					if (ib < b->n)
+						print_rec("+ ", &b->e[ib].rec,
+							b->e[ib].data);
+					else
+						printf("+ (none)\n");
+				}
+				if (ia < a->n)
+					++ia;
+				if (ib < b->n)
+					++ib;
+				++idx;
+			}
+		}
+	}
+	if (ndiff > max)
+		printf("... %d more differences\n", ndiff - max);
+	printf("%d differences\n", ndiff);
+
+	return ndiff != 0;
+}
+
+static void
+usage(const char *name)
+{
+	int i;
+
+	printf("usage: %s [options] LOG\n", name);
+	printf("       %s [options] --diff LOG_A LOG_B\n", name);
+	printf("  --type=LIST    only the comma separated types\n");
+	printf("  --chan=N       only channel N\n");
+	printf("  --from=CYCLE   only records from CYCLE on\n");
+	printf("  --to=CYCLE     only records up to CYCLE\n");
+	printf("  --diff         compare two logs, exit 1 if they differ\n");
+	printf("  --cycles       also compare the cycle stamps\n");
+	printf("  --max=N        print at most N differences (default 20)\n");
+	printf("types:");
+	for (i = 1; i < TX_NTYPES; ++i)
+		printf(" %s", txlog_types[i]);
+	printf("\n");
+	exit(2);
+}
+
+static void
+parse_types(const char *list)
+{
+	const char *p = list;
+	int i;
+
+	type_mask = 0;
+	while (*p) {
+		int len = strcspn(p, ",");
+
+		for (i = 1; i < TX_NTYPES; ++i)
+			if ((int)strlen(txlog_types[i]) == len &&
+			    strncmp(p, txlog_types[i], len) == 0)
+				break;
+		if (i == TX_NTYPES) {
+			printf("unknown type in %s\n", list);
+			exit(2);
+		}
+		type_mask |= 1u << i;
+		p += len;
+		if (*p)
+			++p;
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	int do_diff = 0;
+	int cycles = 0;
+	int max = 20;
+	txfile_t a;
+	txfile_t b;
+	int c;
+	int i;
+
+	static struct option long_options[] = {
+		{ "type", required_argument, NULL, 't' },
+		{ "chan", required_argument, NULL, 'c' },
+		{ "from", required_argument, NULL, 'f' },
+		{ "to", required_argument, NULL, 'T' },
+		{ "diff", no_argument, NULL, 'd' },
+		{ "cycles", no_argument, NULL, 'C' },
+		{ "max", required_argument, NULL, 'm' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while ((c = getopt_long(argc, argv, "t:c:d", long_options, NULL)) != -1) {
+		switch (c) {
+		case 't':
+			parse_types(optarg);
+			break;
+		case 'c':
+			chan_filter = atoi(optarg);
+			break;
+		case 'f':
+			cycle_from = strtoull(optarg, NULL, 0);
+			break;
+		case 'T':
+			cycle_to = strtoull(optarg, NULL, 0);
+			break;
+		case 'd':
+			do_diff = 1;
+			break;
+		case 'C':
+			cycles = 1;
+			break;
+		case 'm':
+			max = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (argc - optind != (do_diff ? 2 : 1))
+		usage(argv[0]);
+
+	load(&a, argv[optind]);
+	if (do_diff) {
+		load(&b, argv[optind + 1]);
+		return diff(&a, &b, cycles, max);
+	}
+	for (i = 0; i < a.n; ++i)
+		print_rec("", &a.e[i].rec, a.e[i].data);
+
+	return 0;
+}
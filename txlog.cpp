@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "txlog.h"
+
+#define TXLOG_BUF	(1 << 20)
+
+struct _txlog {
+	FILE		*fp;
+	const uint64_t	*clock;
+	struct _txlog	*next;		/* list of open logs */
+};
+
+static txlog_t *txlogs;
+
+/* like traces, logs of a failed test are closed on exit */
+static void
+txlog_close_all(void)
+{
+	while (txlogs != NULL)
+		txlog_close(txlogs);
+}
+
+txlog_t *
+txlog_open(const char *path, const uint64_t *clock)
+{
+	txlog_t *tl = (txlog_t *)calloc(1, sizeof(*tl));
+	txlog_hdr_t hdr;
+	static int registered;
+
+	tl->fp = fopen(path, "w");
+	if (tl->fp == NULL) {
+		printf("txlog: failed to create %s\n", path);
+		exit(1);
+	}
+	/* a write is a copy into the buffer most of the time */
+	setvbuf(tl->fp, NULL, _IOFBF, TXLOG_BUF);
+	tl->clock = clock;
+
+	hdr.magic = TXLOG_MAGIC;
+	hdr.version = TXLOG_VERSION;
+	fwrite(&hdr, sizeof(hdr), 1, tl->fp);
+
+	if (!registered)
+		atexit(txlog_close_all);
+	registered = 1;
+	tl->next = txlogs;
+	txlogs = tl;
+
+	return tl;
+}
+
+void
+txlog_write(txlog_t *tl, int type, int chan, const void *data, int len)
+{
+	txrec_t rec;
+
+	if (tl == NULL)
+		return;
+	if (len > TXLOG_MAXDATA)
+		len = TXLOG_MAXDATA;
+	rec.cycle = *tl->clock;
+	rec.len = len;
+	rec.type = type;
+	rec.chan = chan;
+	fwrite(&rec, sizeof(rec), 1, tl->fp);
+	fwrite(data, len, 1, tl->fp);
+}
+
+void
+txlog_close(txlog_t *tl)
+{
+	txlog_t **tlp;
+
+	for (tlp = &txlogs; *tlp != tl; tlp = &(*tlp)->next)
+		;
+	*tlp = tl->next;
+	fclose(tl->fp);
+	free(tl);
+}
+
+void
+txlog_read_hdr(FILE *fp, const char *path)
+{
+	txlog_hdr_t hdr;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != TXLOG_MAGIC) {
+		printf("%s is not a transaction log\n", path);
+		exit(1);
+	}
+	if (hdr.version != TXLOG_VERSION) {
+		printf("%s has version %d, expected %d\n", path, hdr.version,
+			TXLOG_VERSION);
+		exit(1);
+	}
+}
+
+int
+txlog_read(FILE *fp, txrec_t *rec, uint8_t *data)
+{
+	if (fread(rec, sizeof(*rec), 1, fp) != 1)
+		return 0;
+	if (rec->len && fread(data, rec->len, 1, fp) != 1) {
+		printf("transaction log truncated at cycle %lu\n", rec->cycle);
+		exit(1);
+	}
+	if (rec->type == 0 || rec->type >= TX_NTYPES) {
+		printf("bad record type %d at cycle %lu\n", rec->type,
+			rec->cycle);
+		exit(1);
+	}
+
+	return 1;
+}
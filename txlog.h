@@ -0,0 +1,65 @@
+#ifndef __TXLOG__H__
+#define __TXLOG__H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * binary transaction log: one record per transaction seen by the BFMs,
+ * stamped with the cycle it completed in. The file starts with a header,
+ * followed by records, each a txrec_t followed by len bytes of data.
+ * Everything is in host byte order. txdump decodes, filters and diffs
+ * these logs.
+ *
+ * data per type:
+ *	TX_HOST_TX	frame host -> fpga, as sent on the wire
+ *	TX_HOST_RX	frame fpga -> host, as received
+ *	TX_RMII		ethernet frame sent by the fpga, without preamble
+ *	TX_MDIO		op (1 write, 2 read), phy, reg, data (16 bit)
+ *	TX_TMC_REQ	datagram from the fpga, 4 bytes read or 8 write
+ *	TX_TMC_REPLY	datagram to the fpga, 8 bytes
+ *	TX_SD_CMD	command received by the card, 6 bytes
+ *	TX_SD_RESP	response of the card
+ * chan is the instance, e.g. the tmcuart slot
+ */
+#define TXLOG_MAGIC	0x474c5854	/* "TXLG" */
+#define TXLOG_VERSION	1
+
+enum {
+	TX_HOST_TX = 1,
+	TX_HOST_RX,
+	TX_RMII,
+	TX_MDIO,
+	TX_TMC_REQ,
+	TX_TMC_REPLY,
+	TX_SD_CMD,
+	TX_SD_RESP,
+	TX_NTYPES
+};
+
+typedef struct _txlog_hdr {
+	uint32_t	magic;
+	uint32_t	version;
+} txlog_hdr_t;
+
+typedef struct __attribute__((packed)) _txrec {
+	uint64_t	cycle;
+	uint16_t	len;		/* of the data following */
+	uint8_t		type;
+	uint8_t		chan;
+} txrec_t;
+
+#define TXLOG_MAXDATA	65535
+
+typedef struct _txlog txlog_t;
+
+/* writing, from the testbench. The cycle is read from *clock */
+txlog_t *txlog_open(const char *path, const uint64_t *clock);
+void txlog_write(txlog_t *tl, int type, int chan, const void *data, int len);
+void txlog_close(txlog_t *tl);
+
+/* reading. Returns 0 at the end of the log, fails on a broken one */
+void txlog_read_hdr(FILE *fp, const char *path);
+int txlog_read(FILE *fp, txrec_t *rec, uint8_t *data);
+
+#endif
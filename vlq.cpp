@@ -0,0 +1,303 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "vlq.h"
+
+static int simd;
+
+
+static void __attribute__((constructor))
+vlq_init(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2"))
+		simd = 2;
+	else if (__builtin_cpu_supports("ssse3"))
+		simd = 1;
+#endif
+}
+
+int
+vlq_simd(void)
+{
+	return simd;
+}
+
+uint8_t *
+vlq_encode_n(uint8_t *p, const uint32_t *v, int n)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+		p = vlq_encode(p, v[i]);
+
+	return p;
+}
+
+int
+vlq_decode_n_scalar(const uint8_t *buf, int len, uint32_t *v, int max,
+	int *used)
+{
+	int pos = 0;
+	int n = 0;
+	int ret;
+
+	while (n < max && pos < len) {
+		ret = vlq_decode(buf + pos, len - pos, v + n);
+		if (ret == 0)
+			break;
+		pos += ret;
+		++n;
+	}
+	*used = pos;
+
+	return n;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * The SIMD decoders look at blocks of 64 bytes. If all of them are single
+ * byte values, they are widened in vector registers. Otherwise the AVX2
+ * one finds the value ends from the continuation bits and assembles each
+ * value from the 8 bytes loaded up to its end, masked to its length, with
+ * pext. Nothing but the start of the next value depends on the one
+ * before. Without pext that takes more instructions than the plain loop,
+ * so the SSSE3 one decodes these blocks one value at a time
+ */
+#define VLQ_BLOCK	64
+
+/* for a value of l bytes: its bytes, bits 6 and 5 of the first one */
+static const uint64_t lmask[VLQ_MAX + 1] = {
+	0, 0xff, 0xffff, 0xffffff, 0xffffffff, 0xffffffffff
+};
+static const uint64_t signbits[VLQ_MAX + 1] = {
+	0, 0x60, 0x6000, 0x600000, 0x60000000, 0
+};
+/* the sign bits to set then, the 5 byte ones have none left */
+static const uint32_t sext[VLQ_MAX + 1] = {
+	0, ~0u << 5, ~0u << 12, ~0u << 19, ~0u << 26, 0
+};
+
+/* the value of l bytes ending at e, the 7 bytes before are readable */
+__attribute__((target("bmi,bmi2")))
+static inline uint32_t
+vlq_assemble(const uint8_t *e, int l)
+{
+	uint64_t x;
+
+	memcpy(&x, e - 7, 8);
+	x = __builtin_bswap64(x) & lmask[l];
+
+	return _pext_u64(x, 0x0f7f7f7f7full) |
+		(sext[l] & -(uint32_t)((x & signbits[l]) == signbits[l]));
+}
+
+/*
+ * the values ending in the block at base, term has a bit set for each
+ * byte that ends one. The value in progress started at *start. Stops at
+ * a value longer than VLQ_MAX, leaving its bit in *term
+ */
+__attribute__((target("bmi,bmi2")))
+static inline int
+vlq_block(const uint8_t *base, uint64_t *term, const uint8_t **start,
+	uint32_t *v)
+{
+	const uint8_t *s = *start;
+	uint64_t t = *term;
+	int n = 0;
+
+	while (t) {
+		const uint8_t *e = base + __builtin_ctzll(t);
+		int l = e - s + 1;
+
+		if (l > VLQ_MAX)
+			break;
+		v[n++] = vlq_assemble(e, l);
+		s = e + 1;
+		t &= t - 1;
+	}
+	*start = s;
+	*term = t;
+
+	return n;
+}
+
+/*
+ * the first values one at a time, until the 7 bytes in front of the
+ * next are in the buffer. Returns the number, *start is moved past them
+ */
+static inline int
+vlq_head(const uint8_t *buf, int len, uint32_t *v, int max,
+	const uint8_t **start)
+{
+	int pos = 0;
+	int n = 0;
+	int ret;
+
+	while (pos < 7 && n < max) {
+		ret = vlq_decode(buf + pos, len - pos, v + n);
+		if (ret == 0)
+			break;
+		pos += ret;
+		++n;
+	}
+	*start = buf + pos;
+
+	return n;
+}
+
+__attribute__((target("ssse3")))
+int
+vlq_decode_n_ssse3(const uint8_t *buf, int len, uint32_t *v, int max,
+	int *used)
+{
+	const uint8_t *end = buf + len;
+	const uint8_t *start;
+	const uint8_t *p;
+	const __m128i lim = _mm_set1_epi8(0x5f);
+	const __m128i top = _mm_set1_epi8((char)0x80);
+	/* byte i of the group into the top byte of dword i */
+	const __m128i spread[4] = {
+		_mm_setr_epi8(-1, -1, -1, 0, -1, -1, -1, 1,
+			-1, -1, -1, 2, -1, -1, -1, 3),
+		_mm_setr_epi8(-1, -1, -1, 4, -1, -1, -1, 5,
+			-1, -1, -1, 6, -1, -1, -1, 7),
+		_mm_setr_epi8(-1, -1, -1, 8, -1, -1, -1, 9,
+			-1, -1, -1, 10, -1, -1, -1, 11),
+		_mm_setr_epi8(-1, -1, -1, 12, -1, -1, -1, 13,
+			-1, -1, -1, 14, -1, -1, -1, 15),
+	};
+	int n = 0;
+	int rest;
+	int ret;
+	int i;
+	int j;
+
+	start = p = buf;
+	while (end - p >= VLQ_BLOCK && max - n >= VLQ_BLOCK) {
+		__m128i c[4];
+		__m128i any;
+
+		for (i = 0; i < 4; ++i)
+			c[i] = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+		any = _mm_or_si128(_mm_or_si128(c[0], c[1]),
+			_mm_or_si128(c[2], c[3]));
+		if (_mm_movemask_epi8(any) == 0 && start == p) {
+			/*
+			 * single byte values, the negative ones get bit 7
+			 * and are sign extended from there
+			 */
+			for (i = 0; i < 4; ++i) {
+				c[i] = _mm_or_si128(c[i], _mm_and_si128(
+					_mm_cmpgt_epi8(c[i], lim), top));
+				for (j = 0; j < 4; ++j) {
+					_mm_storeu_si128((__m128i *)(v + n),
+						_mm_srai_epi32(_mm_shuffle_epi8(
+						c[i], spread[j]), 24));
+					n += 4;
+				}
+			}
+			start += VLQ_BLOCK;
+		} else {
+			while (start < p + VLQ_BLOCK) {
+				ret = vlq_decode(start, end - start, v + n);
+				if (ret == 0)
+					break;
+				start += ret;
+				++n;
+			}
+		}
+		p += VLQ_BLOCK;
+	}
+	n += vlq_decode_n_scalar(start, end - start, v + n, max - n, &rest);
+	*used = start - buf + rest;
+
+	return n;
+}
+
+__attribute__((target("avx2,bmi,bmi2")))
+int
+vlq_decode_n_avx2(const uint8_t *buf, int len, uint32_t *v, int max,
+	int *used)
+{
+	const uint8_t *end = buf + len;
+	const uint8_t *start;
+	const uint8_t *p;
+	const __m256i lim = _mm256_set1_epi8(0x5f);
+	const __m256i top = _mm256_set1_epi8((char)0x80);
+	int n;
+	int rest;
+	int i;
+
+	n = vlq_head(buf, len, v, max, &start);
+	p = start;
+	while (end - p >= VLQ_BLOCK && max - n >= VLQ_BLOCK) {
+		__m256i c[2];
+		uint64_t term;
+
+		c[0] = _mm256_loadu_si256((const __m256i *)p);
+		c[1] = _mm256_loadu_si256((const __m256i *)(p + 32));
+		term = (uint32_t)~_mm256_movemask_epi8(c[0]) |
+			(uint64_t)(uint32_t)~_mm256_movemask_epi8(c[1]) << 32;
+		if (term == ~0ull && start == p) {
+			for (i = 0; i < 2; ++i) {
+				__m256i b = _mm256_or_si256(c[i],
+					_mm256_and_si256(_mm256_cmpgt_epi8(c[i],
+					lim), top));
+				__m128i lo = _mm256_castsi256_si128(b);
+				__m128i hi = _mm256_extracti128_si256(b, 1);
+
+				_mm256_storeu_si256((__m256i *)(v + n),
+					_mm256_cvtepi8_epi32(lo));
+				_mm256_storeu_si256((__m256i *)(v + n + 8),
+					_mm256_cvtepi8_epi32(
+					_mm_srli_si128(lo, 8)));
+				_mm256_storeu_si256((__m256i *)(v + n + 16),
+					_mm256_cvtepi8_epi32(hi));
+				_mm256_storeu_si256((__m256i *)(v + n + 24),
+					_mm256_cvtepi8_epi32(
+					_mm_srli_si128(hi, 8)));
+				n += 32;
+			}
+			start += VLQ_BLOCK;
+		} else {
+			n += vlq_block(p, &term, &start, v + n);
+			if (term)
+				break;	/* not a stream of 32 bit values */
+		}
+		p += VLQ_BLOCK;
+	}
+	n += vlq_decode_n_scalar(start, end - start, v + n, max - n, &rest);
+	*used = start - buf + rest;
+
+	return n;
+}
+#else
+int
+vlq_decode_n_ssse3(const uint8_t *buf, int len, uint32_t *v, int max,
+	int *used)
+{
+	return vlq_decode_n_scalar(buf, len, v, max, used);
+}
+
+int
+vlq_decode_n_avx2(const uint8_t *buf, int len, uint32_t *v, int max,
+	int *used)
+{
+	return vlq_decode_n_scalar(buf, len, v, max, used);
+}
+#endif
+
+int
+vlq_decode_n(const uint8_t *buf, int len, uint32_t *v, int max, int *used)
+{
+	if (simd == 2)
+		return vlq_decode_n_avx2(buf, len, v, max, used);
+	if (simd == 1)
+		return vlq_decode_n_ssse3(buf, len, v, max, used);
+
+	return vlq_decode_n_scalar(buf, len, v, max, used);
+}
@@ -0,0 +1,104 @@
+#ifndef __VLQ__H__
+#define __VLQ__H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * the variable length quantities of the host protocol, as command.v
+ * parses and sends them: 7 bits per byte, most significant first, bit 7
+ * set on all but the last byte. The first byte sign extends if its bits
+ * 6 and 5 are set, so small negative values stay short. A 32 bit value
+ * takes at most VLQ_MAX bytes.
+ * Single values are encoded and decoded inline, whole arrays with the
+ * _n functions. Decoding looks at 64 bytes at a time with SSSE3 or AVX2
+ * where the cpu has it, see vlq.cpp, the plain loop is used otherwise.
+ */
+#define VLQ_MAX		5
+
+static inline uint8_t *
+vlq_encode(uint8_t *p, uint32_t v)
+{
+	int32_t sv = v;
+
+	if (sv < (3L<<5)  && sv >= -(1L<<5))
+		goto f4;
+	if (sv < (3L<<12) && sv >= -(1L<<12))
+		goto f3;
+	if (sv < (3L<<19) && sv >= -(1L<<19))
+		goto f2;
+	if (sv < (3L<<26) && sv >= -(1L<<26))
+		goto f1;
+	*p++ = (v>>28) | 0x80;
+f1:	*p++ = ((v>>21) & 0x7f) | 0x80;
+f2:	*p++ = ((v>>14) & 0x7f) | 0x80;
+f3:	*p++ = ((v>>7) & 0x7f) | 0x80;
+f4:	*p++ = v & 0x7f;
+
+	return p;
+}
+
+/* returns the bytes used, 0 if the buffer ends within the value */
+static inline int
+vlq_decode(const uint8_t *p, int len, uint32_t *val)
+{
+	const uint8_t *start = p;
+	const uint8_t *end = p + len;
+	uint8_t c;
+	uint32_t v;
+
+	if (p >= end)
+		return 0;
+	c = *p++;
+	v = c & 0x7f;
+	if ((c & 0x60) == 0x60)
+		v |= -0x20;
+	while (c & 0x80) {
+		if (p >= end)
+			return 0;
+		c = *p++;
+		v = (v << 7) | (c & 0x7f);
+	}
+	*val = v;
+
+	return p - start;
+}
+
+/*
+ * the n values at v into buf, which needs room for n * VLQ_MAX bytes.
+ * Returns the end of the encoded values
+ */
+uint8_t *vlq_encode_n(uint8_t *buf, const uint32_t *v, int n);
+
+/*
+ * up to max values of the len bytes at buf into v. Returns the number of
+ * values, *used the bytes they took. Stops in front of a value cut off
+ * by the end of buf
+ */
+int vlq_decode_n(const uint8_t *buf, int len, uint32_t *v, int max,
+	int *used);
+
+/*
+ * all values of a payload, e.g. a response. Returns their number, -1 if
+ * the payload ends within a value or has more than max
+ */
+static inline int
+vlq_decode_all(const uint8_t *buf, int len, uint32_t *v, int max)
+{
+	int used;
+	int n = vlq_decode_n(buf, len, v, max, &used);
+
+	return used == len ? n : -1;
+}
+
+/* implementations, for vlqbench */
+int vlq_decode_n_scalar(const uint8_t *buf, int len, uint32_t *v, int max,
+	int *used);
+int vlq_decode_n_ssse3(const uint8_t *buf, int len, uint32_t *v, int max,
+	int *used);
+int vlq_decode_n_avx2(const uint8_t *buf, int len, uint32_t *v, int max,
+	int *used);
+/* what vlq_decode_n uses: 0 plain, 1 SSSE3, 2 AVX2 */
+int vlq_simd(void);
+
+#endif
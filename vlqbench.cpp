@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "vlq.h"
+#include "bench.h"
+
+/*
+ * checks and throughput of the batch VLQ codec. The encoder is checked
+ * byte for byte against the per value one the harness used before, every
+ * decoder against it over streams of different value lengths, at all
+ * alignments and cut off at every length.
+ * Exits 1 if anything differs
+ */
+typedef int (*decode_fn)(const uint8_t *buf, int len, uint32_t *v, int max,
+	int *used);
+
+static const struct {
+	const char	*name;
+	decode_fn	fn;
+	int		level;		/* needed from vlq_simd() */
+} decoders[] = {
+	{ "scalar", vlq_decode_n_scalar, 0 },
+	{ "ssse3", vlq_decode_n_ssse3, 1 },
+	{ "avx2", vlq_decode_n_avx2, 2 },
+};
+#define NDECODERS (int)(sizeof(decoders) / sizeof(decoders[0]))
+
+/*
+ * value streams: single bytes only, the mix of RSP_STEPPER_GET_NEXT and
+ * RSP_DRO_DATA (type, channel and flags short, clocks and positions
+ * long), and full 5 byte values only
+ */
+enum { DIST_SHORT, DIST_RSP, DIST_WIDE, NDIST };
+static const char *dist_names[NDIST] = { "short", "response", "wide" };
+
+static uint32_t
+value(int dist)
+{
+	switch (dist) {
+	case DIST_SHORT:
+		return rnd32() % 128 - 32;
+	case DIST_RSP:
+		switch (rand() % 10) {
+		case 0: case 1: case 2: case 3:
+			return rand() % 16;
+		case 4: case 5:
+			return rand() % 4000;
+		case 6:
+			return rand() % 1000000 - 500000;
+		default:
+			return rnd32();
+		}
+	default:
+		return 0x10000000 | rnd32();
+	}
+}
+
+/* the encoder of the harness before */
+static uint8_t *
+ref_encode(uint8_t *p, uint32_t v)
+{
+	int32_t sv = v;
+
+	if (sv < (3L<<5)  && sv >= -(1L<<5))
+		goto f4;
+	if (sv < (3L<<12) && sv >= -(1L<<12))
+		goto f3;
+	if (sv < (3L<<19) && sv >= -(1L<<19))
+		goto f2;
+	if (sv < (3L<<26) && sv >= -(1L<<26))
+		goto f1;
+	*p++ = (v>>28) | 0x80;
+f1:	*p++ = ((v>>21) & 0x7f) | 0x80;
+f2:	*p++ = ((v>>14) & 0x7f) | 0x80;
+f3:	*p++ = ((v>>7) & 0x7f) | 0x80;
+f4:	*p++ = v & 0x7f;
+
+	return p;
+}
+
+#define NVALS		4096
+
+static uint32_t vals[NVALS];
+static uint8_t enc[NVALS * VLQ_MAX + 64];
+static uint8_t ref[NVALS * VLQ_MAX + 64];
+static uint32_t out[NVALS + 64];
+
+/* values at the edges of each length */
+static void
+edges(void)
+{
+	static const int32_t e[] = {
+		0, -1, 95, 96, -32, -33, 12287, 12288, -4096, -4097,
+		1572863, 1572864, -524288, -524289, 201326591, 201326592,
+		-67108864, -67108865, 0x7fffffff, (int32_t)0x80000000
+	};
+	int n = sizeof(e) / sizeof(e[0]);
+	uint8_t *p = ref;
+	uint8_t *q;
+	int used;
+	int i;
+
+	for (i = 0; i < n; ++i)
+		p = ref_encode(p, e[i]);
+	q = vlq_encode_n(enc, (const uint32_t *)e, n);
+	if (q - enc != p - ref || memcmp(enc, ref, p - ref) != 0) {
+		printf("encoding of the edge values differs\n");
+		++errors;
+	}
+	for (i = 0; i < NDECODERS; ++i) {
+		if (vlq_simd() < decoders[i].level)
+			continue;
+		if (decoders[i].fn(ref, p - ref, out, n, &used) != n ||
+		    used != p - ref || memcmp(out, e, sizeof(e)) != 0) {
+			printf("%s: decoding of the edge values differs\n",
+				decoders[i].name);
+			++errors;
+		}
+	}
+}
+
+static void
+compare(int dist)
+{
+	static uint32_t want[NVALS];
+	int len;
+	int off;
+	int i;
+	int d;
+
+	for (i = 0; i < NVALS; ++i)
+		vals[i] = value(dist);
+
+	/* the encoder, at all alignments */
+	for (off = 0; off < 16; ++off) {
+		uint8_t *p = ref;
+		uint8_t *q;
+
+		for (i = 0; i < NVALS; ++i)
+			p = ref_encode(p, vals[i]);
+		q = vlq_encode_n(enc + off, vals, NVALS);
+		if (q - enc - off != p - ref ||
+		    memcmp(enc + off, ref, p - ref) != 0) {
+			printf("%s: encoding differs at offset %d\n",
+				dist_names[dist], off);
+			++errors;
+			return;
+		}
+		len = p - ref;
+	}
+
+	/* the decoders, at all alignments and cut off anywhere */
+	for (d = 0; d < NDECODERS; ++d) {
+		if (vlq_simd() < decoders[d].level)
+			continue;
+		for (off = 0; off < 32; ++off) {
+			int used;
+			int l;
+
+			memcpy(enc + off, ref, len);
+			if (decoders[d].fn(enc + off, len, out, NVALS, &used) !=
+			    NVALS || used != len ||
+			    memcmp(out, vals, sizeof(vals)) != 0) {
+				printf("%s: %s differs on the whole stream at "
+					"offset %d\n", dist_names[dist],
+					decoders[d].name, off);
+				++errors;
+				return;
+			}
+			for (l = 0; l <= 256; ++l) {
+				int want_used;
+				int nwant;
+				int n;
+
+				nwant = vlq_decode_n_scalar(enc + off, l, want,
+					NVALS, &want_used);
+				n = decoders[d].fn(enc + off, l, out, NVALS,
+					&used);
+				if (n != nwant || used != want_used ||
+				    memcmp(out, want, n * 4) != 0) {
+					printf("%s: %s differs at offset %d "
+						"len %d\n", dist_names[dist],
+						decoders[d].name, off, l);
+					++errors;
+					return;
+				}
+				/* fewer values wanted than there are */
+				n = decoders[d].fn(enc + off, l, out, nwant / 2,
+					&used);
+				if (n != nwant / 2) {
+					printf("%s: %s ignores max at offset "
+						"%d len %d\n", dist_names[dist],
+						decoders[d].name, off, l);
+					++errors;
+					return;
+				}
+			}
+		}
+	}
+}
+
+#define BENCH_VALUES	(64 << 20)
+
+static void
+bench(void)
+{
+	volatile uint32_t sink = 0;
+	uint8_t *p;
+	int dist;
+	int len;
+	int d;
+	int i;
+
+	printf("simd level %d\n", vlq_simd());
+	for (dist = 0; dist < NDIST; ++dist) {
+		for (i = 0; i < NVALS; ++i)
+			vals[i] = value(dist);
+		len = vlq_encode_n(ref, vals, NVALS) - ref;
+		printf("%s values, %.2f bytes each\n", dist_names[dist],
+			(double)len / NVALS);
+
+		double t = now();
+		for (i = 0; i < BENCH_VALUES / NVALS; ++i) {
+			int j;
+
+			p = enc;
+			for (j = 0; j < NVALS; ++j)
+				p = ref_encode(p, vals[j]);
+			sink += p[-1];
+		}
+		t = now() - t;
+		printf("  %-16s %8.1f Mvalues/s\n", "encode single",
+			BENCH_VALUES / t / 1e6);
+		t = now();
+		for (i = 0; i < BENCH_VALUES / NVALS; ++i) {
+			p = vlq_encode_n(enc, vals, NVALS);
+			sink += p[-1];
+		}
+		t = now() - t;
+		printf("  %-16s %8.1f Mvalues/s\n", "encode batch",
+			BENCH_VALUES / t / 1e6);
+
+		for (d = 0; d < NDECODERS; ++d) {
+			int used;
+
+			if (vlq_simd() < decoders[d].level)
+				continue;
+			t = now();
+			for (i = 0; i < BENCH_VALUES / NVALS; ++i)
+				sink += decoders[d].fn(ref, len, out, NVALS,
+					&used);
+			t = now() - t;
+			printf("  decode %-9s %8.1f Mvalues/s %8.1f MB/s\n",
+				decoders[d].name, BENCH_VALUES / t / 1e6,
+				(double)BENCH_VALUES / NVALS * len / t / 1e6);
+		}
+	}
+}
+
+static void
+checks(void)
+{
+	int dist;
+
+	edges();
+	for (dist = 0; dist < NDIST; ++dist)
+		compare(dist);
+}
+
+int
+main(int argc, char **argv)
+{
+	return bench_main(argc, argv, checks, bench,
+		"encoder and decoders agree with the per value code");
+}
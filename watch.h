@@ -0,0 +1,1394 @@
+#ifndef __WATCH__H__
+#define __WATCH__H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <pcre.h>
+#include "trace.h"
+
+/*
+ * signal watch engine shared by the testbenches. Include after vsyms.h,
+ * it works on the vsigs[] table of the model at hand.
+ * Values of all watched signals live in two snapshot arenas, the current
+ * and the previous one. Each entry has a fixed offset into both, assigned
+ * in watch_add, so taking and comparing a snapshot is a plain copy and
+ * compare without any allocation. The arenas swap roles every cycle.
+ * Two more arenas with the same layout hold the masks: the value mask
+ * given to watch_add, and the trigger mask, which is the value mask for
+ * WF_WATCH entries and zero otherwise. Change detection for the whole set
+ * is one vectorized XOR/AND/test over the arenas; only if that finds a
+ * change are the entries compared one by one.
+ * Masks are given per element, one uint64_t for each of the vsigs[].num
+ * elements, and are stored in the byte order of the host. For wide
+ * elements the mask covers the lowest 64 bits, the words above are always
+ * watched.
+ * While a trace is open, every watched signal also goes into the trace,
+ * independent of masks and flags, along with the signals of the groups
+ * given when starting it.
+ * Triggers are expressions over signals, evaluated in each do_watch. They
+ * call back whenever their value changes, see watch_trigger.
+ */
+#define WF_WATCH	1
+#define WF_PRINT	2
+#define WF_ALL		(WF_WATCH | WF_PRINT)
+
+#define FORM_BIN	1
+#define FORM_HEX	2
+#define FORM_DEC	3
+
+#define COLOR_NONE	1
+#define COLOR_CHANGED	2
+#define COLOR_ALWAYS	3
+
+#define WATCH_ALIGN	8	/* of each entry in the arenas */
+#define WATCH_VEC	32	/* arena alignment and compare width */
+
+typedef uint64_t watch_vec_t __attribute__((vector_size(WATCH_VEC)));
+
+static int color_disabled = 0;
+
+static void fail(const char *msg, ...);
+
+typedef struct _watch_entry {
+	int		sig;	/* signal number */
+	char		*nick;
+	int		flags;
+	int		format;
+	int		cmp;
+	void		*owner;	/* task that added the entry */
+	const uint8_t	*src;	/* signal in the model */
+	int		len;
+	int		off;	/* offset in the snapshot arenas */
+} watch_entry_t;
+
+typedef struct _trigger trigger_t;
+
+typedef struct _watch {
+	watch_entry_t	*we;
+	int		n;
+	const uint8_t	*tb;	/* model, base of vsigs[].offset */
+	uint64_t	last_cycle;
+	void		*owner;	/* owner for entries added from now on */
+	uint8_t		*snap[2];
+	uint8_t		*mask;	/* value masks */
+	uint8_t		*trig;	/* masks for change detection */
+	int		cur;	/* snap[cur] holds the latest values */
+	int		used;	/* bytes in use in each arena */
+	int		size;	/* bytes allocated for each arena */
+	trace_t		*trace;	/* waveform output, if any */
+	trigger_t	*triggers;
+	int		trig_dead;	/* removed triggers not freed yet */
+} watch_t;
+
+static watch_t *
+watch_init(const void *tb)
+{
+	watch_t *wp = (watch_t *)calloc(sizeof(*wp), 1);
+	wp->we = (watch_entry_t *)calloc(sizeof(*wp->we), NSIGS * 10);
+	wp->tb = (const uint8_t *)tb;
+
+	return wp;
+}
+
+/* sizes come precomputed from gensyms.pl */
+static inline int
+sig_to_len(int sig)
+{
+	return vsigs[sig].len;
+}
+
+/* latest snapshot of the entry */
+static inline void *
+watch_val(watch_t *wp, watch_entry_t *we)
+{
+	return wp->snap[wp->cur] + we->off;
+}
+
+static inline int
+sig_elem_len(int sig)
+{
+	return vsigs[sig].elem_len;
+}
+
+/*
+ * compare one entry of two snapshots under the given mask arena
+ */
+static int
+watch_cmp_masked(watch_entry_t *we, const uint8_t *a, const uint8_t *b,
+	const uint8_t *mask)
+{
+	int i;
+
+	a += we->off;
+	b += we->off;
+	mask += we->off;
+	for (i = 0; i < we->len; ++i)
+		if ((a[i] ^ b[i]) & mask[i])
+			return 1;
+
+	return 0;
+}
+
+/*
+ * signal lookup. Exact names and scopes are served from the sorted index
+ * generated by gensyms.pl, name suffixes from the index sorted by the
+ * reversed names. Regular expressions are compiled only once, the list of
+ * signals they match is cached by pattern
+ */
+static int
+sig_lookup(const char *name)
+{
+	int lo = 0;
+	int hi = NSIGS;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		int ret = strcmp(vsigs[vsig_sorted[mid]].name, name);
+
+		if (ret == 0)
+			return vsig_sorted[mid];
+		if (ret < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return -1;
+}
+
+/*
+ * all signals whose name starts with prefix, as a range in vsig_sorted.
+ * Returns the number of signals
+ */
+static int
+sig_prefix(const char *prefix, int *first)
+{
+	int len = strlen(prefix);
+	int lo = 0;
+	int hi = NSCOPES;
+	int start;
+
+	if (len > 0 && prefix[len - 1] == '.') {
+		/* hierarchy scope, straight from the table */
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			int ret = strcmp(vscopes[mid].name, prefix);
+
+			if (ret == 0) {
+				*first = vscopes[mid].first;
+				return vscopes[mid].num;
+			}
+			if (ret < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		*first = 0;
+		return 0;
+	}
+
+	/* lower bound, then all entries sharing the prefix */
+	lo = 0;
+	hi = NSIGS;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (strcmp(vsigs[vsig_sorted[mid]].name, prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	start = lo;
+	while (lo < (int)NSIGS &&
+	    strncmp(vsigs[vsig_sorted[lo]].name, prefix, len) == 0)
+		++lo;
+	*first = start;
+
+	return lo - start;
+}
+
+/* compares name to suffix from their ends, as strcmp of both reversed */
+static int
+sig_rcmp(const char *name, const char *suffix, int len)
+{
+	int nlen = strlen(name);
+	int i;
+
+	for (i = 1; i <= nlen && i <= len; ++i)
+		if (name[nlen - i] != suffix[len - i])
+			return (unsigned char)name[nlen - i] -
+				(unsigned char)suffix[len - i];
+
+	return nlen - len;
+}
+
+/*
+ * all signals whose name ends in suffix, as a range in vsig_rsorted.
+ * Returns the number of signals
+ */
+static int
+sig_suffix(const char *suffix, int *first)
+{
+	int len = strlen(suffix);
+	int lo = 0;
+	int hi = NSIGS;
+	int start;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (sig_rcmp(vsigs[vsig_rsorted[mid]].name, suffix, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	start = lo;
+	while (lo < (int)NSIGS) {
+		const char *name = vsigs[vsig_rsorted[lo]].name;
+		int nlen = strlen(name);
+
+		if (nlen < len || memcmp(name + nlen - len, suffix, len) != 0)
+			break;
+		++lo;
+	}
+	*first = start;
+
+	return lo - start;
+}
+
+typedef struct _sigcache {
+	char			*pattern;
+	int			*match;	/* matching signals, ascending */
+	int			n;
+	struct _sigcache	*next;
+} sigcache_t;
+
+#define SIGCACHE_HASH	256
+static sigcache_t *sigcache[SIGCACHE_HASH];
+
+static const char *sig_meta = "\\^$.|?*+()[]{}";
+
+/*
+ * the literal text at the start of pattern, with escaped punctuation like
+ * \. taken as the plain character. Stops at the first other meta
+ * character. Returns the number of pattern characters consumed
+ */
+static int
+sig_lit_head(const char *pattern, char *lit)
+{
+	const char *p = pattern;
+	int len = 0;
+
+	while (*p) {
+		if (p[0] == '\\' && p[1] != 0 &&
+		    !isalnum((unsigned char)p[1])) {
+			lit[len++] = p[1];
+			p += 2;
+		} else if (strchr(sig_meta, *p) == NULL) {
+			lit[len++] = *p++;
+		} else {
+			break;
+		}
+	}
+	lit[len] = 0;
+
+	return p - pattern;
+}
+
+/* number of backslashes right in front of pattern[i] */
+static int
+sig_escapes(const char *pattern, int i)
+{
+	int n = 0;
+
+	while (i - n > 0 && pattern[i - n - 1] == '\\')
+		++n;
+
+	return n;
+}
+
+/*
+ * the literal text in front of the closing $ of pattern, read backwards
+ * like sig_lit_head reads forward. Returns its length, 0 if the pattern
+ * does not end in $
+ */
+static int
+sig_lit_tail(const char *pattern, char *lit)
+{
+	int i = strlen(pattern) - 1;
+	int len = 0;
+	int j;
+
+	if (i < 0 || pattern[i] != '$' || sig_escapes(pattern, i) % 2)
+		return 0;
+	while (--i >= 0) {
+		if (sig_escapes(pattern, i) % 2) {
+			if (isalnum((unsigned char)pattern[i]))
+				break;
+			lit[len++] = pattern[i--];
+		} else if (strchr(sig_meta, pattern[i]) == NULL) {
+			lit[len++] = pattern[i];
+		} else {
+			break;
+		}
+	}
+	for (j = 0; j < len / 2; ++j) {
+		char c = lit[j];
+
+		lit[j] = lit[len - 1 - j];
+		lit[len - 1 - j] = c;
+	}
+	lit[len] = 0;
+
+	return len;
+}
+
+static int
+sig_cmp_int(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * all signals matching the regular expression
+ */
+static sigcache_t *
+sig_match(const char *pattern)
+{
+	unsigned int h = 5381;
+	const char *p;
+	sigcache_t *sc;
+	const char *err_str;
+	int err_off;
+	char lit[strlen(pattern) + 1];
+	const int *sorted = NULL;
+	int first = 0;
+	int num = NSIGS;
+	int len;
+	int end;
+	int ret;
+	int i;
+	pcre *comp;
+
+	for (p = pattern; *p; ++p)
+		h = h * 33 + (unsigned char)*p;
+	h %= SIGCACHE_HASH;
+	for (sc = sigcache[h]; sc != NULL; sc = sc->next)
+		if (strcmp(sc->pattern, pattern) == 0)
+			return sc;
+
+	sc = (sigcache_t *)calloc(1, sizeof(*sc));
+	sc->pattern = strdup(pattern);
+	sc->next = sigcache[h];
+	sigcache[h] = sc;
+
+	/*
+	 * the literal part after a ^ or in front of a $ narrows down the
+	 * candidates, unless an alternative can match without it
+	 */
+	if (pattern[0] == '^' && strchr(pattern, '|') == NULL) {
+		end = 1 + sig_lit_head(pattern + 1, lit);
+		len = strlen(lit);
+		if (pattern[end] == '$' && pattern[end + 1] == 0) {
+			i = sig_lookup(lit);
+			if (i >= 0) {
+				sc->match = (int *)malloc(sizeof(int));
+				sc->match[sc->n++] = i;
+			}
+			return sc;
+		}
+		/* a quantifier makes the last literal char optional */
+		if (len > 0 && pattern[end] != 0 &&
+		    strchr("?*{", pattern[end]) != NULL)
+			lit[--len] = 0;
+		if (len > 0) {
+			num = sig_prefix(lit, &first);
+			sorted = vsig_sorted;
+		}
+	}
+	if (sorted == NULL && strchr(pattern, '|') == NULL &&
+	    sig_lit_tail(pattern, lit) > 0) {
+		num = sig_suffix(lit, &first);
+		sorted = vsig_rsorted;
+	}
+
+	comp = pcre_compile(pattern, 0, &err_str, &err_off, NULL);
+	if (comp == NULL) {
+		printf("name %s not a valid regexp: %s\n", pattern, err_str);
+		exit(1);
+	}
+	sc->match = (int *)malloc(sizeof(int) * (num ? num : 1));
+	for (i = 0; i < num; ++i) {
+		int sig = sorted != NULL ? sorted[first + i] : i;
+
+		ret = pcre_exec(comp, NULL, vsigs[sig].name,
+			strlen(vsigs[sig].name), 0, 0, NULL, 0);
+		if (ret == PCRE_ERROR_NOMATCH)
+			continue;
+		if (ret < 0) {
+			printf("pcre match failed with %d\n", ret);
+			exit(1);
+		}
+		sc->match[sc->n++] = sig;
+	}
+	pcre_free(comp);
+	/* keep the order of vsigs, as without the index */
+	if (sorted != NULL)
+		qsort(sc->match, sc->n, sizeof(int), sig_cmp_int);
+
+	return sc;
+}
+
+/*
+ * next signal matching name, starting at signal number *start
+ */
+static int
+find_signal(const char *name, int *start)
+{
+	sigcache_t *sc = sig_match(name);
+	int i;
+
+	for (i = 0; i < sc->n; ++i) {
+		if (sc->match[i] >= *start) {
+			*start = sc->match[i] + 1;
+			return sc->match[i];
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * reserve len bytes in all arenas. Only called from watch_add, never
+ * while taking snapshots
+ */
+static int
+watch_alloc(watch_t *wp, int len)
+{
+	int off = wp->used;
+	int i;
+
+	len = (len + WATCH_ALIGN - 1) & ~(WATCH_ALIGN - 1);
+	if (off + len > wp->size) {
+		int size = wp->size ? wp->size : 1024;
+
+		while (off + len > size)
+			size *= 2;
+		for (i = 0; i < 4; ++i) {
+			uint8_t **arena = i < 2 ? wp->snap + i :
+				i == 2 ? &wp->mask : &wp->trig;
+			void *p;
+
+			if (posix_memalign(&p, WATCH_VEC, size) != 0) {
+				printf("out of memory for watch snapshots\n");
+				exit(1);
+			}
+			/* unused tail never compares as changed */
+			memset(p, 0, size);
+			if (*arena != NULL) {
+				memcpy(p, *arena, wp->used);
+				free(*arena);
+			}
+			*arena = (uint8_t *)p;
+		}
+		wp->size = size;
+	}
+	wp->used += len;
+
+	return off;
+}
+
+/*
+ * close the gaps left by removed entries
+ */
+static void
+watch_compact(watch_t *wp)
+{
+	uint8_t *arenas[4] = { wp->snap[0], wp->snap[1], wp->mask, wp->trig };
+	int used = 0;
+	int i;
+	int j;
+
+	for (i = 0; i < wp->n; ++i) {
+		watch_entry_t *we = wp->we + i;
+		int len = (we->len + WATCH_ALIGN - 1) & ~(WATCH_ALIGN - 1);
+
+		if (we->off != used) {
+			for (j = 0; j < 4; ++j)
+				memmove(arenas[j] + used, arenas[j] + we->off,
+					len);
+			we->off = used;
+		}
+		used += len;
+	}
+	if (used < wp->used) {
+		/* keep the freed tail out of the compare */
+		memset(wp->mask + used, 0, wp->used - used);
+		memset(wp->trig + used, 0, wp->used - used);
+	}
+	wp->used = used;
+}
+
+static void
+watch_set_mask(watch_t *wp, watch_entry_t *we, uint64_t *mask)
+{
+	int elen = sig_elem_len(we->sig);
+	int i;
+
+	for (i = 0; i < vsigs[we->sig].num; ++i) {
+		uint64_t m = mask ? mask[i] : ~0ull;
+		uint8_t *dst = wp->mask + we->off + i * elen;
+
+		if (elen > 8) {
+			memcpy(dst, &m, 8);
+			memset(dst + 8, 0xff, elen - 8);
+		} else {
+			memcpy(dst, &m, elen);
+		}
+	}
+	if (we->flags & WF_WATCH)
+		memcpy(wp->trig + we->off, wp->mask + we->off, we->len);
+	else
+		memset(wp->trig + we->off, 0, we->len);
+}
+
+static void
+watch_trace_sig(watch_t *wp, int sig)
+{
+	signal_t *s = vsigs + sig;
+	const uint8_t *src = wp->tb + s->offset;
+	int width = s->range_start - s->range_end + 1;
+	int elen = sig_elem_len(sig);
+	char name[strlen(s->name) + 16];
+	int i;
+
+	if (s->num == 1) {
+		trace_var(wp->trace, s->name, width, src, sig_to_len(sig));
+		return;
+	}
+	for (i = 0; i < s->num; ++i) {
+		snprintf(name, sizeof(name), "%s[%d]", s->name, i);
+		trace_var(wp->trace, name, width, src + i * elen, elen);
+	}
+}
+
+/*
+ * start tracing the watched signals plus all signals matching any of the
+ * given patterns into path
+ */
+static void
+watch_trace_start(watch_t *wp, const char *path, const char *top,
+	uint64_t period_ps, const char **groups, int ngroups)
+{
+	int i;
+	int sig;
+
+	wp->trace = trace_open(path, top, period_ps);
+	printf("trace: writing to %s\n", path);
+	for (i = 0; i < wp->n; ++i)
+		watch_trace_sig(wp, wp->we[i].sig);
+	for (i = 0; i < ngroups; ++i) {
+		int _r = 0;
+
+		while ((sig = find_signal(groups[i], &_r)) >= 0)
+			watch_trace_sig(wp, sig);
+	}
+}
+
+static void
+watch_trace_stop(watch_t *wp)
+{
+	if (wp->trace == NULL)
+		return;
+	trace_close(wp->trace);
+	wp->trace = NULL;
+}
+
+static void
+watch_add(watch_t *wp, const char *name, const char *nick, uint64_t *mask,
+	int format, int flags)
+{
+	int _r = 0;
+	int at_least_one = 0;
+	int sig;
+
+	while ((sig = find_signal(name, &_r)) >= 0) {
+		watch_entry_t *we = wp->we + wp->n;
+
+		if (nick)
+			printf("watch: adding %s as %s\n", vsigs[sig].name, nick);
+		else
+			printf("watch: adding %s as <unnamed>\n", vsigs[sig].name);
+		we->sig = sig;
+		we->nick = nick ? strdup(nick) : NULL;
+		we->flags = flags;
+		we->format = format;
+		we->owner = wp->owner;
+		we->src = wp->tb + vsigs[sig].offset;
+		we->len = sig_to_len(sig);
+		we->off = watch_alloc(wp, we->len);
+		we->cmp = 0;
+		memcpy(watch_val(wp, we), we->src, we->len);
+		watch_set_mask(wp, we, mask);
+		if (wp->trace)
+			watch_trace_sig(wp, sig);
+		++wp->n;
+		if (wp->n == NSIGS * 10) {
+			printf("too many signals in watchlist\n");
+			exit(1);
+		}
+		at_least_one = 1;
+		nick = NULL;
+	}
+	if (!at_least_one) {
+		printf("name %s doesn't match any signal\n", name);
+		exit(0);
+	}
+}
+
+static void
+watch_remove(watch_t *wp, const char *name)
+{
+	int _r = 0;
+	int sig;
+	int i;
+
+	while ((sig = find_signal(name, &_r)) >= 0) {
+		for (i = 0; i < wp->n; ++i) {
+			if (wp->we[i].sig == sig) {
+				free(wp->we[i].nick);
+				memmove(wp->we + i, wp->we + i + 1, sizeof(*wp->we) * (wp->n - i));
+				--wp->n;
+				break;
+			}
+		}
+	}
+	watch_compact(wp);
+}
+
+/*
+ * triggers: expressions over signals, compiled once into RPN when added
+ * and evaluated in do_watch. The callback runs whenever the value of the
+ * expression changes, with the new value.
+ * Operands are signals of up to 64 bits, array elements as name[i], and
+ * constants in decimal, 0x hex or 0b binary. Names are looked up exactly
+ * first, otherwise as a regular expression that has to match a single
+ * signal. rise(x) and fall(x) are true in the evaluation in which x went
+ * from 0 to non-0 or back.
+ * Operators, by increasing precedence: || && | ^ & == != < > <= >= + -
+ * and the unary ! ~ -.
+ */
+#define TRIG_MAXOPS	64
+#define TRIG_MAXSRC	16
+#define TRIG_STACK	32
+
+enum {
+	TOP_CONST,
+	TOP_SIG,
+	TOP_RISE,
+	TOP_FALL,
+	TOP_NOT,
+	TOP_INV,
+	TOP_NEG,
+	TOP_OR,
+	TOP_AND,
+	TOP_BOR,
+	TOP_BXOR,
+	TOP_BAND,
+	TOP_EQ,
+	TOP_NE,
+	TOP_LT,
+	TOP_GT,
+	TOP_LE,
+	TOP_GE,
+	TOP_ADD,
+	TOP_SUB,
+};
+
+typedef struct _trig_op {
+	int		op;
+	uint64_t	val;	/* constant or index into src */
+} trig_op_t;
+
+typedef struct _trig_src {
+	const uint8_t	*src;	/* signal or array element in the model */
+	int		len;
+	uint64_t	last;	/* value at the last evaluation */
+} trig_src_t;
+
+typedef void (*trigger_fn_t)(trigger_t *tp, int level, uint64_t cycle,
+	void *arg);
+
+struct _trigger {
+	char		*name;
+	char		*expr;
+	trig_op_t	code[TRIG_MAXOPS];
+	int		nops;
+	trig_src_t	src[TRIG_MAXSRC];
+	int		nsrc;
+	int		level;	/* value of the last evaluation */
+	int		edge;	/* uses rise or fall */
+	uint64_t	hits;	/* times it became true */
+	uint64_t	cycle;	/* when it last became true */
+	trigger_fn_t	fn;
+	void		*arg;
+	void		*owner;
+	int		dead;
+	struct _trigger	*next;
+};
+
+typedef struct _trig_parse {
+	trigger_t	*tp;
+	const uint8_t	*tb;
+	const char	*p;
+	int		depth;	/* of the evaluation stack */
+} trig_parse_t;
+
+static const struct {
+	const char	*tok;
+	int		op;
+	int		prec;
+} trig_binops[] = {
+	/* two char tokens first */
+	{ "||", TOP_OR, 1 },
+	{ "&&", TOP_AND, 2 },
+	{ "==", TOP_EQ, 6 },
+	{ "!=", TOP_NE, 6 },
+	{ "<=", TOP_LE, 7 },
+	{ ">=", TOP_GE, 7 },
+	{ "|", TOP_BOR, 3 },
+	{ "^", TOP_BXOR, 4 },
+	{ "&", TOP_BAND, 5 },
+	{ "<", TOP_LT, 7 },
+	{ ">", TOP_GT, 7 },
+	{ "+", TOP_ADD, 8 },
+	{ "-", TOP_SUB, 8 },
+	{ NULL, 0, 0 }
+};
+
+static void
+trig_error(trig_parse_t *pp, const char *msg)
+{
+	printf("trigger %s: %s at \"%s\"\n", pp->tp->expr, msg, pp->p);
+	exit(1);
+}
+
+static void
+trig_skip(trig_parse_t *pp)
+{
+	while (*pp->p == ' ' || *pp->p == '\t')
+		++pp->p;
+}
+
+static void
+trig_emit(trig_parse_t *pp, int op, uint64_t val)
+{
+	trigger_t *tp = pp->tp;
+
+	if (tp->nops == TRIG_MAXOPS)
+		trig_error(pp, "expression too long");
+	tp->code[tp->nops].op = op;
+	tp->code[tp->nops].val = val;
+	++tp->nops;
+	if (op == TOP_RISE || op == TOP_FALL)
+		tp->edge = 1;
+
+	/* operands push, binary operators pop two and push one */
+	if (op <= TOP_FALL)
+		++pp->depth;
+	else if (op >= TOP_OR)
+		--pp->depth;
+	if (pp->depth > TRIG_STACK)
+		trig_error(pp, "expression too deep");
+}
+
+/*
+ * signal operand, returns the index into the source list
+ */
+static int
+trig_signal(trig_parse_t *pp)
+{
+	trigger_t *tp = pp->tp;
+	const char *start = pp->p;
+	const uint8_t *src;
+	int idx = 0;
+	int len;
+	int sig;
+	int i;
+
+	while (*pp->p == '_' || *pp->p == '.' || (*pp->p >= '0' &&
+	    *pp->p <= '9') || (*pp->p >= 'a' && *pp->p <= 'z') ||
+	    (*pp->p >= 'A' && *pp->p <= 'Z'))
+		++pp->p;
+	if (pp->p == start)
+		trig_error(pp, "operand expected");
+
+	char name[pp->p - start + 1];
+
+	memcpy(name, start, pp->p - start);
+	name[pp->p - start] = 0;
+	sig = sig_lookup(name);
+	if (sig < 0) {
+		int _r = 0;
+
+		sig = find_signal(name, &_r);
+		if (sig >= 0 && find_signal(name, &_r) >= 0)
+			trig_error(pp, "name matches more than one signal");
+	}
+	if (sig < 0)
+		trig_error(pp, "unknown signal");
+	if (vsigs[sig].elem_len > 8)
+		trig_error(pp, "signal wider than 64 bits");
+
+	trig_skip(pp);
+	if (*pp->p == '[') {
+		idx = strtol(pp->p + 1, (char **)&pp->p, 0);
+		trig_skip(pp);
+		if (*pp->p != ']')
+			trig_error(pp, "] expected");
+		++pp->p;
+		if (idx < 0 || idx >= vsigs[sig].num)
+			trig_error(pp, "index out of range");
+	} else if (vsigs[sig].num > 1) {
+		trig_error(pp, "array signal needs an index");
+	}
+
+	len = sig_elem_len(sig);
+	src = pp->tb + vsigs[sig].offset + idx * len;
+	for (i = 0; i < tp->nsrc; ++i)
+		if (tp->src[i].src == src && tp->src[i].len == len)
+			return i;
+	if (tp->nsrc == TRIG_MAXSRC)
+		trig_error(pp, "too many signals");
+	tp->src[tp->nsrc].src = src;
+	tp->src[tp->nsrc].len = len;
+
+	return tp->nsrc++;
+}
+
+static void trig_expr(trig_parse_t *pp, int min_prec);
+
+static void
+trig_primary(trig_parse_t *pp)
+{
+	const char *p;
+	int op;
+
+	trig_skip(pp);
+	p = pp->p;
+	if (*p == '(') {
+		++pp->p;
+		trig_expr(pp, 1);
+		if (*pp->p != ')')
+			trig_error(pp, ") expected");
+		++pp->p;
+	} else if (*p == '!' || *p == '~' || *p == '-') {
+		op = *p == '!' ? TOP_NOT : *p == '~' ? TOP_INV : TOP_NEG;
+		++pp->p;
+		trig_primary(pp);
+		trig_emit(pp, op, 0);
+	} else if (*p >= '0' && *p <= '9') {
+		if (p[0] == '0' && p[1] == 'b')
+			trig_emit(pp, TOP_CONST, strtoull(p + 2, (char **)&pp->p,
+				2));
+		else
+			trig_emit(pp, TOP_CONST, strtoull(p, (char **)&pp->p, 0));
+	} else if (strncmp(p, "rise(", 5) == 0 || strncmp(p, "fall(", 5) == 0) {
+		op = p[0] == 'r' ? TOP_RISE : TOP_FALL;
+		pp->p += 5;
+		trig_skip(pp);
+		trig_emit(pp, op, trig_signal(pp));
+		trig_skip(pp);
+		if (*pp->p != ')')
+			trig_error(pp, ") expected");
+		++pp->p;
+	} else {
+		trig_emit(pp, TOP_SIG, trig_signal(pp));
+	}
+	trig_skip(pp);
+}
+
+/*
+ * precedence climbing, emits the operators in RPN order
+ */
+static void
+trig_expr(trig_parse_t *pp, int min_prec)
+{
+	int i;
+
+	trig_primary(pp);
+	for (;;) {
+		for (i = 0; trig_binops[i].tok != NULL; ++i)
+			if (strncmp(pp->p, trig_binops[i].tok,
+			    strlen(trig_binops[i].tok)) == 0)
+				break;
+		if (trig_binops[i].tok == NULL || trig_binops[i].prec < min_prec)
+			return;
+		pp->p += strlen(trig_binops[i].tok);
+		trig_expr(pp, trig_binops[i].prec + 1);
+		trig_emit(pp, trig_binops[i].op, 0);
+	}
+}
+
+static inline uint64_t
+trig_load(const trig_src_t *ts)
+{
+	uint64_t v = 0;
+
+	memcpy(&v, ts->src, ts->len);
+
+	return v;
+}
+
+static int
+trigger_eval(trigger_t *tp)
+{
+	uint64_t cur[TRIG_MAXSRC];
+	uint64_t st[TRIG_STACK];
+	uint64_t b = 0;
+	int n = 0;
+	int i;
+
+	for (i = 0; i < tp->nsrc; ++i)
+		cur[i] = trig_load(tp->src + i);
+	for (i = 0; i < tp->nops; ++i) {
+		const trig_op_t *op = tp->code + i;
+
+		if (op->op >= TOP_OR)
+			b = st[--n];
+		switch (op->op) {
+		case TOP_CONST:	st[n++] = op->val; break;
+		case TOP_SIG:	st[n++] = cur[op->val]; break;
+		case TOP_RISE:	st[n++] = cur[op->val] && !tp->src[op->val].last; break;
+		case TOP_FALL:	st[n++] = !cur[op->val] && tp->src[op->val].last; break;
+		case TOP_NOT:	st[n - 1] = !st[n - 1]; break;
+		case TOP_INV:	st[n - 1] = ~st[n - 1]; break;
+		case TOP_NEG:	st[n - 1] = -st[n - 1]; break;
+		case TOP_OR:	st[n - 1] = st[n - 1] || b; break;
+		case TOP_AND:	st[n - 1] = st[n - 1] && b; break;
+		case TOP_BOR:	st[n - 1] |= b; break;
+		case TOP_BXOR:	st[n - 1] ^= b; break;
+		case TOP_BAND:	st[n - 1] &= b; break;
+		case TOP_EQ:	st[n - 1] = st[n - 1] == b; break;
+		case TOP_NE:	st[n - 1] = st[n - 1] != b; break;
+		case TOP_LT:	st[n - 1] = st[n - 1] < b; break;
+		case TOP_GT:	st[n - 1] = st[n - 1] > b; break;
+		case TOP_LE:	st[n - 1] = st[n - 1] <= b; break;
+		case TOP_GE:	st[n - 1] = st[n - 1] >= b; break;
+		case TOP_ADD:	st[n - 1] += b; break;
+		case TOP_SUB:	st[n - 1] -= b; break;
+		}
+	}
+	for (i = 0; i < tp->nsrc; ++i)
+		tp->src[i].last = cur[i];
+
+	return st[0] != 0;
+}
+
+static trigger_t *
+trig_new(watch_t *wp, const char *name, const char *expr, trigger_fn_t fn,
+	void *arg)
+{
+	trigger_t *tp = (trigger_t *)calloc(1, sizeof(*tp));
+
+	tp->name = strdup(name ? name : expr);
+	tp->expr = strdup(expr);
+	tp->fn = fn;
+	tp->arg = arg;
+	tp->owner = wp->owner;
+
+	return tp;
+}
+
+/* the compiled trigger goes live */
+static trigger_t *
+trig_add(watch_t *wp, trigger_t *tp, int verbose)
+{
+	int i;
+
+	for (i = 0; i < tp->nsrc; ++i)
+		tp->src[i].last = trig_load(tp->src + i);
+	if (verbose)
+		printf("watch: adding trigger %s\n", tp->name);
+
+	tp->next = wp->triggers;
+	wp->triggers = tp;
+
+	if (trigger_eval(tp)) {
+		tp->level = 1;
+		++tp->hits;
+		tp->cycle = wp->last_cycle;
+		if (tp->fn)
+			tp->fn(tp, 1, tp->cycle, tp->arg);
+	}
+
+	return tp;
+}
+
+/*
+ * add a trigger. fn may be NULL for triggers that are only polled through
+ * level or hits. If the expression is already true, fn is called right
+ * away
+ */
+static trigger_t *
+watch_trigger(watch_t *wp, const char *name, const char *expr,
+	trigger_fn_t fn, void *arg)
+{
+	trigger_t *tp = trig_new(wp, name, expr, fn, arg);
+	trig_parse_t pp;
+
+	pp.tp = tp;
+	pp.tb = wp->tb;
+	pp.p = tp->expr;
+	pp.depth = 0;
+	trig_expr(&pp, 1);
+	if (*pp.p != 0)
+		trig_error(&pp, "operator expected");
+
+	return trig_add(wp, tp, name != NULL);
+}
+
+/*
+ * trigger on len bytes at src being val, for signals known at compile
+ * time, see vsig_ptr(). Nothing to parse or look up
+ */
+static trigger_t *
+watch_trigger_eq(watch_t *wp, const char *sig, const void *src, int len,
+	uint64_t val, trigger_fn_t fn, void *arg)
+{
+	char expr[strlen(sig) + 32];
+	trigger_t *tp;
+
+	snprintf(expr, sizeof(expr), "%s == %lu", sig, val);
+	tp = trig_new(wp, NULL, expr, fn, arg);
+	tp->src[0].src = (const uint8_t *)src;
+	tp->src[0].len = len;
+	tp->nsrc = 1;
+	tp->code[0].op = TOP_SIG;
+	tp->code[0].val = 0;
+	tp->code[1].op = TOP_CONST;
+	tp->code[1].val = val;
+	tp->code[2].op = TOP_EQ;
+	tp->nops = 3;
+
+	return trig_add(wp, tp, 0);
+}
+
+/*
+ * triggers may be removed from their own callbacks, so they are only
+ * marked here and freed in the next evaluation
+ */
+static void
+watch_trigger_remove(watch_t *wp, trigger_t *tp)
+{
+	tp->dead = 1;
+	tp->fn = NULL;
+	++wp->trig_dead;
+}
+
+static void
+watch_trigger_purge(watch_t *wp)
+{
+	trigger_t **tpp = &wp->triggers;
+
+	while (*tpp != NULL) {
+		trigger_t *tp = *tpp;
+
+		if (!tp->dead) {
+			tpp = &tp->next;
+			continue;
+		}
+		*tpp = tp->next;
+		free(tp->name);
+		free(tp->expr);
+		free(tp);
+	}
+	wp->trig_dead = 0;
+}
+
+static void
+watch_triggers_eval(watch_t *wp, uint64_t cycle)
+{
+	trigger_t *tp;
+	int level;
+
+	if (wp->trig_dead)
+		watch_trigger_purge(wp);
+
+	for (tp = wp->triggers; tp != NULL; tp = tp->next) {
+		if (tp->dead)
+			continue;
+		level = trigger_eval(tp);
+		if (level == tp->level)
+			continue;
+		tp->level = level;
+		if (level) {
+			++tp->hits;
+			tp->cycle = cycle;
+		}
+		if (tp->fn)
+			tp->fn(tp, level, cycle, tp->arg);
+	}
+}
+
+/*
+ * any signal used by a trigger changed since the last evaluation. Nothing
+ * else can change the value of an expression, except for an edge going
+ * away again in the next evaluation
+ */
+static int
+watch_triggers_changed(watch_t *wp)
+{
+	trigger_t *tp;
+	int i;
+
+	for (tp = wp->triggers; tp != NULL; tp = tp->next) {
+		if (tp->dead)
+			continue;
+		if (tp->edge && tp->level)
+			return 1;
+		for (i = 0; i < tp->nsrc; ++i)
+			if (trig_load(tp->src + i) != tp->src[i].last)
+				return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * remove all entries and triggers of the current owner, those of
+ * concurrently running tasks stay
+ */
+static void
+watch_clear(watch_t *wp)
+{
+	trigger_t *tp;
+	int i;
+	int n = 0;
+
+	for (tp = wp->triggers; tp != NULL; tp = tp->next)
+		if (tp->owner == wp->owner && !tp->dead)
+			watch_trigger_remove(wp, tp);
+
+	for (i = 0; i < wp->n; ++i) {
+		if (wp->we[i].owner != wp->owner) {
+			wp->we[n++] = wp->we[i];
+			continue;
+		}
+		free(wp->we[i].nick);
+	}
+	wp->n = n;
+	watch_compact(wp);
+}
+
+#define C_BLACK "\e[30m"
+#define C_RED "\e[31m"
+#define C_GREEN "\e[32m"
+#define C_YELLOW "\e[33m"
+#define C_BLUE "\e[34m"
+#define C_MAGENTA "\e[35m"
+#define C_CYAN "\e[36m"
+#define C_WHITE "\e[37m"
+#define C_RESET "\e[0m"
+static void
+print_value(watch_t *wp, watch_entry_t *we, int do_color)
+{
+	const char *c = NULL;
+	uint8_t *v = (uint8_t *)watch_val(wp, we);
+	uint8_t *m = wp->mask + we->off;
+	int elen = sig_elem_len(we->sig);
+
+	if (color_disabled)
+		do_color = COLOR_NONE;
+	if (do_color == COLOR_CHANGED && we->cmp)
+		c = C_RED;
+	else if (do_color == COLOR_ALWAYS)
+		c = C_GREEN;
+	if (we->nick)
+		printf(" %s %s", we->nick, c ? c : "");
+	else
+		printf(" %s", c ? c : "");
+
+	for (int i = 0; i < vsigs[we->sig].num; ++i) {
+		uint64_t val = 0;
+		uint64_t mval = 0;
+
+		if (i > 0)
+			printf("/");
+		if (elen > 8) {
+			/* wide, always in hex, most significant word first */
+			uint32_t *w = (uint32_t *)(v + i * elen);
+			uint32_t *mw = (uint32_t *)(m + i * elen);
+			int j;
+
+			printf("%x", w[elen / 4 - 1] & mw[elen / 4 - 1]);
+			for (j = elen / 4 - 2; j >= 0; --j)
+				printf("_%08x", w[j] & mw[j]);
+			continue;
+		}
+		memcpy(&val, v + i * elen, elen);
+		memcpy(&mval, m + i * elen, elen);
+		val &= mval;
+
+		if (we->format == FORM_HEX) {
+			printf("%lx", val);
+		} else if (we->format == FORM_DEC) {
+			printf("%ld", val);
+		} else if (we->format == FORM_BIN) {
+			int first = 0;
+			int i;
+
+			for (i = 63; i >= 0; --i) {
+				int bit = (val & (1ul << 63)) != 0;
+
+				val <<= 1;
+
+				if (bit == 0 && !first)
+					continue;
+				first = 1;
+				printf("%d", bit);
+			}
+			if (!first)
+				printf("0");
+		} else {
+			printf("invalid format %d\n", we->format);
+			exit(1);
+		}
+	}
+
+	if (c)
+		printf("%s", C_RESET);
+}
+
+/*
+ * cheap check if any watched signal differs from the last snapshot,
+ * without taking a new one
+ */
+static int
+watch_changed(watch_t *wp)
+{
+	const uint8_t *snap = wp->snap[wp->cur];
+	const uint8_t *trig = wp->trig;
+	int i;
+	int j;
+
+	for (i = 0; i < wp->n; ++i) {
+		watch_entry_t *we = wp->we + i;
+
+		if (~we->flags & WF_WATCH)
+			continue;
+		for (j = 0; j < we->len; ++j)
+			if ((snap[we->off + j] ^ we->src[j]) & trig[we->off + j])
+				return 1;
+	}
+
+	return watch_triggers_changed(wp);
+}
+
+/*
+ * any triggering difference between the two snapshots, over the whole
+ * watch set at once
+ */
+static int
+watch_any_change(watch_t *wp, const uint8_t *a, const uint8_t *b)
+{
+	const watch_vec_t *va = (const watch_vec_t *)a;
+	const watch_vec_t *vb = (const watch_vec_t *)b;
+	const watch_vec_t *vm = (const watch_vec_t *)wp->trig;
+	int n = (wp->used + WATCH_VEC - 1) / WATCH_VEC;
+	watch_vec_t acc = { 0 };
+	int i;
+	int j;
+
+	for (i = 0; i < n; ++i)
+		acc |= (va[i] ^ vb[i]) & vm[i];
+	for (j = 0; j < WATCH_VEC / 8; ++j)
+		if (acc[j])
+			return 1;
+
+	return 0;
+}
+
+static void
+do_watch(watch_t *wp, uint64_t cycle)
+{
+	int i;
+	int header_done;
+	uint8_t *prev;
+	uint8_t *next;
+
+	if (cycle - wp->last_cycle > 1000000)
+		fail("abort due to inactivity\n");
+
+	/* first, triggers may start the trace for this cycle */
+	if (wp->triggers)
+		watch_triggers_eval(wp, cycle);
+
+	if (wp->trace)
+		trace_sample(wp->trace, cycle);
+
+	/*
+	 * take a new snapshot into the older arena and compare
+	 */
+	prev = wp->snap[wp->cur];
+	next = wp->snap[wp->cur ^ 1];
+	for (i = 0; i < wp->n; ++i) {
+		watch_entry_t *we = wp->we + i;
+
+		memcpy(next + we->off, we->src, we->len);
+	}
+	wp->cur ^= 1;
+
+	if (wp->n == 0 || !watch_any_change(wp, prev, next))
+		return;
+
+	/* something changed, find out what for the output */
+	for (i = 0; i < wp->n; ++i) {
+		watch_entry_t *we = wp->we + i;
+
+		we->cmp = watch_cmp_masked(we, prev, next, wp->mask);
+	}
+
+	uint64_t diff = cycle - wp->last_cycle;
+
+	/* print all fixed values */
+	header_done = 0;
+	for (i = 0; i < wp->n; ++i) {
+		watch_entry_t *we = wp->we + i;
+		int flags = we->flags;
+
+		if (flags & WF_PRINT) {
+			if (!header_done) {
+				printf("% 10d % 6d", cycle, diff);
+				header_done = 1;
+			}
+			print_value(wp, we, COLOR_CHANGED);
+		}
+	}
+	if (header_done)
+		printf("\n");
+
+	header_done = 0;
+	/* print watch-only first */
+	for (i = 0; i < wp->n; ++i) {
+		watch_entry_t *we = wp->we + i;
+		int flags = we->flags;
+
+		if (flags & WF_WATCH && we->cmp && ~flags & WF_PRINT) {
+			if (!header_done) {
+				printf("% 10d % 6d changed", cycle, diff);
+				header_done = 1;
+			}
+			print_value(wp, we, COLOR_NONE);
+		}
+	}
+	if (header_done)
+		printf("\n");
+
+	wp->last_cycle = cycle;
+}
+
+#endif